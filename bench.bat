@@ -0,0 +1,3 @@
+@echo off
+g++ -Ofast -o bench.exe src/Benchmark.cpp
+IF EXIST bench.exe bench.exe -o bench.json %*
@@ -0,0 +1,9 @@
+@echo off
+g++ -Ofast -o micro.exe src/Microbench.cpp
+g++ -Ofast -DAABB_SLAB_VARIANT=1 -o micro_aabb1.exe src/Microbench.cpp
+g++ -Ofast -DTRIANGLE_VARIANT=1 -o micro_triangle1.exe src/Microbench.cpp
+g++ -Ofast -DREC_INTERSECTION=1 -o micro_recursive.exe src/Microbench.cpp
+IF EXIST micro.exe micro.exe -o micro.json %*
+IF EXIST micro_aabb1.exe micro_aabb1.exe -o micro_aabb1.json %*
+IF EXIST micro_triangle1.exe micro_triangle1.exe -o micro_triangle1.json %*
+IF EXIST micro_recursive.exe micro_recursive.exe -o micro_recursive.json %*
@@ -2,8 +2,6 @@
 
 #include "Triangle.h"
 
-unsigned long long AABBIntersectionCount = 0;
-
 struct AABB{
 	Vector3 min, max;
 
@@ -26,7 +24,7 @@ struct AABB{
 		return max;
     }
 
-	void fix(std::shared_ptr<Observable> obs){
+	void fix(const std::shared_ptr<Observable>& obs){
 		Vector3 v0 = obs->min_vertex();
 		Vector3 v1 = obs->max_vertex();
 		min = Vector3::min(min, v0);
@@ -61,8 +59,15 @@ struct AABB{
 };
 
 
+// slab test the trees use, can be picked on the command line to compare them with the kernel benchmarks
+// 0 takes the min and max of whole vectors, 1 goes through the axes one at a time
+#ifndef AABB_SLAB_VARIANT
+#define AABB_SLAB_VARIANT 0
+#endif
+
+#if AABB_SLAB_VARIANT == 0
 inline float AABBIntersection(const AABB& aabb, const Ray& ray){
-    AABBIntersectionCount++;
+    PERF_COUNT(COUNTER_AABB_TESTS);
 	Vector3 min = aabb.min;
 	Vector3 max = aabb.max;
     // ray AABB intersection using ray slab intersection algorithm
@@ -76,11 +81,9 @@ inline float AABBIntersection(const AABB& aabb, const Ray& ray){
 
     return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : FINF;
 }
-
-
-/*
+#else
 inline float AABBIntersection(const AABB& aabb, const Ray& ray){
-	AABBIntersectionCount++;
+	PERF_COUNT(COUNTER_AABB_TESTS);
 	Vector3 bmin = aabb.min;
 	Vector3 bmax = aabb.max;
     float tx1 = (bmin.x-ray.origin.x) * ray.inv_direction.x, tx2 = (bmax.x-ray.origin.x) * ray.inv_direction.x;
@@ -89,9 +92,10 @@ inline float AABBIntersection(const AABB& aabb, const Ray& ray){
     tmin = fmax( tmin, fmin( ty1, ty2 ) ), tmax = fmin( tmax, fmax( ty1, ty2 ) );
     float tz1 = (bmin.z-ray.origin.z) * ray.inv_direction.z, tz2 = (bmax.z-ray.origin.z) * ray.inv_direction.z;
     tmin = fmax( tmin, fmin( tz1, tz2 ) ), tmax = fmin( tmax, fmax( tz1, tz2 ) );
-    if (tmax >= tmin && tmax > 0) return tmin; else return 1e30f;
+    // misses are FINF like the vector version, the trees test for it
+    if (tmax >= tmin && tmax > 0) return tmin; else return FINF;
 }
-*/
+#endif
 
 /*
 inline bool AABBIntersection(const Vector3& center, const Vector3& e, Triangle& tri){
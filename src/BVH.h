@@ -3,8 +3,15 @@
 #include "Observable.h"
 #include "AABB.h"
 #include "Triangle.h"
+#include "MemoryAccounting.h"
 
+// 1 walks the tree recursively, 0 iteratively with an explicit stack, nearest child first
+#ifndef REC_INTERSECTION
 #define REC_INTERSECTION 0
+#endif
+
+// deepest tree the traversal stack has room for, the builds stop splitting at this depth
+const uint BVH_MAX_DEPTH = 200;
 
 struct BVHNode{
     AABB aabb;
@@ -28,12 +35,20 @@ struct BVHSplitBucket{
 
 struct BVH: public Observable{
     std::vector<BVHNode> nodes;
+    // the tree still owns its objects, rays only reach them through references to these pointers
+    // and never copy one, so ownership costs nothing per ray
     std::vector<std::shared_ptr<Observable>> observables;
+    // the trees of meshes hold their triangles here instead of in observables, side by side in one
+    // array and tested without a virtual call or a shared pointer each, indices then refer to these
+    std::vector<Triangle> triangles;
     std::vector<int> indices;
 
     uint root_index;
     uint nodes_used;
     uint N;
+    // nodes and indices, and the triangles or the shared pointers of the observables
+    MemoryCharge node_memory = MemoryCharge(MEMORY_BVH_NODES);
+    MemoryCharge primitive_memory = MemoryCharge(MEMORY_PRIMITIVES);
 
     Vector3 min_vertex(){
         return nodes[root_index].aabb.min;
@@ -54,23 +69,126 @@ struct BVH: public Observable{
 
     BVH(std::vector<std::shared_ptr<Observable>>& obs){
         observables = obs;
-        N = observables.size();
+        build_new(observables.size());
+    }
+
+    BVH(std::vector<Triangle> triangles_){
+        triangles = std::move(triangles_);
+        build_new(triangles.size());
+    }
+
+    // a tree built on an earlier run, the nodes and indices exactly as build() left them
+    BVH(std::vector<std::shared_ptr<Observable>>& obs, std::vector<BVHNode> nodes_, std::vector<int> indices_){
+        observables = obs;
+        reuse(observables.size(), std::move(nodes_), std::move(indices_));
+    }
+
+    BVH(std::vector<Triangle> triangles_, std::vector<BVHNode> nodes_, std::vector<int> indices_){
+        triangles = std::move(triangles_);
+        reuse(triangles.size(), std::move(nodes_), std::move(indices_));
+    }
+
+    void build_new(uint count){
+        N = count;
+        // an empty tree has no root, N * 2 - 1 nodes would wrap around
+        if (N == 0){
+            return;
+        }
         indices.resize(N);
         for (int i = 0; i < N; i++){
             indices[i] = i;
         }
         nodes.resize(N * 2 - 1);
+        account_memory();
         root_index = 0;
         nodes_used = 1;
         build();
     }
 
+    void reuse(uint count, std::vector<BVHNode> nodes_, std::vector<int> indices_){
+        N = count;
+        nodes = std::move(nodes_);
+        indices = std::move(indices_);
+        root_index = 0;
+        nodes_used = nodes.size();
+        account_memory();
+    }
+
+    // whether nodes and indices form a tree over count primitives that traversal can walk safely,
+    // for trees read back from disk, children come after their parent so the walk always ends
+    static bool valid_tree(const std::vector<BVHNode>& nodes_, const std::vector<int>& indices_, size_t count){
+        if (nodes_.empty() || indices_.size() != count){
+            return false;
+        }
+        for (int index: indices_){
+            if (index < 0 || (size_t) index >= count){
+                return false;
+            }
+        }
+        std::vector<std::pair<uint, uint>> stack = {{0, 1}};
+        size_t visited = 0;
+        while (!stack.empty()){
+            uint ind = stack.back().first;
+            uint depth = stack.back().second;
+            stack.pop_back();
+            const BVHNode& node = nodes_[ind];
+            if (++visited > nodes_.size() || depth > BVH_MAX_DEPTH){
+                return false;
+            }
+            if (node.observable_count > 0){
+                if ((uint64_t) node.first_index + node.observable_count > indices_.size()){
+                    return false;
+                }
+                continue;
+            }
+            if (node.left_child <= ind || (uint64_t) node.left_child + 1 >= nodes_.size()){
+                return false;
+            }
+            stack.push_back({node.left_child, depth + 1});
+            stack.push_back({node.left_child + 1, depth + 1});
+        }
+        return true;
+    }
+
+    void account_memory(){
+        node_memory.set(nodes.capacity() * sizeof(BVHNode) + indices.capacity() * sizeof(int));
+        primitive_memory.set(triangles.capacity() * sizeof(Triangle) + observables.capacity() * sizeof(std::shared_ptr<Observable>));
+    }
+
+    inline Vector3 leaf_centroid(int i){
+        return triangles.empty() ? observables[i]->centroid() : triangles[i].centroid();
+    }
+
+    void fix_leaf(AABB& box, int i){
+        if (triangles.empty()){
+            box.fix(observables[i]);
+            return;
+        }
+        box.min = Vector3::min(box.min, triangles[i].min_vertex());
+        box.max = Vector3::max(box.max, triangles[i].max_vertex());
+    }
+
+    // the triangles are called by their own type so the test is inlined
+    inline bool intersect_leaf(int i, const Ray& ray, RayHit& inter){
+        if (!triangles.empty()){
+            return triangles[i].Triangle::intersect(ray, inter);
+        }
+        return observables[i]->intersect(ray, inter);
+    }
+
+    void select_lod(const Camera& cam){
+        for (auto& obs: observables){
+            obs->select_lod(cam);
+        }
+    }
+
     void build(){
+        TRACE_SCOPE("BVH::build");
         BVHNode& root = nodes[root_index];
         root.first_index = 0;
         root.observable_count = N;
         refit_node(root_index);
-        sah_divide(root_index);
+        sah_divide(root_index, 0);
     }
 
 
@@ -81,14 +199,13 @@ struct BVH: public Observable{
         box.max = Vector3(-1e8f);
         uint first = node.first_index;
         for (uint i = 0; i < node.observable_count; i++){
-            std::shared_ptr<Observable> obs = observables[indices[first + i]];
-            box.fix(obs);
+            fix_leaf(box, indices[first + i]);
         }
     }
 
-    void basic_divide(uint ind){
+    void basic_divide(uint ind, uint depth){
         BVHNode& node = nodes[ind];
-        if (node.observable_count <= 2){
+        if (node.observable_count <= 2 || depth + 1 >= BVH_MAX_DEPTH){
             return;
         }
         AABB& box = node.aabb;
@@ -102,7 +219,7 @@ struct BVH: public Observable{
         uint j = i + node.observable_count - 1;
 
         while (i <= j){
-            if (observables[indices[i]]->centroid()[axis] < split){
+            if (leaf_centroid(indices[i])[axis] < split){
                 i++;
             }
             else{
@@ -126,13 +243,13 @@ struct BVH: public Observable{
         refit_node(left_ind);
         refit_node(right_ind);
 
-        basic_divide(left_ind);
-        basic_divide(right_ind);
+        basic_divide(left_ind, depth + 1);
+        basic_divide(right_ind, depth + 1);
     }
 
-    void sah_divide(uint ind){
+    void sah_divide(uint ind, uint depth){
         BVHNode& node = nodes[ind];
-        if (node.observable_count <= 2){
+        if (node.observable_count <= 2 || depth + 1 >= BVH_MAX_DEPTH){
             return;
         }
         constexpr int nbuckets = 20;
@@ -145,10 +262,10 @@ struct BVH: public Observable{
         if (extents.z > extents[axis]) axis = 2;
 
         for (uint i = 0; i < node.observable_count; i++){
-            int b = nbuckets * nodes_box.offset(observables[indices[node.first_index + i]]->centroid())[axis];
+            int b = nbuckets * nodes_box.offset(leaf_centroid(indices[node.first_index + i]))[axis];
             if (b == nbuckets) b = nbuckets - 1;
             buckets[b].count++;
-            buckets[b].box.fix(observables[indices[node.first_index + i]]);
+            fix_leaf(buckets[b].box, indices[node.first_index + i]);
         }
 
         constexpr int nsplits = nbuckets - 1;
@@ -184,7 +301,7 @@ struct BVH: public Observable{
             int j = i + node.observable_count - 1;
 
             while (i <= j){
-                if (observables[indices[i]]->centroid()[axis] < split){
+                if (leaf_centroid(indices[i])[axis] < split){
                     i++;
                 }
                 else{
@@ -208,8 +325,8 @@ struct BVH: public Observable{
             refit_node(left_ind);
             refit_node(right_ind);
 
-            sah_divide(left_ind);
-            sah_divide(right_ind);
+            sah_divide(left_ind, depth + 1);
+            sah_divide(right_ind, depth + 1);
         }
     }
 
@@ -218,13 +335,13 @@ struct BVH: public Observable{
         bool hit = false;
         BVHNode& node = nodes[ind];
         float t = AABBIntersection(node.aabb, ray);
-        if (t < 0 || t > inter.distance){
+        if (t == FINF || t > inter.distance){
             return false;
         }
+        PERF_COUNT(COUNTER_NODES_VISITED);
         if (node.is_leaf()){
             for (uint i = 0; i < node.observable_count; i++){
-                Triangle& tri = observables[indices[node.first_index + i]];
-                hit |= ray_triangle(ray, inter, tri);
+                hit |= intersect_leaf(indices[node.first_index + i], ray, inter);
             }
         }
         else{
@@ -235,27 +352,22 @@ struct BVH: public Observable{
     }
 
     bool intersect(const Ray& ray, RayHit& inter){
-        bool hit = false;
-        float t = AABBIntersection(nodes[root_index].aabb, ray);
-        if (t > 0 && t < inter.distance){
-            hit = intersect_BVH(ray, inter, root_index);
-        }
-        return hit;
+        return intersect_BVH(ray, inter, root_index);
     }
 #else
     bool intersect(const Ray& ray, RayHit& inter){
-        if (AABBIntersection(nodes[root_index].aabb, ray) == FINF){
+        if (nodes.empty() || AABBIntersection(nodes[root_index].aabb, ray) == FINF){
             return false;
         }
         bool hit = false;
-        BVHNode* node = &nodes[root_index], *stack[200];
+        BVHNode* node = &nodes[root_index], *stack[BVH_MAX_DEPTH];
         uint stack_ptr = 0;
         while (true){
+            PERF_COUNT(COUNTER_NODES_VISITED);
             if (node->is_leaf()){
                 uint first = node->first_index;
                 for (uint i = 0; i < node->observable_count; i++){
-                    std::shared_ptr<Observable>& obs = observables[indices[first + i]];
-                    hit |= obs->intersect(ray, inter);
+                    hit |= intersect_leaf(indices[first + i], ray, inter);
                 }
                 if (stack_ptr == 0){
                     break;
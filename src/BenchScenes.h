@@ -0,0 +1,208 @@
+#pragma once
+
+#include <array>
+#include "TriangleMesh.h"
+#include "Instance.h"
+
+// procedural scenes shared by the render and kernel benchmarks
+
+// a mesh over a shared vertex list, texcoord and normal indices follow the vertex indices
+// so normals are smoothed wherever triangles share a vertex
+std::shared_ptr<TriangleMesh> make_mesh(const std::string& name, std::vector<Vector3>& vertices, const std::vector<std::array<int, 3>>& triangles, const Material& mat){
+    std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+    mesh->name = name;
+    mesh->mat = mat;
+    mesh->vertices = std::move(vertices);
+    mesh->texcoords.resize(mesh->vertices.size(), Vector3(0,0,0));
+    mesh->faces.reserve(triangles.size());
+    for (const std::array<int, 3>& tri: triangles){
+        int a = tri[0] + 1, b = tri[1] + 1, c = tri[2] + 1;
+        mesh->faces.push_back({a, a, a, b, b, b, c, c, c});
+    }
+    mesh->calculate_normals();
+    // recalc_bounding_box prints the mesh, too much for hundreds of spheres
+    mesh->boundingBox[0] = Vector3(1e8);
+    mesh->boundingBox[1] = Vector3(-1e8);
+    for (const Vector3& v: mesh->vertices){
+        mesh->boundingBox[0] = Vector3::min(mesh->boundingBox[0], v);
+        mesh->boundingBox[1] = Vector3::max(mesh->boundingBox[1], v);
+    }
+    return mesh;
+}
+
+// quad a b c d, counter clockwise seen from the side it faces, with its own vertices so it stays flat shaded
+void add_quad(std::vector<Vector3>& vertices, std::vector<std::array<int, 3>>& triangles, Vector3 a, Vector3 b, Vector3 c, Vector3 d){
+    int base = vertices.size();
+    vertices.insert(vertices.end(), {a, b, c, d});
+    triangles.push_back({base, base + 1, base + 2});
+    triangles.push_back({base, base + 2, base + 3});
+}
+
+// the unit cube around the origin moved by matrix
+void add_box(std::vector<Vector3>& vertices, std::vector<std::array<int, 3>>& triangles, const Mat4& matrix){
+    Vector3 c[8];
+    for (int i = 0; i < 8; i++){
+        c[i] = Mat4::transform_point(matrix, Vector3((i & 1) - 0.5f, ((i >> 1) & 1) - 0.5f, (i >> 2) - 0.5f));
+    }
+    add_quad(vertices, triangles, c[0], c[2], c[3], c[1]);
+    add_quad(vertices, triangles, c[4], c[5], c[7], c[6]);
+    add_quad(vertices, triangles, c[0], c[1], c[5], c[4]);
+    add_quad(vertices, triangles, c[2], c[6], c[7], c[3]);
+    add_quad(vertices, triangles, c[0], c[4], c[6], c[2]);
+    add_quad(vertices, triangles, c[1], c[3], c[7], c[5]);
+}
+
+// uv sphere with one vertex at each pole, 2 * segments * (rings - 1) triangles
+void add_sphere(std::vector<Vector3>& vertices, std::vector<std::array<int, 3>>& triangles, Vector3 centre, float radius, int segments, int rings){
+    int top = vertices.size();
+    vertices.push_back(centre + Vector3(0, 0, radius));
+    for (int r = 1; r < rings; r++){
+        float theta = M_PI * r / rings;
+        for (int s = 0; s < segments; s++){
+            float phi = 2 * M_PI * s / segments;
+            vertices.push_back(centre + radius * Vector3(sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)));
+        }
+    }
+    int bottom = vertices.size();
+    vertices.push_back(centre - Vector3(0, 0, radius));
+
+    auto ring = [&](int r, int s){return top + 1 + (r - 1) * segments + (s % segments);};
+    for (int s = 0; s < segments; s++){
+        triangles.push_back({top, ring(1, s), ring(1, s + 1)});
+        triangles.push_back({bottom, ring(rings - 1, s + 1), ring(rings - 1, s)});
+    }
+    for (int r = 1; r < rings - 1; r++){
+        for (int s = 0; s < segments; s++){
+            triangles.push_back({ring(r, s), ring(r + 1, s), ring(r + 1, s + 1)});
+            triangles.push_back({ring(r, s), ring(r + 1, s + 1), ring(r, s + 1)});
+        }
+    }
+}
+
+std::shared_ptr<TriangleMesh> ground_mesh(float x0, float y0, float x1, float y1, const Material& mat){
+    std::vector<Vector3> vertices;
+    std::vector<std::array<int, 3>> triangles;
+    add_quad(vertices, triangles, Vector3(x0, y0, 0), Vector3(x1, y0, 0), Vector3(x1, y1, 0), Vector3(x0, y1, 0));
+    return make_mesh("ground", vertices, triangles, mat);
+}
+
+
+// a scene built entirely in code so every run traces exactly the same geometry
+struct BenchScene{
+    std::string name;
+    // with placements the first mesh is instanced at each of them and the rest are added as they are
+    std::vector<std::shared_ptr<TriangleMesh>> meshes;
+    std::vector<Mat4> placements;
+    Vector3 camera_position, camera_target;
+    Vector3 light_position;
+    float light_intensity;
+
+    // triangles in the scene, counting each instance
+    unsigned long long triangles(){
+        unsigned long long count = 0;
+        for (size_t i = 0; i < meshes.size(); i++){
+            count += meshes[i]->faces.size() * ((i == 0 && !placements.empty()) ? placements.size() : 1);
+        }
+        return count;
+    }
+
+    // build every tree, returns the top level BVH over the scenes objects
+    std::shared_ptr<BVH> build(){
+        for (std::shared_ptr<TriangleMesh>& mesh: meshes){
+            mesh->recalc_tree();
+        }
+        std::vector<std::shared_ptr<Observable>> objects;
+        size_t first = 0;
+        if (!placements.empty()){
+            for (const Mat4& matrix: placements){
+                objects.push_back(std::make_shared<Instance>(meshes[0], matrix));
+            }
+            first = 1;
+        }
+        for (size_t i = first; i < meshes.size(); i++){
+            objects.push_back(meshes[i]);
+        }
+        return std::make_shared<BVH>(objects);
+    }
+};
+
+BenchScene cornell_scene(){
+    BenchScene scene;
+    scene.name = "cornell";
+    std::vector<Vector3> vertices;
+    std::vector<std::array<int, 3>> triangles;
+    // floor, ceiling and back wall, open towards the camera
+    add_quad(vertices, triangles, Vector3(-5, -5, 0), Vector3(5, -5, 0), Vector3(5, 5, 0), Vector3(-5, 5, 0));
+    add_quad(vertices, triangles, Vector3(-5, -5, 10), Vector3(-5, 5, 10), Vector3(5, 5, 10), Vector3(5, -5, 10));
+    add_quad(vertices, triangles, Vector3(-5, 5, 0), Vector3(5, 5, 0), Vector3(5, 5, 10), Vector3(-5, 5, 10));
+    scene.meshes.push_back(make_mesh("walls", vertices, triangles, DefaultMaterial("#BBBBBB")));
+
+    vertices.clear();
+    triangles.clear();
+    add_quad(vertices, triangles, Vector3(-5, -5, 0), Vector3(-5, 5, 0), Vector3(-5, 5, 10), Vector3(-5, -5, 10));
+    scene.meshes.push_back(make_mesh("red wall", vertices, triangles, DefaultMaterial("#BB2222")));
+
+    vertices.clear();
+    triangles.clear();
+    add_quad(vertices, triangles, Vector3(5, -5, 0), Vector3(5, -5, 10), Vector3(5, 5, 10), Vector3(5, 5, 0));
+    scene.meshes.push_back(make_mesh("green wall", vertices, triangles, DefaultMaterial("#22BB22")));
+
+    vertices.clear();
+    triangles.clear();
+    add_box(vertices, triangles, Mat4::create_translation(Vector3(-1.8, 1.5, 3)) * Mat4::create_rotation(Vector3(0, 0, 0.3)) * Mat4::create_scalar(Vector3(3, 3, 6)));
+    add_box(vertices, triangles, Mat4::create_translation(Vector3(1.8, -1.5, 1.5)) * Mat4::create_rotation(Vector3(0, 0, -0.3)) * Mat4::create_scalar(Vector3(3, 3, 3)));
+    scene.meshes.push_back(make_mesh("blocks", vertices, triangles, DefaultMaterial("#DDDDDD")));
+
+    scene.camera_position = Vector3(0, -18, 7);
+    scene.camera_target = Vector3(0, 0, 3.5);
+    scene.light_position = Vector3(0, 0, 9);
+    scene.light_intensity = 100;
+    return scene;
+}
+
+// a grid of separately meshed spheres on a ground plane
+BenchScene sphere_field_scene(int count = 16, int segments = 48, int rings = 24){
+    BenchScene scene;
+    scene.name = "sphere_field";
+    for (int i = 0; i < count * count; i++){
+        std::vector<Vector3> vertices;
+        std::vector<std::array<int, 3>> triangles;
+        Vector3 centre = Vector3(2 * (i % count), 2 * (i / count), 0.8f);
+        add_sphere(vertices, triangles, centre, 0.8f, segments, rings);
+        scene.meshes.push_back(make_mesh("sphere" + std::to_string(i), vertices, triangles, DefaultMaterial((i % 2) ? "#CC8844" : "#4488CC")));
+    }
+    scene.meshes.push_back(ground_mesh(-2, -2, 2 * count, 2 * count, DefaultMaterial("#888888")));
+
+    float middle = count - 1;
+    scene.camera_position = Vector3(-6, -6, 10);
+    scene.camera_target = Vector3(middle, middle, 0);
+    scene.light_position = Vector3(middle, -10, 30);
+    scene.light_intensity = 2000;
+    return scene;
+}
+
+// one sphere mesh shared by a dense grid of instances, each turned and scaled a little differently
+BenchScene instance_scene(int count = 64, int segments = 64, int rings = 32){
+    BenchScene scene;
+    scene.name = "instances";
+    std::vector<Vector3> vertices;
+    std::vector<std::array<int, 3>> triangles;
+    add_sphere(vertices, triangles, Vector3(0, 0, 0), 1, segments, rings);
+    scene.meshes.push_back(make_mesh("sphere", vertices, triangles, DefaultMaterial("#AA66CC")));
+    for (int i = 0; i < count * count; i++){
+        // a fixed hash of the index, so the layout never depends on a random generator
+        uint32_t h = (uint32_t) i * 2654435761u;
+        float scale = 0.3f + 0.4f * ((h >> 8) & 0xff) / 255.0f;
+        float angle = 2 * M_PI * ((h >> 16) & 0xff) / 255.0f;
+        Vector3 position = Vector3(1.6f * (i % count), 1.6f * (i / count), scale * 0.6f);
+        scene.placements.push_back(Mat4::create_translation(position) * Mat4::create_rotation(Vector3(0, 0, angle)) * Mat4::create_scalar(Vector3(scale, scale, scale * 0.6f)));
+    }
+    scene.meshes.push_back(ground_mesh(-2, -2, 1.6f * count, 1.6f * count, DefaultMaterial("#888888")));
+
+    float middle = 0.8f * (count - 1);
+    scene.camera_position = Vector3(-4, -4, 8);
+    scene.camera_target = Vector3(middle, middle, 0);
+    scene.light_position = Vector3(middle, -10, 40);
+    scene.light_intensity = 3000;
+    return scene;
+}
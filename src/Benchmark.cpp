@@ -0,0 +1,463 @@
+// renders a fixed set of procedural scenes and times the parts of the renderer, so runs on
+// different commits and machines can be compared, results are written as JSON
+// usage: bench [-o results.json] [-size width height] [-repeat n] [-threads n] [-label name] [-variant name]
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <sstream>
+#include "Scene.h"
+#include "Renderer.h"
+#include "SphericalLight.h"
+#include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "BenchScenes.h"
+#include "QOI.h"
+#include "Json.h"
+
+int BENCH_WIDTH = 640;
+int BENCH_HEIGHT = 360;
+// every timing is the best of this many runs
+int BENCH_REPEAT = 3;
+// rays are handed to the threads in blocks of this many
+const int BENCH_BLOCK = 1024;
+const uint32_t BENCH_SEED = 1234;
+// offset along the normal for rays leaving a surface
+const float BENCH_BIAS = 1e-3f;
+
+
+// throws away the pixels of a benchmark render
+struct NullWriter : public ImageWriter{
+    void write_rgb8(const uint8_t*, size_t) override{}
+    void finish() override{}
+};
+
+
+// best time of repeat calls of f in ms
+double best_ms(int repeat, const std::function<void()>& f){
+    double best = 1e30;
+    for (int i = 0; i < repeat; i++){
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+// body(begin, end) for blocks of [0, count) spread over the threads
+void parallel_blocks(size_t count, int threads, const std::function<void(size_t, size_t)>& body){
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++){
+        workers.emplace_back([&](){
+            for (size_t begin = next.fetch_add(BENCH_BLOCK); begin < count; begin = next.fetch_add(BENCH_BLOCK)){
+                body(begin, std::min(count, begin + BENCH_BLOCK));
+            }
+        });
+    }
+    for (std::thread& thread: workers){
+        thread.join();
+    }
+}
+
+
+struct SceneResult{
+    std::string name;
+    unsigned long long triangles;
+    size_t objects;
+    double build_ms;
+    double primary_mrays, shadow_mrays, diffuse_mrays;
+    // how many rays hit, the same on every run of one commit so a changed count means changed results
+    size_t primary_hits, shadow_occluded, diffuse_hits;
+    // building the RENDER_VARIANT kernel, once per scene and outside render_ms
+    double kernel_ms;
+    double render_ms;
+};
+
+// closest hit of every ray, a ray only finds hits closer than the distance its hit starts with
+void trace_rays(Scene& world, const std::vector<Ray>& rays, std::vector<RayHit>& hits, const std::vector<float>& max_distance, PerfCounter type, int threads){
+    // only counted in builds with PERF_COUNTERS
+    (void) type;
+    parallel_blocks(rays.size(), threads, [&](size_t begin, size_t end){
+        PERF_ADD(type, end - begin);
+        for (size_t i = begin; i < end; i++){
+            hits[i] = RayHit();
+            if (!max_distance.empty()){
+                hits[i].distance = max_distance[i];
+            }
+            world.closest_intersection(hits[i], rays[i]);
+        }
+    });
+}
+
+double mrays(size_t rays, double ms){
+    return (ms > 0) ? rays / (ms * 1000) : 0;
+}
+
+SceneResult run_scene(BenchScene scene, int threads){
+    std::cout << "Benchmarking " << scene.name << "..." << std::endl;
+    SceneResult result;
+    result.name = scene.name;
+    result.triangles = scene.triangles();
+
+    std::shared_ptr<BVH> top;
+    result.build_ms = best_ms(BENCH_REPEAT, [&](){top = scene.build();});
+    result.objects = top->observables.size();
+
+    Scene world = Scene();
+    world.add_object(top);
+    world.ambientColour = Vector3::to_colour("#FFFFFF") * 0.3;
+    world.add_light(std::make_shared<SphericalLight>(scene.light_position, Vector3::to_colour("#FFFFFF"), scene.light_intensity, 0));
+    world.cam.setup(scene.camera_position, scene.camera_target);
+    world.setup_camera(BENCH_WIDTH, BENCH_HEIGHT);
+
+    // rays are made before the clock starts, only tracing them is timed
+    std::vector<Ray> primary;
+    primary.reserve((size_t) BENCH_WIDTH * BENCH_HEIGHT);
+    for (int z = 0; z < BENCH_HEIGHT; z++){
+        for (int x = 0; x < BENCH_WIDTH; x++){
+            primary.push_back(world.cam.cast_ray(x, z));
+        }
+    }
+    std::vector<RayHit> hits(primary.size());
+    double primary_ms = best_ms(BENCH_REPEAT, [&](){trace_rays(world, primary, hits, {}, COUNTER_PRIMARY_RAYS, threads);});
+    result.primary_mrays = mrays(primary.size(), primary_ms);
+
+    // shadow rays towards the light and diffuse bounces from every primary hit
+    std::vector<Ray> shadow, diffuse;
+    std::vector<float> light_distance;
+    seed_random(BENCH_SEED);
+    for (const RayHit& hit: hits){
+        if (hit.distance == FINF){
+            continue;
+        }
+        Vector3 origin = hit.point + hit.normal * BENCH_BIAS;
+        Vector3 to_light = scene.light_position - origin;
+        float distance = Vector3::length(to_light);
+        shadow.push_back(Ray(origin, to_light / distance));
+        light_distance.push_back(distance);
+        diffuse.push_back(Ray(origin, random_hemisphere_vector(hit.normal)));
+    }
+    result.primary_hits = shadow.size();
+
+    std::vector<RayHit> shadow_hits(shadow.size());
+    double shadow_ms = best_ms(BENCH_REPEAT, [&](){trace_rays(world, shadow, shadow_hits, light_distance, COUNTER_SHADOW_RAYS, threads);});
+    result.shadow_mrays = mrays(shadow.size(), shadow_ms);
+    result.shadow_occluded = 0;
+    for (size_t i = 0; i < shadow_hits.size(); i++){
+        result.shadow_occluded += shadow_hits[i].distance < light_distance[i];
+    }
+
+    std::vector<RayHit> diffuse_hits(diffuse.size());
+    double diffuse_ms = best_ms(BENCH_REPEAT, [&](){trace_rays(world, diffuse, diffuse_hits, {}, COUNTER_BOUNCE_RAYS, threads);});
+    result.diffuse_mrays = mrays(diffuse.size(), diffuse_ms);
+    result.diffuse_hits = 0;
+    for (const RayHit& hit: diffuse_hits){
+        result.diffuse_hits += hit.distance != FINF;
+    }
+
+    // the whole renderer, shading and tile scheduling included
+    NullWriter null_output;
+    Renderer ren = Renderer(&null_output, BENCH_WIDTH, BENCH_HEIGHT, world);
+    ren.threads = threads;
+    result.kernel_ms = best_ms(1, [&](){ren.prepare_kernel();});
+    result.render_ms = best_ms(BENCH_REPEAT, [&](){ren.render();});
+    return result;
+}
+
+
+struct ObjResult{
+    size_t bytes;
+    size_t faces;
+    double parse_ms, load_ms, cached_load_ms;
+};
+
+// writes the sphere field out as an OBJ and times reading it back
+ObjResult run_obj(){
+    std::cout << "Benchmarking OBJ loading..." << std::endl;
+    ObjResult result;
+    std::string filename = (std::filesystem::temp_directory_path() / "bench_sphere_field.obj").string();
+    BenchScene scene = sphere_field_scene();
+    {
+        std::ofstream file(filename);
+        file << "# procedural sphere field written by bench\n";
+        int base = 1;
+        for (size_t m = 0; m < scene.meshes.size(); m++){
+            TriangleMesh& mesh = *scene.meshes[m];
+            file << "o mesh" << m << "\n";
+            for (const Vector3& v: mesh.vertices){
+                file << "v " << v.x << " " << v.y << " " << v.z << "\n";
+            }
+            for (const Vector3& n: mesh.normals){
+                file << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+            }
+            for (const Face& face: mesh.faces){
+                file << "f " << face[0] + base - 1 << "//" << face[2] + base - 1 << " " << face[3] + base - 1 << "//" << face[5] + base - 1
+                     << " " << face[6] + base - 1 << "//" << face[8] + base - 1 << "\n";
+            }
+            base += mesh.vertices.size();
+        }
+    }
+    result.bytes = std::filesystem::file_size(filename);
+
+    result.parse_ms = best_ms(BENCH_REPEAT, [&](){
+        ObjData obj;
+        parse_obj(filename, obj);
+        result.faces = obj.faces.size();
+    });
+    // without a cache file load_obj builds every tree and writes the cache, the next load reads it
+    std::string cache = scene_cache_filename(filename);
+    result.load_ms = best_ms(BENCH_REPEAT, [&](){
+        std::filesystem::remove(cache);
+        BVH bvh = load_obj(filename);
+    });
+    result.cached_load_ms = best_ms(BENCH_REPEAT, [&](){BVH bvh = load_obj(filename);});
+    std::filesystem::remove(cache);
+    std::filesystem::remove(filename);
+    return result;
+}
+
+
+struct GlbResult{
+    size_t bytes;
+    size_t faces;
+    double load_ms;
+};
+
+// the sphere field as a binary glTF, one node per mesh with its positions, normals and indices
+// the meshes index every attribute with the vertex index, so each corner needs one index
+void write_glb(const std::string& filename, BenchScene& scene){
+    std::string bin;
+    std::ostringstream views, accessors, meshes, nodes;
+    int view_count = 0;
+    auto add_view = [&](const void* data, size_t bytes){
+        views << (view_count > 0 ? "," : "") << "{\"buffer\": 0, \"byteOffset\": " << bin.size() << ", \"byteLength\": " << bytes << "}";
+        bin.append((const char*) data, bytes);
+        return view_count++;
+    };
+    for (size_t m = 0; m < scene.meshes.size(); m++){
+        TriangleMesh& mesh = *scene.meshes[m];
+        std::vector<float> positions, normals;
+        for (size_t i = 0; i < mesh.vertices.size(); i++){
+            positions.insert(positions.end(), {mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z});
+            normals.insert(normals.end(), {mesh.normals[i].x, mesh.normals[i].y, mesh.normals[i].z});
+        }
+        std::vector<uint32_t> indices;
+        for (const Face& face: mesh.faces){
+            indices.insert(indices.end(), {(uint32_t) face[0] - 1, (uint32_t) face[3] - 1, (uint32_t) face[6] - 1});
+        }
+        int first = 3 * m;
+        int position_view = add_view(positions.data(), positions.size() * sizeof(float));
+        int normal_view = add_view(normals.data(), normals.size() * sizeof(float));
+        int index_view = add_view(indices.data(), indices.size() * sizeof(uint32_t));
+        const Vector3* box = mesh.boundingBox;
+        accessors << (m > 0 ? "," : "")
+                  << "{\"bufferView\": " << position_view << ", \"componentType\": " << GLTF_FLOAT << ", \"count\": " << mesh.vertices.size()
+                  << ", \"type\": \"VEC3\", \"min\": [" << box[0].x << ", " << box[0].y << ", " << box[0].z << "], \"max\": ["
+                  << box[1].x << ", " << box[1].y << ", " << box[1].z << "]},"
+                  << "{\"bufferView\": " << normal_view << ", \"componentType\": " << GLTF_FLOAT << ", \"count\": " << mesh.vertices.size() << ", \"type\": \"VEC3\"},"
+                  << "{\"bufferView\": " << index_view << ", \"componentType\": " << GLTF_UNSIGNED_INT << ", \"count\": " << indices.size() << ", \"type\": \"SCALAR\"}";
+        meshes << (m > 0 ? "," : "") << "{\"name\": " << json_quote(mesh.name) << ", \"primitives\": [{\"attributes\": {\"POSITION\": " << first
+               << ", \"NORMAL\": " << first + 1 << "}, \"indices\": " << first + 2 << "}]}";
+        nodes << (m > 0 ? "," : "") << "{\"mesh\": " << m << "}";
+    }
+    std::ostringstream json;
+    json << "{\"asset\": {\"version\": \"2.0\", \"generator\": \"bench\"}, \"scene\": 0, \"scenes\": [{\"nodes\": [";
+    for (size_t m = 0; m < scene.meshes.size(); m++){
+        json << (m > 0 ? ", " : "") << m;
+    }
+    json << "]}], \"nodes\": [" << nodes.str() << "], \"meshes\": [" << meshes.str() << "], \"accessors\": [" << accessors.str()
+         << "], \"bufferViews\": [" << views.str() << "], \"buffers\": [{\"byteLength\": " << bin.size() << "}]}";
+
+    // chunks are padded to 4 bytes, the JSON with spaces and the binary with zeros
+    std::string text = json.str();
+    text.resize((text.size() + 3) & ~size_t(3), ' ');
+    bin.resize((bin.size() + 3) & ~size_t(3), '\0');
+    uint32_t header[5] = {GLB_MAGIC, 2, (uint32_t) (12 + 8 + text.size() + 8 + bin.size()), (uint32_t) text.size(), GLB_CHUNK_JSON};
+    uint32_t bin_header[2] = {(uint32_t) bin.size(), GLB_CHUNK_BIN};
+    std::ofstream file(filename, std::ios::out|std::ios::binary);
+    file.write((const char*) header, sizeof(header));
+    file.write(text.data(), text.size());
+    file.write((const char*) bin_header, sizeof(bin_header));
+    file.write(bin.data(), bin.size());
+}
+
+// writes the sphere field out as a .glb and times reading it back, to set against run_obj
+GlbResult run_glb(){
+    std::cout << "Benchmarking glTF loading..." << std::endl;
+    GlbResult result;
+    std::string filename = (std::filesystem::temp_directory_path() / "bench_sphere_field.glb").string();
+    BenchScene scene = sphere_field_scene();
+    write_glb(filename, scene);
+    result.bytes = std::filesystem::file_size(filename);
+    result.load_ms = best_ms(BENCH_REPEAT, [&](){
+        BVH bvh = load_glb(filename);
+        result.faces = 0;
+        for (std::shared_ptr<Observable>& obs: bvh.observables){
+            result.faces += std::static_pointer_cast<TriangleMesh>(obs)->faces.size();
+        }
+    });
+    std::filesystem::remove(filename);
+    return result;
+}
+
+
+struct QOIResult{
+    int width, height;
+    size_t bytes;
+    double encode_ms, decode_ms;
+};
+
+// encodes and decodes a synthetic image with smooth gradients, flat areas and noise
+QOIResult run_qoi(int width = 1920, int height = 1080){
+    std::cout << "Benchmarking QOI..." << std::endl;
+    QOIResult result = {width, height, 0, 0, 0};
+    std::vector<uint8_t> rgb((size_t) width * height * 3);
+    seed_random(BENCH_SEED);
+    for (int z = 0; z < height; z++){
+        for (int x = 0; x < width; x++){
+            uint8_t* p = &rgb[((size_t) z * width + x) * 3];
+            if (z < height / 3){
+                p[0] = x * 255 / width;
+                p[1] = z * 255 / height;
+                p[2] = 128;
+            }
+            else if (z < 2 * height / 3){
+                p[0] = p[1] = p[2] = ((x / 64 + z / 64) % 2) ? 200 : 40;
+            }
+            else{
+                p[0] = random_value() * 255;
+                p[1] = random_value() * 255;
+                p[2] = random_value() * 255;
+            }
+        }
+    }
+
+    std::string filename = (std::filesystem::temp_directory_path() / "bench_image.qoi").string();
+    result.encode_ms = best_ms(BENCH_REPEAT, [&](){
+        std::ofstream output(filename, std::ios::out|std::ios::binary);
+        QOIWriter writer = QOIWriter(output, width, height);
+        writer.write_rgb8(rgb.data(), (size_t) width * height);
+        writer.finish();
+    });
+    result.bytes = std::filesystem::file_size(filename);
+    result.decode_ms = best_ms(BENCH_REPEAT, [&](){
+        std::ifstream input(filename, std::ios::in|std::ios::binary);
+        QOIReader reader = QOIReader(input);
+        std::vector<uint32_t> pixels;
+        reader.read_all(pixels);
+    });
+    std::filesystem::remove(filename);
+    return result;
+}
+
+
+std::string compiler_name(){
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+void write_results(const std::string& filename, const std::string& label, int threads, const std::vector<SceneResult>& scenes, const ObjResult& obj, const GlbResult& glb, const QOIResult& qoi){
+    std::ofstream file(filename);
+    if (!file.is_open()){
+        std::cerr << "Could not open file " << filename << std::endl;
+        return;
+    }
+    char timestamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    file << "{\n";
+    file << "  \"label\": " << json_quote(label) << ",\n";
+    file << "  \"timestamp\": " << json_quote(timestamp) << ",\n";
+    file << "  \"compiler\": " << json_quote(compiler_name()) << ",\n";
+    file << "  \"threads\": " << threads << ",\n";
+    file << "  \"render_variant\": " << json_quote(RENDER_VARIANT) << ",\n";
+    file << "  \"width\": " << BENCH_WIDTH << ",\n";
+    file << "  \"height\": " << BENCH_HEIGHT << ",\n";
+    file << "  \"repeat\": " << BENCH_REPEAT << ",\n";
+    file << "  \"scenes\": [\n";
+    for (size_t i = 0; i < scenes.size(); i++){
+        const SceneResult& s = scenes[i];
+        file << "    {\"name\": " << json_quote(s.name) << ", \"triangles\": " << s.triangles << ", \"objects\": " << s.objects
+             << ", \"build_ms\": " << s.build_ms << ", \"primary_mrays\": " << s.primary_mrays << ", \"shadow_mrays\": " << s.shadow_mrays
+             << ", \"diffuse_mrays\": " << s.diffuse_mrays << ", \"kernel_ms\": " << s.kernel_ms << ", \"render_ms\": " << s.render_ms
+             << ", \"primary_hits\": " << s.primary_hits
+             << ", \"shadow_occluded\": " << s.shadow_occluded << ", \"diffuse_hits\": " << s.diffuse_hits << "}"
+             << (i + 1 < scenes.size() ? "," : "") << "\n";
+    }
+    file << "  ],\n";
+    file << "  \"obj\": {\"bytes\": " << obj.bytes << ", \"faces\": " << obj.faces << ", \"parse_ms\": " << obj.parse_ms
+         << ", \"load_ms\": " << obj.load_ms << ", \"cached_load_ms\": " << obj.cached_load_ms << "},\n";
+    file << "  \"glb\": {\"bytes\": " << glb.bytes << ", \"faces\": " << glb.faces << ", \"load_ms\": " << glb.load_ms << "},\n";
+    file << "  \"qoi\": {\"width\": " << qoi.width << ", \"height\": " << qoi.height << ", \"bytes\": " << qoi.bytes
+         << ", \"encode_ms\": " << qoi.encode_ms << ", \"decode_ms\": " << qoi.decode_ms << "}\n";
+    file << "}\n";
+}
+
+
+int main(int argc, char** argv){
+    std::string output = "bench.json";
+    std::string label = "";
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "-o"){
+            output = argv[++i];
+        }
+        else if (i + 2 < argc && arg == "-size"){
+            BENCH_WIDTH = atoi(argv[++i]);
+            BENCH_HEIGHT = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "-repeat"){
+            BENCH_REPEAT = std::max(1, atoi(argv[++i]));
+        }
+        else if (i + 1 < argc && arg == "-threads"){
+            threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (i + 1 < argc && arg == "-label"){
+            label = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "-variant"){
+            RENDER_VARIANT = argv[++i];
+        }
+        else{
+            std::cerr << "usage: bench [-o results.json] [-size width height] [-repeat n] [-threads n] [-label name] [-variant name]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<SceneResult> scenes;
+    scenes.push_back(run_scene(cornell_scene(), threads));
+    scenes.push_back(run_scene(sphere_field_scene(), threads));
+    scenes.push_back(run_scene(instance_scene(), threads));
+    ObjResult obj = run_obj();
+    GlbResult glb = run_glb();
+    QOIResult qoi = run_qoi();
+
+    std::cout << std::endl;
+    for (const SceneResult& s: scenes){
+        std::cout << s.name << ": " << s.triangles << " triangles, build " << s.build_ms << "ms, primary " << s.primary_mrays
+                  << " Mrays/s, shadow " << s.shadow_mrays << " Mrays/s, diffuse " << s.diffuse_mrays << " Mrays/s, kernel "
+                  << s.kernel_ms << "ms, render " << s.render_ms << "ms" << std::endl;
+    }
+    std::cout << "obj: " << (obj.bytes >> 20) << "MB, parse " << obj.parse_ms << "ms, load " << obj.load_ms << "ms, cached load "
+              << obj.cached_load_ms << "ms" << std::endl;
+    std::cout << "glb: " << (glb.bytes >> 20) << "MB, load " << glb.load_ms << "ms" << std::endl;
+    double raw_mb = qoi.width * qoi.height * 3 / 1048576.0;
+    std::cout << "qoi: encode " << raw_mb / (qoi.encode_ms / 1000) << "MB/s, decode " << raw_mb / (qoi.decode_ms / 1000) << "MB/s" << std::endl;
+
+    write_results(output, label, threads, scenes, obj, glb, qoi);
+    std::cout << "Results written to " << output << std::endl;
+}
@@ -70,11 +70,23 @@ struct Camera{
 
     // return a ray through the pixel coordinate x, z
     Ray cast_ray(int x, int z){
+        return cast_ray((float) x, (float) z, 1);
+    }
+
+    // return a ray through a point on the image plane given in pixels, pixel centres are at whole numbers
+    // spacing is the distance in pixels to the neighbouring samples, used for the ray differentials
+    Ray cast_ray(float x, float z, float spacing){
         float x_pos = (x_step_m - width_m) / 2 + x * x_step_m;
         float z_pos = (z_step_m + height_m) / 2 - z * z_step_m;
 
         Vector3 ray_direction = x_pos * right + z_pos * up + forward;
 
-        return Ray(position, Vector3::normalize(ray_direction));
+        Ray ray = Ray(position, Vector3::normalize(ray_direction));
+        ray.has_differentials = true;
+        ray.rx_origin = position;
+        ray.rx_direction = Vector3::normalize(ray_direction + spacing * x_step_m * right);
+        ray.rz_origin = position;
+        ray.rz_direction = Vector3::normalize(ray_direction - spacing * z_step_m * up);
+        return ray;
     }
 };
\ No newline at end of file
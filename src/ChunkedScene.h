@@ -0,0 +1,419 @@
+#pragma once
+
+#include "ObjLoader.h"
+#include "GeometryCache.h"
+#include <numeric>
+
+// triangles per chunk when a scene is split for out of core rendering
+int GEOMETRY_CHUNK_FACES = 1 << 18;
+
+const uint32_t CHUNK_MANIFEST_MAGIC = 0x464e4d43;
+const uint32_t CHUNK_MANIFEST_VERSION = 1;
+
+
+struct GeometryChunk{
+    AABB bounds;
+    std::string filename;
+};
+
+
+// stands in for a chunk in the routing tree, only its bounds are ever used
+struct ChunkBounds: public Observable{
+    AABB bounds;
+
+    ChunkBounds(const AABB& bounds_) : bounds(bounds_){}
+
+    bool intersect(const Ray& ray, RayHit& inter){
+        return false;
+    }
+
+    Vector3 centroid(){
+        return bounds.center();
+    }
+
+    Vector3 max_vertex(){
+        return bounds.max;
+    }
+
+    Vector3 min_vertex(){
+        return bounds.min;
+    }
+};
+
+
+// where ray enters box, 0 if it starts inside, FINF if it misses
+inline float chunk_entry(const AABB& box, const Ray& ray){
+    Vector3 f = (box.min - ray.origin) * ray.inv_direction;
+    Vector3 n = (box.max - ray.origin) * ray.inv_direction;
+    float t0 = fmax(Vector3::max_component(Vector3::min(f, n)), 0.0f);
+    float t1 = Vector3::min_component(Vector3::max(f, n));
+    return (t1 >= t0) ? t0 : FINF;
+}
+
+
+// a scene split into spatial chunks on disk, each with its own meshes and BVH
+// only the chunk bounds and the small tree over them stay resident, chunks are paged
+// in through the geometry cache when rays reach them
+struct ChunkedScene: public Observable{
+    std::vector<GeometryChunk> chunks;
+    // tree over the chunk bounds, its leaves index chunks
+    BVH router;
+    GeometryCache& cache;
+
+    // throws std::runtime_error if the manifest can't be read
+    ChunkedScene(const std::string& manifest, GeometryCache& cache_ = geometry_cache) : cache(cache_){
+        std::string path;
+        int last_slash = manifest.find_last_of("/\\");
+        path = (last_slash != std::string::npos) ? manifest.substr(0, last_slash + 1) : "./";
+        MappedFile file;
+        if (!file.open(manifest)){
+            std::cerr << "Could not open file " << manifest << std::endl;
+            throw std::runtime_error("Could not open file");
+        }
+        SceneCacheReader reader = SceneCacheReader(file);
+        uint32_t magic, version;
+        uint64_t count;
+        if (!reader.get(magic) || !reader.get(version) || !reader.get(count)
+            || magic != CHUNK_MANIFEST_MAGIC || version != CHUNK_MANIFEST_VERSION){
+            std::cerr << manifest << " is not a chunk manifest of this version" << std::endl;
+            throw std::runtime_error("Invalid chunk manifest");
+        }
+        std::vector<std::shared_ptr<Observable>> proxies;
+        for (uint64_t i = 0; i < count; i++){
+            GeometryChunk chunk;
+            if (!reader.get(chunk.bounds.min) || !reader.get(chunk.bounds.max) || !reader.get_string(chunk.filename)){
+                throw std::runtime_error("Invalid chunk manifest");
+            }
+            chunk.filename = path + chunk.filename;
+            chunks.push_back(chunk);
+            proxies.push_back(std::make_shared<ChunkBounds>(chunk.bounds));
+        }
+        if (chunks.empty()){
+            throw std::runtime_error("Empty chunk manifest");
+        }
+        router = BVH(proxies);
+        std::cout << "Chunked scene: " << chunks.size() << " chunks in " << manifest << std::endl;
+    }
+
+    Vector3 centroid(){
+        return router.centroid();
+    }
+
+    Vector3 max_vertex(){
+        return router.max_vertex();
+    }
+
+    Vector3 min_vertex(){
+        return router.min_vertex();
+    }
+
+    // every chunk the ray passes through, with the distance it enters at
+    void route(const Ray& ray, std::vector<std::pair<float, int>>& entered){
+        entered.clear();
+        uint stack[BVH_MAX_DEPTH];
+        uint stack_ptr = 0;
+        if (chunk_entry(router.nodes[router.root_index].aabb, ray) == FINF){
+            return;
+        }
+        stack[stack_ptr++] = router.root_index;
+        while (stack_ptr > 0){
+            BVHNode& node = router.nodes[stack[--stack_ptr]];
+            if (node.is_leaf()){
+                for (uint i = 0; i < node.observable_count; i++){
+                    int c = router.indices[node.first_index + i];
+                    float t = chunk_entry(chunks[c].bounds, ray);
+                    if (t != FINF){
+                        entered.push_back({t, c});
+                    }
+                }
+                continue;
+            }
+            for (uint child = node.left_child; child <= node.left_child + 1; child++){
+                if (chunk_entry(router.nodes[child].aabb, ray) != FINF){
+                    stack[stack_ptr++] = child;
+                }
+            }
+        }
+    }
+
+    // chunks are visited front to back and loaded on demand
+    bool intersect(const Ray& ray, RayHit& inter){
+        thread_local std::vector<std::pair<float, int>> entered;
+        route(ray, entered);
+        std::sort(entered.begin(), entered.end());
+        bool hit = false;
+        unsigned long long queued = 0, hits = 0, culled = 0;
+        for (auto& [t, c]: entered){
+            if (t > inter.distance){
+                culled += entered.size() - queued;
+                break;
+            }
+            queued++;
+            bool resident;
+            BVH* chunk = cache.get(chunks[c].filename, resident);
+            hits += resident;
+            if (chunk != nullptr){
+                hit |= chunk->intersect(ray, inter);
+            }
+        }
+        if (queued + culled > 0){
+            cache.count_rays(queued, hits, culled);
+        }
+        return hit;
+    }
+
+    // rays are queued on every chunk they pass through, then each chunk is loaded once
+    // and traces its whole queue, resident chunks go first and the rest nearest first
+    // so rays that hit something early can skip the chunks behind it
+    void intersect_batch(const std::vector<Ray>& rays, std::vector<RayHit>& hits){
+        thread_local std::vector<std::vector<std::pair<float, int>>> queues;
+        thread_local std::vector<float> nearest;
+        thread_local std::vector<int> touched;
+        thread_local std::vector<std::pair<float, int>> entered;
+        queues.resize(chunks.size());
+        nearest.resize(chunks.size());
+        touched.clear();
+        for (int i = 0; i < rays.size(); i++){
+            route(rays[i], entered);
+            for (auto& [t, c]: entered){
+                if (queues[c].empty()){
+                    touched.push_back(c);
+                    nearest[c] = t;
+                }
+                queues[c].push_back({t, i});
+                nearest[c] = fmin(nearest[c], t);
+            }
+        }
+
+        std::vector<std::pair<bool, int>> order;
+        for (int c: touched){
+            order.push_back({!cache.resident(chunks[c].filename), c});
+        }
+        std::sort(order.begin(), order.end(), [&](const std::pair<bool, int>& a, const std::pair<bool, int>& b){
+            if (a.first != b.first){
+                return a.first < b.first;
+            }
+            return nearest[a.second] < nearest[b.second];
+        });
+
+        unsigned long long queued = 0, queue_hits = 0, culled = 0;
+        for (auto& [paged, c]: order){
+            std::vector<std::pair<float, int>>& queue = queues[c];
+            queued += queue.size();
+            if (!paged){
+                queue_hits += queue.size();
+            }
+            bool resident;
+            BVH* chunk = cache.get(chunks[c].filename, resident);
+            for (auto& [t, i]: queue){
+                if (chunk == nullptr){
+                    break;
+                }
+                if (t > hits[i].distance){
+                    culled++;
+                    continue;
+                }
+                chunk->intersect(rays[i], hits[i]);
+            }
+            queue.clear();
+        }
+        cache.count_rays(queued, queue_hits, culled);
+    }
+};
+
+
+// splits an OBJ into chunks of about chunk_faces triangles, each written to its own file in directory
+// with scene.chunks listing them, open the result with ChunkedScene(directory + "/scene.chunks")
+// the OBJ is parsed in memory once here, rendering only ever holds the chunks it needs
+bool build_chunked_scene(const std::string& filename, const std::string& directory, int chunk_faces = GEOMETRY_CHUNK_FACES){
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string path;
+    int last_slash = filename.find_last_of("/\\");
+    path = (last_slash != std::string::npos) ? filename.substr(0, last_slash + 1) : "./";
+
+    ObjData obj;
+    if (!parse_obj(filename, obj)){
+        return false;
+    }
+
+    // material of every face from the material lines around it
+    std::map<std::string, Material> materials;
+    std::vector<Material> material_list;
+    std::map<std::string, int> material_index;
+    // faces are grouped by the o and usemtl lines they follow, each group is a named mesh in every chunk it reaches
+    std::vector<std::pair<std::string, int>> groups;
+    std::map<std::pair<std::string, int>, int> group_index;
+    std::vector<int> face_group(obj.faces.size(), -1);
+    size_t first_face = 0;
+    std::string object_name, material_name;
+    int material = -1;
+    int current = -1;
+    for (const ObjEvent& event: obj.events){
+        std::fill(face_group.begin() + first_face, face_group.begin() + event.face, current);
+        first_face = event.face;
+        if (event.type == ObjEventType::MTLLIB){
+            load_mtllib(path + event.name, materials);
+            continue;
+        }
+        if (event.type == ObjEventType::OBJECT){
+            object_name = event.name;
+        }
+        else if (event.type == ObjEventType::USEMTL && materials.find(event.name) != materials.end()){
+            if (material_index.find(event.name) == material_index.end()){
+                material_index[event.name] = material_list.size();
+                material_list.push_back(materials[event.name]);
+            }
+            material_name = event.name;
+            material = material_index[event.name];
+        }
+        std::pair<std::string, int> key = {object_name.empty() ? material_name : object_name, material};
+        if (group_index.find(key) == group_index.end()){
+            group_index[key] = groups.size();
+            groups.push_back(key);
+        }
+        current = group_index[key];
+    }
+    std::fill(face_group.begin() + first_face, face_group.end(), current);
+
+    bool need_to_calc_normals = obj.normals.empty();
+    if (obj.texcoords.empty()){
+        obj.texcoords.resize(obj.vertices.size(), Vector3(0, 0, 0));
+    }
+    if (need_to_calc_normals){
+        obj.normals.resize(obj.vertices.size(), Vector3(0, 0, 0));
+    }
+
+    // faces with a vertex or normal index out of range are dropped, as load_obj does
+    size_t kept = 0;
+    for (size_t f = 0; f < obj.faces.size(); f++){
+        const Face& face = obj.faces[f];
+        if (obj_index_valid(face[0], obj.vertices) && obj_index_valid(face[3], obj.vertices) && obj_index_valid(face[6], obj.vertices)
+            && obj_index_valid(face[2], obj.normals) && obj_index_valid(face[5], obj.normals) && obj_index_valid(face[8], obj.normals)){
+            obj.faces[kept] = face;
+            face_group[kept] = face_group[f];
+            kept++;
+        }
+    }
+    size_t skipped = obj.faces.size() - kept;
+    obj.faces.resize(kept);
+    face_group.resize(kept);
+
+    // median splits on the longest axis of the face centroids until every piece is small enough
+    std::vector<Vector3> centroids(obj.faces.size());
+    for (size_t f = 0; f < obj.faces.size(); f++){
+        const Face& face = obj.faces[f];
+        centroids[f] = (obj.vertices[face[0] - 1] + obj.vertices[face[3] - 1] + obj.vertices[face[6] - 1]) / 3.0f;
+    }
+    std::vector<int> order(obj.faces.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<std::pair<size_t, size_t>> pieces;
+    std::vector<std::pair<size_t, size_t>> pending = {{0, order.size()}};
+    while (!pending.empty()){
+        auto [first, last] = pending.back();
+        pending.pop_back();
+        if (last - first <= chunk_faces){
+            if (last > first){
+                pieces.push_back({first, last});
+            }
+            continue;
+        }
+        Vector3 lo = Vector3(1e30f), hi = Vector3(-1e30f);
+        for (size_t i = first; i < last; i++){
+            lo = Vector3::min(lo, centroids[order[i]]);
+            hi = Vector3::max(hi, centroids[order[i]]);
+        }
+        Vector3 extents = hi - lo;
+        int axis = 0;
+        if (extents.y > extents.x) axis = 1;
+        if (extents.z > extents[axis]) axis = 2;
+        size_t mid = (first + last) / 2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last, [&](int a, int b){
+            return centroids[a][axis] < centroids[b][axis];
+        });
+        pending.push_back({first, mid});
+        pending.push_back({mid, last});
+    }
+
+    std::filesystem::create_directories(directory);
+    std::string manifest_filename = directory + "/scene.chunks";
+    std::ofstream manifest(manifest_filename, std::ios::out|std::ios::binary);
+    if (!manifest.is_open()){
+        std::cerr << "Could not open file " << manifest_filename << std::endl;
+        return false;
+    }
+    SceneCacheWriter writer = SceneCacheWriter(manifest);
+    writer.put(CHUNK_MANIFEST_MAGIC);
+    writer.put(CHUNK_MANIFEST_VERSION);
+    writer.put((uint64_t) pieces.size());
+
+    // one mesh per group in each chunk, renumbered like load_obj does
+    IndexMap vmap, vtmap, vnmap;
+    for (int p = 0; p < pieces.size(); p++){
+        auto [first, last] = pieces[p];
+        std::stable_sort(order.begin() + first, order.begin() + last, [&](int a, int b){
+            return face_group[a] < face_group[b];
+        });
+        std::vector<std::shared_ptr<Observable>> meshes;
+        for (size_t run = first; run < last;){
+            size_t run_end = run;
+            while (run_end < last && face_group[order[run_end]] == face_group[order[run]]) run_end++;
+            std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+            int group = face_group[order[run]];
+            if (group >= 0){
+                mesh->name = groups[group].first;
+                if (groups[group].second >= 0){
+                    mesh->mat = material_list[groups[group].second];
+                }
+            }
+            vmap.reset(3 * (run_end - run));
+            vtmap.reset(3 * (run_end - run));
+            vnmap.reset(3 * (run_end - run));
+            int zero_texcoord = 0;
+            mesh->faces.reserve(run_end - run);
+            for (size_t i = run; i < run_end; i++){
+                const Face& face = obj.faces[order[i]];
+                Face new_face;
+                for (int c = 0; c < 9; c += 3){
+                    new_face[c] = vmap.find_or_add(face[c], mesh->vertices, obj.vertices);
+                    if (obj_index_valid(face[c + 1], obj.texcoords)){
+                        new_face[c + 1] = vtmap.find_or_add(face[c + 1], mesh->texcoords, obj.texcoords);
+                    }
+                    else{
+                        if (zero_texcoord == 0){
+                            mesh->texcoords.push_back(Vector3(0,0,0));
+                            zero_texcoord = mesh->texcoords.size();
+                        }
+                        new_face[c + 1] = zero_texcoord;
+                    }
+                    new_face[c + 2] = vnmap.find_or_add(face[c + 2], mesh->normals, obj.normals);
+                }
+                mesh->faces.push_back(new_face);
+            }
+            if (need_to_calc_normals){
+                mesh->calculate_normals();
+            }
+            mesh->recalc_bounding_box();
+            mesh->tree = mesh->build_tree(mesh->faces);
+            mesh->account_memory();
+            meshes.push_back(mesh);
+            run = run_end;
+        }
+        BVH chunk(meshes);
+        std::string chunk_name = "chunk_" + std::to_string(p) + ".scene";
+        if (!write_chunk_file(directory + "/" + chunk_name, chunk)){
+            return false;
+        }
+        writer.put(chunk.min_vertex());
+        writer.put(chunk.max_vertex());
+        writer.put_string(chunk_name);
+    }
+    manifest.close();
+    if (skipped > 0){
+        std::cerr << "Skipped " << skipped << " faces with out of range indices in " << filename << std::endl;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Split " << filename << " into " << pieces.size() << " chunks in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    return true;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Counters.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// splits the tracing work between the meshes of a scene, by name, to find the assets worth simplifying
+// build with -DCOST_ATTRIBUTION=1, the node and triangle counts come from the performance counters
+#ifndef COST_ATTRIBUTION
+#define COST_ATTRIBUTION 0
+#endif
+
+#if COST_ATTRIBUTION && !PERF_COUNTERS
+#error "COST_ATTRIBUTION needs PERF_COUNTERS=1"
+#endif
+
+// meshes listed by the report, the rest are summed into one line
+const int COST_REPORT_ROWS = 40;
+
+
+struct ObjectCost{
+    // rays that got past the box around the mesh
+    unsigned long long rays = 0;
+    unsigned long long nodes = 0;
+    unsigned long long triangles = 0;
+    // rays whose closest hit was on this mesh
+    unsigned long long hits = 0;
+    // time spent inside the meshes intersect, including the timer itself
+    double ns = 0;
+
+    void add(const ObjectCost& other){
+        rays += other.rays;
+        nodes += other.nodes;
+        triangles += other.triangles;
+        hits += other.hits;
+        ns += other.ns;
+    }
+};
+
+// one threads costs, indexed by object id
+struct ThreadObjectCosts{
+    std::vector<ObjectCost> costs;
+
+    ThreadObjectCosts();
+    ~ThreadObjectCosts();
+};
+
+struct CostAttribution{
+    std::mutex lock;
+    // meshes of the same name share an id, so a chunk that is reloaded adds to its earlier entry
+    std::unordered_map<std::string, int> ids;
+    std::vector<std::string> names;
+    std::vector<size_t> faces;
+    std::vector<ThreadObjectCosts*> threads;
+    // what exited threads accumulated
+    std::vector<ObjectCost> retired;
+
+    int id(const std::string& name, size_t face_count){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = ids.find(name);
+        if (it != ids.end()){
+            return it->second;
+        }
+        ids[name] = names.size();
+        names.push_back(name);
+        faces.push_back(face_count);
+        return names.size() - 1;
+    }
+
+    void add_thread(ThreadObjectCosts* thread){
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(thread);
+    }
+
+    void remove_thread(ThreadObjectCosts* thread){
+        std::lock_guard<std::mutex> guard(lock);
+        merge(thread->costs, retired);
+        threads.erase(std::find(threads.begin(), threads.end(), thread));
+    }
+
+    static void merge(const std::vector<ObjectCost>& from, std::vector<ObjectCost>& into){
+        if (into.size() < from.size()){
+            into.resize(from.size());
+        }
+        for (size_t i = 0; i < from.size(); i++){
+            into[i].add(from[i]);
+        }
+    }
+
+    // costs sorted by time, most expensive first, only meant to be called once the render threads are done
+    void report(){
+#if COST_ATTRIBUTION
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<ObjectCost> totals = retired;
+        for (ThreadObjectCosts* thread: threads){
+            merge(thread->costs, totals);
+        }
+        if (totals.empty()){
+            return;
+        }
+        std::vector<int> order(totals.size());
+        double total_ns = 0;
+        for (size_t i = 0; i < totals.size(); i++){
+            order[i] = i;
+            total_ns += totals[i].ns;
+        }
+        std::sort(order.begin(), order.end(), [&](int a, int b){return totals[a].ns > totals[b].ns;});
+
+        std::cout << "Cost by object, " << totals.size() << " objects:" << std::endl;
+        printf("%-32s %10s %12s %14s %14s %12s %10s %7s\n", "object", "faces", "rays", "nodes", "triangles", "hits", "ms", "time");
+        ObjectCost rest;
+        for (size_t i = 0; i < order.size(); i++){
+            const ObjectCost& c = totals[order[i]];
+            if (i >= COST_REPORT_ROWS){
+                rest.add(c);
+                continue;
+            }
+            printf("%-32.32s %10zu %12llu %14llu %14llu %12llu %10.1f %6.1f%%\n", names[order[i]].c_str(), faces[order[i]],
+                   c.rays, c.nodes, c.triangles, c.hits, c.ns / 1e6, 100 * c.ns / total_ns);
+        }
+        if (order.size() > COST_REPORT_ROWS){
+            printf("%-32s %10s %12llu %14llu %14llu %12llu %10.1f %6.1f%%\n", ("(" + std::to_string(order.size() - COST_REPORT_ROWS) + " more)").c_str(), "",
+                   rest.rays, rest.nodes, rest.triangles, rest.hits, rest.ns / 1e6, 100 * rest.ns / total_ns);
+        }
+#endif
+    }
+};
+
+CostAttribution cost_attribution;
+
+ThreadObjectCosts::ThreadObjectCosts(){
+    cost_attribution.add_thread(this);
+}
+
+ThreadObjectCosts::~ThreadObjectCosts(){
+    cost_attribution.remove_thread(this);
+}
+
+// the id a mesh is charged to, meshes register once their name is known
+inline int object_cost_id(const std::string& name, size_t face_count){
+    return cost_attribution.id(name.empty() ? "(unnamed)" : name, face_count);
+}
+
+// the calling threads cost entry for an object id
+inline ObjectCost& object_cost(int id){
+    thread_local ThreadObjectCosts thread;
+    if (id < 0){
+        id = object_cost_id("", 0);
+    }
+    if ((int) thread.costs.size() <= id){
+        thread.costs.resize(id + 1);
+    }
+    return thread.costs[id];
+}
+
+// charges the nodes, triangles and time of one intersect call to an object
+struct ObjectCostScope{
+    ObjectCost& cost;
+    CounterBlock& counters;
+    unsigned long long nodes, triangles;
+    std::chrono::steady_clock::time_point start;
+
+    ObjectCostScope(ObjectCost& cost_) : cost(cost_), counters(thread_counters()){
+        nodes = counters.values[COUNTER_NODES_VISITED].load(std::memory_order_relaxed);
+        triangles = counters.values[COUNTER_TRIANGLE_TESTS].load(std::memory_order_relaxed);
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~ObjectCostScope(){
+        cost.ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        unsigned long long visited = counters.values[COUNTER_NODES_VISITED].load(std::memory_order_relaxed) - nodes;
+        cost.rays += visited > 0;
+        cost.nodes += visited;
+        cost.triangles += counters.values[COUNTER_TRIANGLE_TESTS].load(std::memory_order_relaxed) - triangles;
+    }
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// counts of the work a render does, for seeing where the time goes
+// off by default so normal builds don't pay for them, build with -DPERF_COUNTERS=1 to turn them on
+// cost attribution is built on them, so asking for it turns them on
+#ifndef PERF_COUNTERS
+#if defined(COST_ATTRIBUTION) && COST_ATTRIBUTION
+#define PERF_COUNTERS 1
+#else
+#define PERF_COUNTERS 0
+#endif
+#endif
+
+enum PerfCounter{
+    COUNTER_PRIMARY_RAYS,
+    COUNTER_SHADOW_RAYS,
+    COUNTER_BOUNCE_RAYS,
+    COUNTER_NODES_VISITED,
+    COUNTER_AABB_TESTS,
+    COUNTER_TRIANGLE_TESTS,
+    COUNTER_TRIANGLE_HITS,
+    COUNTER_SHADING,
+    COUNTER_TEXTURE_SAMPLES,
+    COUNTER_COUNT
+};
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "primary rays", "shadow rays", "bounce rays", "nodes visited", "AABB tests",
+    "triangles tested", "triangle hits", "shading evaluations", "texture samples"
+};
+
+
+// one threads counters, on a cache line of their own so threads never write to a shared line
+// only the owning thread adds to them, relaxed loads and stores keep that as cheap as a plain
+// increment while still letting the report read them from another thread
+struct alignas(64) CounterBlock{
+    std::atomic<unsigned long long> values[COUNTER_COUNT] = {};
+
+    inline void add(PerfCounter counter, unsigned long long n){
+        values[counter].store(values[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// every threads block, merged when the totals are wanted
+struct PerfCounters{
+    std::mutex lock;
+    std::vector<CounterBlock*> threads;
+    // what threads that have exited counted
+    unsigned long long retired[COUNTER_COUNT] = {};
+
+    void add_thread(CounterBlock* block){
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(block);
+    }
+
+    void remove_thread(CounterBlock* block){
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < COUNTER_COUNT; i++){
+            retired[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+        threads.erase(std::find(threads.begin(), threads.end(), block));
+    }
+
+    unsigned long long total(PerfCounter counter){
+        std::lock_guard<std::mutex> guard(lock);
+        unsigned long long sum = retired[counter];
+        for (CounterBlock* block: threads){
+            sum += block->values[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    void reset(){
+        std::lock_guard<std::mutex> guard(lock);
+        for (int i = 0; i < COUNTER_COUNT; i++){
+            retired[i] = 0;
+            for (CounterBlock* block: threads){
+                block->values[i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void report(){
+#if PERF_COUNTERS
+        for (int i = 0; i < COUNTER_COUNT; i++){
+            std::cout << "Counters: " << total((PerfCounter) i) << " " << COUNTER_NAMES[i] << std::endl;
+        }
+#endif
+    }
+};
+
+PerfCounters perf_counters;
+
+// registers the calling threads block on first use and folds it into the totals when the thread exits
+struct ThreadCounters{
+    CounterBlock block;
+
+    ThreadCounters(){
+        perf_counters.add_thread(&block);
+    }
+
+    ~ThreadCounters(){
+        perf_counters.remove_thread(&block);
+    }
+};
+
+inline CounterBlock& thread_counters(){
+    thread_local ThreadCounters counters;
+    return counters.block;
+}
+
+#if PERF_COUNTERS
+#define PERF_COUNT(counter) thread_counters().add(counter, 1)
+#define PERF_ADD(counter, n) thread_counters().add(counter, n)
+#else
+#define PERF_COUNT(counter) ((void) 0)
+#define PERF_ADD(counter, n) ((void) 0)
+#endif
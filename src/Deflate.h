@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+// deflate (RFC 1951) compressor with LZ77 matching and dynamic huffman codes
+// every call compresses its data as an independent block ending on a byte boundary,
+// so blocks compressed on different threads can be joined into one stream
+
+const int DEFLATE_WINDOW = 1 << 15;
+const int DEFLATE_HASH_BITS = 15;
+const int DEFLATE_MIN_MATCH = 3;
+const int DEFLATE_MAX_MATCH = 258;
+// candidates looked at per position, more is smaller output but slower
+const int DEFLATE_MAX_CHAIN = 16;
+
+const uint16_t DEFLATE_LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t DEFLATE_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DEFLATE_DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DEFLATE_DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// order the code length code lengths are stored in
+const uint8_t DEFLATE_CLEN_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+
+// writes bits least significant first as deflate expects
+struct BitWriter{
+    std::vector<uint8_t>& out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    BitWriter(std::vector<uint8_t>& out_) : out(out_){}
+
+    inline void write(uint32_t value, int length){
+        bits |= (uint64_t) value << count;
+        count += length;
+        while (count >= 8){
+            out.push_back(bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // huffman codes are defined most significant bit first
+    inline void write_code(uint32_t code, int length){
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++){
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        write(reversed, length);
+    }
+
+    void align(){
+        if (count > 0){
+            out.push_back(bits & 0xff);
+        }
+        bits = 0;
+        count = 0;
+    }
+};
+
+
+// huffman code lengths no longer than max_length for the given symbol frequencies
+inline std::vector<uint8_t> huffman_lengths(std::vector<uint32_t> freq, int max_length){
+    int n = freq.size();
+    std::vector<uint8_t> lengths(n, 0);
+    while (true){
+        // nodes past n are internal, parent links give each leafs depth
+        std::vector<int> parent(2 * n, -1);
+        typedef std::pair<uint64_t, int> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+        for (int i = 0; i < n; i++){
+            if (freq[i] > 0){
+                heap.push({freq[i], i});
+            }
+        }
+        if (heap.size() == 1){
+            lengths[heap.top().second] = 1;
+            return lengths;
+        }
+        int next = n;
+        while (heap.size() > 1){
+            Node a = heap.top(); heap.pop();
+            Node b = heap.top(); heap.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            heap.push({a.first + b.first, next++});
+        }
+        int longest = 0;
+        for (int i = 0; i < n; i++){
+            if (freq[i] == 0){
+                continue;
+            }
+            int depth = 0;
+            for (int p = parent[i]; p != -1; p = parent[p]){
+                depth++;
+            }
+            lengths[i] = depth;
+            longest = std::max(longest, depth);
+        }
+        if (longest <= max_length){
+            return lengths;
+        }
+        // flatten the distribution and try again
+        for (uint32_t& f: freq){
+            if (f > 0){
+                f = (f + 1) / 2;
+            }
+        }
+    }
+}
+
+
+// canonical codes for a set of code lengths
+inline std::vector<uint16_t> huffman_codes(const std::vector<uint8_t>& lengths){
+    int count[16] = {};
+    for (uint8_t l: lengths){
+        count[l]++;
+    }
+    count[0] = 0;
+    int next[16] = {};
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++){
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    std::vector<uint16_t> codes(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); i++){
+        if (lengths[i] != 0){
+            codes[i] = next[lengths[i]]++;
+        }
+    }
+    return codes;
+}
+
+
+// a literal when dist is 0, otherwise a match of length bytes dist back
+struct LZSymbol{
+    uint16_t length;
+    uint16_t dist;
+};
+
+
+inline int length_symbol(int length){
+    int i = 28;
+    while (DEFLATE_LENGTH_BASE[i] > length) i--;
+    return i;
+}
+
+inline int dist_symbol(int dist){
+    int i = 29;
+    while (DEFLATE_DIST_BASE[i] > dist) i--;
+    return i;
+}
+
+
+// greedy LZ77 with hash chains over a 32KB window
+inline std::vector<LZSymbol> lz77(const uint8_t* data, size_t size){
+    std::vector<LZSymbol> symbols;
+    symbols.reserve(size / 2);
+    std::vector<int32_t> head(1 << DEFLATE_HASH_BITS, -1);
+    std::vector<int32_t> prev(DEFLATE_WINDOW, -1);
+    auto hash = [&](size_t i){
+        uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+    };
+    auto insert = [&](size_t i){
+        if (i + DEFLATE_MIN_MATCH <= size){
+            uint32_t h = hash(i);
+            prev[i & (DEFLATE_WINDOW - 1)] = head[h];
+            head[h] = i;
+        }
+    };
+
+    size_t i = 0;
+    while (i < size){
+        int best_length = 0;
+        int best_dist = 0;
+        if (i + DEFLATE_MIN_MATCH <= size){
+            size_t max_length = std::min<size_t>(DEFLATE_MAX_MATCH, size - i);
+            int32_t candidate = head[hash(i)];
+            for (int chain = 0; chain < DEFLATE_MAX_CHAIN && candidate >= 0; chain++){
+                size_t dist = i - candidate;
+                if (dist > DEFLATE_WINDOW - 1){
+                    break;
+                }
+                // check the byte that would extend the best match first
+                if (data[candidate + best_length] == data[i + best_length]){
+                    size_t length = 0;
+                    while (length < max_length && data[candidate + length] == data[i + length]){
+                        length++;
+                    }
+                    if (length > (size_t) best_length){
+                        best_length = length;
+                        best_dist = dist;
+                        if (length == max_length){
+                            break;
+                        }
+                    }
+                }
+                int32_t next = prev[candidate & (DEFLATE_WINDOW - 1)];
+                // the ring slot was reused by a newer position
+                if (next >= candidate){
+                    break;
+                }
+                candidate = next;
+            }
+        }
+        if (best_length >= DEFLATE_MIN_MATCH){
+            symbols.push_back({(uint16_t) best_length, (uint16_t) best_dist});
+            for (size_t j = i; j < i + best_length; j++){
+                insert(j);
+            }
+            i += best_length;
+        }
+        else{
+            symbols.push_back({data[i], 0});
+            insert(i);
+            i++;
+        }
+    }
+    return symbols;
+}
+
+
+// compress data as one dynamic huffman block followed by an empty stored block
+// the stored block byte aligns the output so another block can be appended straight after
+inline std::vector<uint8_t> deflate_block(const uint8_t* data, size_t size){
+    std::vector<LZSymbol> symbols = lz77(data, size);
+
+    std::vector<uint32_t> lit_freq(286, 0);
+    std::vector<uint32_t> dist_freq(30, 0);
+    for (const LZSymbol& s: symbols){
+        if (s.dist == 0){
+            lit_freq[s.length]++;
+        }
+        else{
+            lit_freq[257 + length_symbol(s.length)]++;
+            dist_freq[dist_symbol(s.dist)]++;
+        }
+    }
+    lit_freq[256] = 1;
+    // some decoders reject a distance tree with fewer than two codes
+    for (int i = 0; i < 2; i++){
+        if (dist_freq[i] == 0){
+            dist_freq[i] = 1;
+        }
+    }
+    std::vector<uint8_t> lit_lengths = huffman_lengths(lit_freq, 15);
+    std::vector<uint8_t> dist_lengths = huffman_lengths(dist_freq, 15);
+    std::vector<uint16_t> lit_codes = huffman_codes(lit_lengths);
+    std::vector<uint16_t> dist_codes = huffman_codes(dist_lengths);
+
+    int lit_count = 286;
+    while (lit_count > 257 && lit_lengths[lit_count - 1] == 0) lit_count--;
+    int dist_count = 30;
+    while (dist_count > 1 && dist_lengths[dist_count - 1] == 0) dist_count--;
+
+    // run length encode both sets of lengths with the code length alphabet
+    std::vector<uint8_t> all_lengths(lit_lengths.begin(), lit_lengths.begin() + lit_count);
+    all_lengths.insert(all_lengths.end(), dist_lengths.begin(), dist_lengths.begin() + dist_count);
+    std::vector<std::pair<uint8_t, uint8_t>> runs;
+    std::vector<uint32_t> clen_freq(19, 0);
+    for (size_t i = 0; i < all_lengths.size();){
+        uint8_t l = all_lengths[i];
+        size_t run = 1;
+        while (i + run < all_lengths.size() && all_lengths[i + run] == l) run++;
+        if (l == 0 && run >= 11){
+            run = std::min<size_t>(run, 138);
+            runs.push_back({18, run - 11});
+        }
+        else if (l == 0 && run >= 3){
+            runs.push_back({17, run - 3});
+        }
+        else if (l != 0 && run >= 4){
+            // the first length is sent as is, then repeated 3-6 times
+            run = std::min<size_t>(run, 7);
+            runs.push_back({l, 0});
+            runs.push_back({16, run - 4});
+        }
+        else{
+            run = 1;
+            runs.push_back({l, 0});
+        }
+        i += run;
+    }
+    for (auto& r: runs){
+        clen_freq[r.first]++;
+    }
+    // the code length code has to be complete, so it needs at least two symbols
+    if (std::count_if(clen_freq.begin(), clen_freq.end(), [](uint32_t f){return f > 0;}) < 2){
+        clen_freq[clen_freq[0] == 0 ? 0 : 1]++;
+    }
+    std::vector<uint8_t> clen_lengths = huffman_lengths(clen_freq, 7);
+    std::vector<uint16_t> clen_codes = huffman_codes(clen_lengths);
+    int clen_count = 19;
+    while (clen_count > 4 && clen_lengths[DEFLATE_CLEN_ORDER[clen_count - 1]] == 0) clen_count--;
+
+    std::vector<uint8_t> out;
+    out.reserve(size / 2 + 64);
+    BitWriter bits = BitWriter(out);
+    bits.write(0, 1);
+    bits.write(2, 2);
+    bits.write(lit_count - 257, 5);
+    bits.write(dist_count - 1, 5);
+    bits.write(clen_count - 4, 4);
+    for (int i = 0; i < clen_count; i++){
+        bits.write(clen_lengths[DEFLATE_CLEN_ORDER[i]], 3);
+    }
+    for (auto& r: runs){
+        bits.write_code(clen_codes[r.first], clen_lengths[r.first]);
+        if (r.first == 16) bits.write(r.second, 2);
+        else if (r.first == 17) bits.write(r.second, 3);
+        else if (r.first == 18) bits.write(r.second, 7);
+    }
+
+    for (const LZSymbol& s: symbols){
+        if (s.dist == 0){
+            bits.write_code(lit_codes[s.length], lit_lengths[s.length]);
+            continue;
+        }
+        int ls = length_symbol(s.length);
+        bits.write_code(lit_codes[257 + ls], lit_lengths[257 + ls]);
+        bits.write(s.length - DEFLATE_LENGTH_BASE[ls], DEFLATE_LENGTH_EXTRA[ls]);
+        int ds = dist_symbol(s.dist);
+        bits.write_code(dist_codes[ds], dist_lengths[ds]);
+        bits.write(s.dist - DEFLATE_DIST_BASE[ds], DEFLATE_DIST_EXTRA[ds]);
+    }
+    bits.write_code(lit_codes[256], lit_lengths[256]);
+
+    // empty stored block, padding to a byte then LEN 0 and NLEN 0xffff
+    bits.write(0, 3);
+    bits.align();
+    out.push_back(0x00);
+    out.push_back(0x00);
+    out.push_back(0xff);
+    out.push_back(0xff);
+    return out;
+}
+
+// empty final stored block that ends a stream of deflate_block output
+const uint8_t DEFLATE_FINAL_BLOCK[5] = {0x01, 0x00, 0x00, 0xff, 0xff};
+
+
+// zlib checksum, blocks of 5552 bytes are the most that can be summed before the modulo
+inline uint32_t adler32(uint32_t adler, const uint8_t* data, size_t size){
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (size > 0){
+        size_t block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < block; i++){
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
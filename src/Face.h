@@ -0,0 +1,6 @@
+#pragma once
+
+#include <array>
+
+// a mesh triangle, v/vt/vn indices for each of its three corners, 1 based like OBJ files
+typedef std::array<int, 9> Face;
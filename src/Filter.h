@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+
+enum class FilterType{BOX, TENT, BLACKMAN_HARRIS};
+
+
+// pixel reconstruction filter, separable so the 2D weight is weight(dx) * weight(dz)
+// distances are in pixels from the pixel centre
+struct ReconstructionFilter{
+    FilterType type = FilterType::BOX;
+
+    ReconstructionFilter(FilterType type_ = FilterType::BOX) : type(type_){}
+
+    float radius() const{
+        switch (type){
+            case FilterType::TENT: return 1.0f;
+            case FilterType::BLACKMAN_HARRIS: return 2.0f;
+            default: return 0.5f;
+        }
+    }
+
+    float weight(float d) const{
+        d = fabsf(d);
+        float r = radius();
+        if (d >= r){
+            return 0;
+        }
+        switch (type){
+            case FilterType::TENT:
+                return 1 - d;
+            case FilterType::BLACKMAN_HARRIS:{
+                // 4 term window stretched over [-r, r]
+                float t = 2 * M_PI * (d + r) / (2 * r);
+                return 0.35875f - 0.48829f * cosf(t) + 0.14128f * cosf(2 * t) - 0.01168f * cosf(3 * t);
+            }
+            default:
+                return 1;
+        }
+    }
+
+    // samples on either side of a pixels own n samples that still fall inside the filter
+    int grid_margin(int n) const{
+        return std::max(0, (int) ceilf(radius() * n - 0.5f * n));
+    }
+
+    // normalized 1D kernel for an n per pixel sample grid
+    // tap k is the k'th sample counting from grid_margin samples before the pixels first one
+    std::vector<float> grid_taps(int n) const{
+        int m = grid_margin(n);
+        std::vector<float> taps(n + 2 * m);
+        float total = 0;
+        for (int k = 0; k < (int) taps.size(); k++){
+            taps[k] = weight((k - m + 0.5f) / n - 0.5f);
+            total += taps[k];
+        }
+        for (float& tap: taps){
+            tap /= total;
+        }
+        return taps;
+    }
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "SceneCache.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// bytes of chunk geometry kept in memory by out of core scenes, read whenever a chunk is loaded
+unsigned long long GEOMETRY_CACHE_BUDGET = 1ull << 30;
+
+const uint32_t GEOMETRY_CHUNK_MAGIC = 0x4b4e4843;
+const uint32_t GEOMETRY_CHUNK_VERSION = 3;
+
+
+// a chunk file holds the meshes of one region of a scene and the tree over them
+bool write_chunk_file(const std::string& filename, BVH& chunk){
+    std::ofstream file(filename, std::ios::out|std::ios::binary);
+    if (!file.is_open()){
+        std::cerr << "Could not open file " << filename << std::endl;
+        return false;
+    }
+    SceneCacheWriter writer = SceneCacheWriter(file);
+    writer.put(GEOMETRY_CHUNK_MAGIC);
+    writer.put(GEOMETRY_CHUNK_VERSION);
+    writer.put(scene_cache_settings());
+    bool written = writer.put_meshes(chunk);
+    file.close();
+    return written && file;
+}
+
+bool read_chunk_file(const std::string& filename, BVH& chunk, size_t& file_bytes){
+    MappedFile file;
+    if (!file.open(filename)){
+        std::cerr << "Could not open file " << filename << std::endl;
+        return false;
+    }
+    file_bytes = file.size;
+    SceneCacheReader reader = SceneCacheReader(file);
+    uint32_t magic, version;
+    uint64_t settings;
+    if (!reader.get(magic) || !reader.get(version) || !reader.get(settings) || magic != GEOMETRY_CHUNK_MAGIC
+        || version != GEOMETRY_CHUNK_VERSION || settings != scene_cache_settings() || !reader.get_meshes(chunk)){
+        std::cerr << filename << " is not a chunk file of this version" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// what a loaded chunk takes up: its arrays, trees, and the triangles the trees hold
+size_t chunk_memory_bytes(BVH& chunk){
+    size_t bytes = chunk.nodes.size() * sizeof(BVHNode) + chunk.indices.size() * sizeof(int);
+    for (std::shared_ptr<Observable>& obs: chunk.observables){
+        TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(obs.get());
+        if (mesh == nullptr){
+            continue;
+        }
+        bytes += sizeof(TriangleMesh) + (mesh->vertices.size() + mesh->normals.size() + mesh->texcoords.size()) * sizeof(Vector3);
+        bytes += mesh->faces.size() * sizeof(Face);
+        BVH* tree = dynamic_cast<BVH*>(mesh->tree.get());
+        if (tree != nullptr){
+            bytes += tree->nodes.size() * sizeof(BVHNode) + tree->indices.size() * sizeof(int);
+            bytes += tree->triangles.size() * sizeof(Triangle);
+        }
+    }
+    return bytes;
+}
+
+
+// process wide LRU of loaded geometry chunks, thread safe
+// a chunk that is evicted while a thread is still tracing it lives on until that thread moves to another chunk
+struct GeometryCache{
+    struct Entry{
+        std::shared_ptr<BVH> chunk;
+        size_t bytes;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::mutex lock;
+    std::unordered_map<std::string, Entry> chunks;
+    // most recently used at the front
+    std::list<std::string> lru;
+    // held while a chunk is read so two threads never load the same one
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>> loading;
+    // 0 follows GEOMETRY_CACHE_BUDGET
+    unsigned long long budget;
+    unsigned long long bytes = 0;
+    unsigned long long loads = 0;
+    unsigned long long evictions = 0;
+    unsigned long long bytes_paged = 0;
+    // rays queued on a chunk, those whose chunk was already resident, and those skipped
+    // because they had already hit something in front of the chunk
+    // added to without the lock, tracing threads add to them on every ray
+    std::atomic<unsigned long long> queued_rays{0};
+    std::atomic<unsigned long long> queue_hits{0};
+    std::atomic<unsigned long long> culled_rays{0};
+
+    GeometryCache(unsigned long long budget_ = 0) : budget(budget_){}
+
+    unsigned long long current_budget(){
+        return (budget > 0) ? budget : GEOMETRY_CACHE_BUDGET;
+    }
+
+    bool resident(const std::string& filename){
+        std::lock_guard<std::mutex> guard(lock);
+        return chunks.find(filename) != chunks.end();
+    }
+
+    // the loaded chunk, reading it from disk if it isn't resident, null if it can't be read
+    // was_resident tells whether it was already loaded, so callers don't lock again to ask
+    // the pointer is good until the thread asks for another chunk, each thread holds on to its last one
+    // like TextureCache::get does with tiles, so rays staying in one chunk skip the lock and the reference count
+    BVH* get(const std::string& filename, bool& was_resident){
+        thread_local const GeometryCache* last_cache = nullptr;
+        thread_local std::string last_filename;
+        thread_local std::shared_ptr<BVH> last_chunk;
+        if (last_cache == this && last_filename == filename){
+            was_resident = true;
+            return last_chunk.get();
+        }
+        last_chunk = find_or_load(filename, was_resident);
+        last_cache = this;
+        last_filename = filename;
+        return last_chunk.get();
+    }
+
+    std::shared_ptr<BVH> find_or_load(const std::string& filename, bool& was_resident){
+        std::shared_ptr<std::mutex> load_lock;
+        was_resident = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = chunks.find(filename);
+            if (it != chunks.end()){
+                lru.splice(lru.begin(), lru, it->second.lru);
+                was_resident = true;
+                return it->second.chunk;
+            }
+            std::shared_ptr<std::mutex>& entry = loading[filename];
+            if (entry == nullptr){
+                entry = std::make_shared<std::mutex>();
+            }
+            load_lock = entry;
+        }
+
+        std::lock_guard<std::mutex> load_guard(*load_lock);
+        {
+            // another thread loaded it while this one waited
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = chunks.find(filename);
+            if (it != chunks.end()){
+                lru.splice(lru.begin(), lru, it->second.lru);
+                return it->second.chunk;
+            }
+        }
+        std::shared_ptr<BVH> chunk = std::make_shared<BVH>();
+        size_t file_bytes = 0;
+        if (!read_chunk_file(filename, *chunk, file_bytes)){
+            return nullptr;
+        }
+        // the chunk can be evicted before the hits on it are shaded, so they point at materials that stay
+        for (std::shared_ptr<Observable>& obs: chunk->observables){
+            if (TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(obs.get())){
+                mesh->arena_material = material_arena.intern(mesh->mat);
+            }
+        }
+        size_t chunk_bytes = chunk_memory_bytes(*chunk);
+
+        std::lock_guard<std::mutex> guard(lock);
+        unsigned long long limit = current_budget();
+        while (!lru.empty() && bytes + chunk_bytes > limit){
+            auto it = chunks.find(lru.back());
+            bytes -= it->second.bytes;
+            chunks.erase(it);
+            lru.pop_back();
+            evictions++;
+        }
+        lru.push_front(filename);
+        chunks[filename] = {chunk, chunk_bytes, lru.begin()};
+        bytes += chunk_bytes;
+        loads++;
+        bytes_paged += file_bytes;
+        return chunk;
+    }
+
+    void count_rays(unsigned long long queued, unsigned long long hits, unsigned long long culled){
+        queued_rays.fetch_add(queued, std::memory_order_relaxed);
+        queue_hits.fetch_add(hits, std::memory_order_relaxed);
+        culled_rays.fetch_add(culled, std::memory_order_relaxed);
+    }
+
+    void report(){
+        std::lock_guard<std::mutex> guard(lock);
+        if (loads == 0){
+            return;
+        }
+        std::cout << "Geometry cache: " << loads << " chunk loads, " << (bytes_paged >> 20) << "MB paged in, "
+                  << evictions << " evictions, " << (bytes >> 20) << "MB resident of " << (current_budget() >> 20) << "MB budget" << std::endl;
+        if (queued_rays > 0){
+            std::cout << "Geometry cache: " << queued_rays << " queued rays, " << (100.0 * queue_hits) / queued_rays
+                      << "% hit a resident chunk, " << culled_rays << " skipped by closer hits" << std::endl;
+        }
+    }
+};
+
+GeometryCache geometry_cache;
@@ -0,0 +1,467 @@
+#pragma once
+
+#include "TriangleMesh.h"
+#include "Instance.h"
+#include "BVH.h"
+#include "Json.h"
+#include "MappedFile.h"
+#include "TextureRegistry.h"
+#include <cstring>
+#include <map>
+
+const uint32_t GLB_MAGIC = 0x46546c67;
+const uint32_t GLB_CHUNK_JSON = 0x4e4f534a;
+const uint32_t GLB_CHUNK_BIN = 0x004e4942;
+
+const int GLTF_BYTE = 5120;
+const int GLTF_UNSIGNED_BYTE = 5121;
+const int GLTF_SHORT = 5122;
+const int GLTF_UNSIGNED_SHORT = 5123;
+const int GLTF_UNSIGNED_INT = 5125;
+const int GLTF_FLOAT = 5126;
+const int GLTF_TRIANGLES = 4;
+
+
+// a typed view into one of the files buffers, nothing is copied
+struct GltfAccessor{
+    const char* data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int component_type = 0;
+    int components = 0;
+    bool normalized = false;
+
+    static int component_size(int type){
+        switch (type){
+            case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+            case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+            case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+        }
+        return 0;
+    }
+
+    static int component_count(const std::string& type){
+        if (type == "SCALAR") return 1;
+        if (type == "VEC2") return 2;
+        if (type == "VEC3") return 3;
+        if (type == "VEC4") return 4;
+        if (type == "MAT4") return 16;
+        return 0;
+    }
+
+    // component c of element i, normalized integers map to 0..1 or -1..1
+    float get_float(size_t i, int c) const{
+        const char* p = data + i * stride + c * component_size(component_type);
+        switch (component_type){
+            case GLTF_FLOAT:{
+                float value;
+                memcpy(&value, p, 4);
+                return value;
+            }
+            case GLTF_UNSIGNED_BYTE: return normalized ? *(const uint8_t*) p / 255.0f : *(const uint8_t*) p;
+            case GLTF_BYTE: return normalized ? fmax(*(const int8_t*) p / 127.0f, -1.0f) : *(const int8_t*) p;
+            case GLTF_UNSIGNED_SHORT:{
+                uint16_t value;
+                memcpy(&value, p, 2);
+                return normalized ? value / 65535.0f : value;
+            }
+            case GLTF_SHORT:{
+                int16_t value;
+                memcpy(&value, p, 2);
+                return normalized ? fmax(value / 32767.0f, -1.0f) : value;
+            }
+        }
+        return 0;
+    }
+
+    uint32_t get_index(size_t i) const{
+        const char* p = data + i * stride;
+        switch (component_type){
+            case GLTF_UNSIGNED_BYTE: return *(const uint8_t*) p;
+            case GLTF_UNSIGNED_SHORT:{
+                uint16_t value;
+                memcpy(&value, p, 2);
+                return value;
+            }
+            case GLTF_UNSIGNED_INT:{
+                uint32_t value;
+                memcpy(&value, p, 4);
+                return value;
+            }
+        }
+        return 0;
+    }
+
+    // float VEC3 data packed the same way as Vector3 can be copied in one go, through a float view of the array
+    void read_vec3(std::vector<Vector3>& out) const{
+        out.resize(count);
+        if (component_type == GLTF_FLOAT && stride == sizeof(Vector3) && sizeof(Vector3) == 3 * sizeof(float)){
+            memcpy(reinterpret_cast<float*>(out.data()), data, count * sizeof(Vector3));
+            return;
+        }
+        for (size_t i = 0; i < count; i++){
+            out[i] = Vector3(get_float(i, 0), get_float(i, 1), get_float(i, 2));
+        }
+    }
+};
+
+
+// a mapped .glb, the JSON chunk is parsed and the binary chunk is left in the mapping
+struct GltfFile{
+    MappedFile file;
+    JsonValue json;
+    std::string path;
+    // start and size of each buffer, the first is normally the files own binary chunk
+    std::vector<std::pair<const char*, size_t>> buffers;
+    // buffers that live in separate .bin files
+    std::vector<std::unique_ptr<MappedFile>> external;
+
+    static uint32_t read32(const char* p){
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return value;
+    }
+
+    bool open(const std::string& filename){
+        size_t last_slash = filename.find_last_of("/\\");
+        path = (last_slash != std::string::npos) ? filename.substr(0, last_slash + 1) : "./";
+        if (!file.open(filename)){
+            std::cerr << "Could not open file " << filename << std::endl;
+            return false;
+        }
+        if (file.size < 20 || read32(file.data) != GLB_MAGIC || read32(file.data + 4) != 2){
+            std::cerr << filename << " is not a glTF 2.0 binary" << std::endl;
+            return false;
+        }
+        size_t length = std::min<size_t>(read32(file.data + 8), file.size);
+        const char* bin = nullptr;
+        size_t bin_size = 0;
+        size_t offset = 12;
+        try{
+            while (offset + 8 <= length){
+                uint32_t chunk_size = read32(file.data + offset);
+                uint32_t chunk_type = read32(file.data + offset + 4);
+                const char* chunk = file.data + offset + 8;
+                if (chunk_size > length - offset - 8){
+                    break;
+                }
+                if (chunk_type == GLB_CHUNK_JSON){
+                    json = parse_json(chunk, chunk_size);
+                }
+                else if (chunk_type == GLB_CHUNK_BIN && bin == nullptr){
+                    bin = chunk;
+                    bin_size = chunk_size;
+                }
+                // chunks are padded to 4 bytes
+                offset += 8 + ((chunk_size + 3) & ~3u);
+            }
+        }
+        catch(std::runtime_error& e){
+            std::cerr << filename << ": " << e.what() << std::endl;
+            return false;
+        }
+        if (json.type != JsonType::OBJECT){
+            std::cerr << filename << " has no JSON chunk" << std::endl;
+            return false;
+        }
+
+        const JsonValue& buffer_list = json["buffers"];
+        for (size_t i = 0; i < buffer_list.size(); i++){
+            const JsonValue& buffer = buffer_list[i];
+            size_t byte_length = buffer["byteLength"].as_number();
+            if (!buffer.has("uri")){
+                buffers.push_back({bin, std::min(byte_length, bin_size)});
+                continue;
+            }
+            // data: uris aren't supported, the buffer is left empty and accessors into it fail
+            std::unique_ptr<MappedFile> mapped = std::make_unique<MappedFile>();
+            if (buffer["uri"].as_string().rfind("data:", 0) == 0 || !mapped->open(path + buffer["uri"].as_string())){
+                std::cerr << "Could not open buffer " << buffer["uri"].as_string() << std::endl;
+                buffers.push_back({nullptr, 0});
+                continue;
+            }
+            buffers.push_back({mapped->data, std::min(byte_length, mapped->size)});
+            external.push_back(std::move(mapped));
+        }
+        return true;
+    }
+
+    // false if the accessor is missing, sparse, or reaches outside its buffer
+    bool accessor(int index, GltfAccessor& out){
+        const JsonValue& acc = json["accessors"][index];
+        if (acc.type != JsonType::OBJECT || !acc.has("bufferView") || acc.has("sparse")){
+            return false;
+        }
+        const JsonValue& view = json["bufferViews"][acc["bufferView"].as_int()];
+        int buffer = view["buffer"].as_int();
+        if (view.type != JsonType::OBJECT || buffer < 0 || buffer >= (int) buffers.size() || buffers[buffer].first == nullptr){
+            return false;
+        }
+        out.component_type = acc["componentType"].as_int();
+        out.components = GltfAccessor::component_count(acc["type"].as_string());
+        out.normalized = acc["normalized"].boolean;
+        out.count = acc["count"].as_number();
+        size_t element_size = out.components * GltfAccessor::component_size(out.component_type);
+        out.stride = view.has("byteStride") ? (size_t) view["byteStride"].as_number() : element_size;
+        size_t view_offset = view["byteOffset"].as_number();
+        size_t view_length = view["byteLength"].as_number();
+        size_t offset = acc["byteOffset"].as_number();
+        if (element_size == 0 || view_offset + view_length > buffers[buffer].second){
+            return false;
+        }
+        if (out.count > 0 && offset + (out.count - 1) * out.stride + element_size > view_length){
+            return false;
+        }
+        out.data = buffers[buffer].first + view_offset + offset;
+        return true;
+    }
+
+    // column major matrix, or translation * rotation * scale
+    Mat4 node_matrix(const JsonValue& node){
+        Mat4 matrix;
+        if (node.has("matrix")){
+            for (int i = 0; i < 16; i++){
+                matrix(i % 4, i / 4) = node["matrix"][i].as_number(i % 5 == 0);
+            }
+            return matrix;
+        }
+        const JsonValue& t = node["translation"];
+        const JsonValue& r = node["rotation"];
+        const JsonValue& s = node["scale"];
+        Mat4 translation = Mat4::create_translation(Vector3(t[0].as_number(), t[1].as_number(), t[2].as_number()));
+        Mat4 scale = Mat4::create_scalar(Vector3(s[0].as_number(1), s[1].as_number(1), s[2].as_number(1)));
+        // unit quaternion x, y, z, w
+        float x = r[0].as_number(), y = r[1].as_number(), z = r[2].as_number(), w = r[3].as_number(1);
+        Mat4 rotation;
+        rotation(0, 0) = 1 - 2 * (y * y + z * z);
+        rotation(0, 1) = 2 * (x * y - z * w);
+        rotation(0, 2) = 2 * (x * z + y * w);
+        rotation(1, 0) = 2 * (x * y + z * w);
+        rotation(1, 1) = 1 - 2 * (x * x + z * z);
+        rotation(1, 2) = 2 * (y * z - x * w);
+        rotation(2, 0) = 2 * (x * z - y * w);
+        rotation(2, 1) = 2 * (y * z + x * w);
+        rotation(2, 2) = 1 - 2 * (x * x + y * y);
+        return translation * rotation * scale;
+    }
+
+    // builds one primitive of a mesh in its own space, false if it isn't a triangle list
+    bool load_primitive(const JsonValue& primitive, TriangleMesh& mesh){
+        if (primitive["mode"].as_int(GLTF_TRIANGLES) != GLTF_TRIANGLES){
+            std::cout << "Skipping primitive that isn't a triangle list" << std::endl;
+            return false;
+        }
+        const JsonValue& attributes = primitive["attributes"];
+        GltfAccessor positions;
+        if (!accessor(attributes["POSITION"].as_int(-1), positions) || positions.components != 3){
+            return false;
+        }
+        positions.read_vec3(mesh.vertices);
+
+        GltfAccessor normals;
+        if (attributes.has("NORMAL") && accessor(attributes["NORMAL"].as_int(), normals) && normals.count == positions.count){
+            normals.read_vec3(mesh.normals);
+        }
+        GltfAccessor texcoords;
+        mesh.texcoords.resize(positions.count, Vector3(0, 0, 0));
+        if (attributes.has("TEXCOORD_0") && accessor(attributes["TEXCOORD_0"].as_int(), texcoords) && texcoords.count == positions.count){
+            // glTF puts v = 0 at the top of the image, textures here are sampled with v = 0 at the bottom
+            for (size_t i = 0; i < texcoords.count; i++){
+                mesh.texcoords[i] = Vector3(texcoords.get_float(i, 0), 1 - texcoords.get_float(i, 1), 0);
+            }
+        }
+
+        // every attribute shares the one index, so each corner is v/vt/vn with the same number
+        GltfAccessor indices;
+        bool indexed = primitive.has("indices");
+        if (indexed && !accessor(primitive["indices"].as_int(), indices)){
+            return false;
+        }
+        size_t index_count = indexed ? indices.count : positions.count;
+        mesh.faces.resize(index_count / 3);
+        for (size_t f = 0; f < mesh.faces.size(); f++){
+            Face& face = mesh.faces[f];
+            for (int corner = 0; corner < 3; corner++){
+                size_t i = f * 3 + corner;
+                uint32_t index = indexed ? indices.get_index(i) : i;
+                if (index >= positions.count){
+                    return false;
+                }
+                face[corner * 3] = face[corner * 3 + 1] = face[corner * 3 + 2] = index + 1;
+            }
+        }
+        if (mesh.normals.empty()){
+            mesh.calculate_normals();
+        }
+        return !mesh.faces.empty();
+    }
+
+    // base colour factor and texture of each material, textures load together on several threads
+    std::vector<Material> load_materials(){
+        const JsonValue& material_list = json["materials"];
+        std::vector<Material> materials(material_list.size());
+        std::vector<std::string> texture_files;
+        std::vector<int> textured;
+        for (size_t i = 0; i < material_list.size(); i++){
+            const JsonValue& pbr = material_list[i]["pbrMetallicRoughness"];
+            const JsonValue& factor = pbr["baseColorFactor"];
+            materials[i].K_d = Vector3(factor[0].as_number(1), factor[1].as_number(1), factor[2].as_number(1));
+            if (!pbr.has("baseColorTexture")){
+                continue;
+            }
+            const JsonValue& texture = json["textures"][pbr["baseColorTexture"]["index"].as_int()];
+            const JsonValue& image = json["images"][texture["source"].as_int()];
+            if (!image.has("uri")){
+                std::cout << "Skipping texture embedded in the binary, only QOI files are supported" << std::endl;
+                continue;
+            }
+            // textures are decoded from QOI, so use the .qoi next to a .png or .jpg
+            std::string uri = image["uri"].as_string();
+            size_t dot = uri.find_last_of('.');
+            if (dot != std::string::npos){
+                uri = uri.substr(0, dot);
+            }
+            texture_files.push_back(path + uri + ".qoi");
+            textured.push_back(i);
+        }
+        std::vector<std::shared_ptr<Texture>> textures = texture_registry.load_all(texture_files);
+        for (size_t i = 0; i < textured.size(); i++){
+            if (textures[i] == nullptr){
+                std::cout << "Missing texture: " << texture_files[i] << std::endl;
+                continue;
+            }
+            materials[textured[i]].K_Dtex = textures[i];
+            materials[textured[i]].K_Dtex_file = texture_files[i];
+        }
+        return materials;
+    }
+
+    // world matrix of every node that places a mesh, walking down from the scenes roots
+    void collect_placements(int node_index, const Mat4& parent, int depth, std::vector<std::pair<int, Mat4>>& placements){
+        const JsonValue& node = json["nodes"][node_index];
+        if (node.type != JsonType::OBJECT || depth > 64){
+            return;
+        }
+        Mat4 world = parent * node_matrix(node);
+        if (node.has("mesh")){
+            placements.push_back({node["mesh"].as_int(), world});
+        }
+        const JsonValue& children = node["children"];
+        for (size_t i = 0; i < children.size(); i++){
+            collect_placements(children[i].as_int(), world, depth + 1, placements);
+        }
+    }
+};
+
+
+// loads the default scene of a .glb into a BVH of its meshes
+// meshes placed once are moved into world space, meshes placed several times are shared by instances
+BVH load_glb(const std::string& filename){
+    TRACE_SCOPE("load_glb", filename);
+    auto start = std::chrono::high_resolution_clock::now();
+    GltfFile gltf;
+    if (!gltf.open(filename)){
+        return BVH();
+    }
+    const JsonValue& json = gltf.json;
+
+    std::vector<std::pair<int, Mat4>> placements;
+    const JsonValue& scene = json["scenes"][json["scene"].as_int(0)];
+    if (scene.has("nodes")){
+        for (size_t i = 0; i < scene["nodes"].size(); i++){
+            gltf.collect_placements(scene["nodes"][i].as_int(), Mat4(), 0, placements);
+        }
+    }
+    else{
+        // no scene, every node nothing else has as a child is a root
+        std::vector<bool> is_child(json["nodes"].size(), false);
+        for (size_t i = 0; i < json["nodes"].size(); i++){
+            const JsonValue& children = json["nodes"][i]["children"];
+            for (size_t c = 0; c < children.size(); c++){
+                int child = children[c].as_int();
+                if (child >= 0 && child < (int) is_child.size()){
+                    is_child[child] = true;
+                }
+            }
+        }
+        for (size_t i = 0; i < is_child.size(); i++){
+            if (!is_child[i]){
+                gltf.collect_placements(i, Mat4(), 0, placements);
+            }
+        }
+    }
+
+    std::map<int, int> uses;
+    for (auto& placement: placements){
+        uses[placement.first]++;
+    }
+    std::vector<Material> materials = gltf.load_materials();
+
+    // each primitive is a mesh of its own with a single material
+    std::vector<std::shared_ptr<Observable>> objects;
+    long long face_count = 0;
+    int instance_count = 0;
+    std::map<int, std::vector<std::shared_ptr<TriangleMesh>>> shared_meshes;
+    for (auto& placement: placements){
+        int mesh_index = placement.first;
+        bool shared = uses[mesh_index] > 1;
+        if (shared && shared_meshes.find(mesh_index) != shared_meshes.end()){
+            for (std::shared_ptr<TriangleMesh>& mesh: shared_meshes[mesh_index]){
+                objects.push_back(std::make_shared<Instance>(mesh, placement.second));
+                instance_count++;
+            }
+            continue;
+        }
+        const JsonValue& primitives = json["meshes"][mesh_index]["primitives"];
+        std::vector<std::shared_ptr<TriangleMesh>> built;
+        for (size_t p = 0; p < primitives.size(); p++){
+            std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+            if (!gltf.load_primitive(primitives[p], *mesh)){
+                continue;
+            }
+            mesh->name = json["meshes"][mesh_index]["name"].as_string();
+            if (mesh->name.empty()){
+                mesh->name = "mesh" + std::to_string(mesh_index);
+            }
+            if (primitives.size() > 1){
+                mesh->name += "." + std::to_string(p);
+            }
+            int material = primitives[p]["material"].as_int(-1);
+            if (material >= 0 && material < (int) materials.size()){
+                mesh->mat = materials[material];
+            }
+            if (!shared){
+                mesh->object_matrix = placement.second;
+                mesh->transform();
+            }
+            else{
+                mesh->recalc_bounding_box();
+            }
+            mesh->recalc_tree();
+            face_count += mesh->faces.size();
+            built.push_back(mesh);
+        }
+        for (std::shared_ptr<TriangleMesh>& mesh: built){
+            if (shared){
+                objects.push_back(std::make_shared<Instance>(mesh, placement.second));
+                instance_count++;
+            }
+            else{
+                objects.push_back(mesh);
+            }
+        }
+        if (shared){
+            shared_meshes[mesh_index] = built;
+        }
+    }
+    if (objects.empty()){
+        std::cerr << "No triangle meshes in " << filename << std::endl;
+        return BVH();
+    }
+
+    BVH bvh(objects);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Loaded " << filename << ": " << objects.size() << " objects (" << instance_count << " instances), "
+              << face_count << " faces in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    return bvh;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Vector.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// what a heatmap render shows for each pixel in place of its colour
+enum class HeatmapMetric{NONE, NODES, AABB_TESTS, TRIANGLES, TIME};
+
+inline HeatmapMetric parse_heatmap_metric(const std::string& name){
+    if (name == "nodes") return HeatmapMetric::NODES;
+    if (name == "aabb") return HeatmapMetric::AABB_TESTS;
+    if (name == "triangles") return HeatmapMetric::TRIANGLES;
+    if (name == "time") return HeatmapMetric::TIME;
+    return HeatmapMetric::NONE;
+}
+
+inline const char* heatmap_metric_name(HeatmapMetric metric){
+    switch (metric){
+        case HeatmapMetric::NODES: return "BVH nodes visited";
+        case HeatmapMetric::AABB_TESTS: return "AABB tests";
+        case HeatmapMetric::TRIANGLES: return "triangle tests";
+        case HeatmapMetric::TIME: return "ns";
+        default: return "none";
+    }
+}
+
+
+// false colour for t from 0 to 1, dark blue through cyan, green, yellow and red
+inline Vector3 heat_colour(float t){
+    static const Vector3 stops[] = {
+        Vector3(0, 0, 0.2f), Vector3(0, 0.2f, 1), Vector3(0, 1, 1), Vector3(0, 1, 0), Vector3(1, 1, 0), Vector3(1, 0, 0)
+    };
+    const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+    t = std::max(0.0f, std::min(t, 1.0f)) * last;
+    int i = std::min((int) t, last - 1);
+    float f = t - i;
+    return stops[i] * (1 - f) + stops[i + 1] * f;
+}
+
+struct HeatmapSummary{
+    float mean, p50, p90, p99, max;
+};
+
+inline HeatmapSummary summarise_costs(std::vector<float> costs){
+    HeatmapSummary summary = {0, 0, 0, 0, 0};
+    if (costs.empty()){
+        return summary;
+    }
+    std::sort(costs.begin(), costs.end());
+    double total = 0;
+    for (float c: costs){
+        total += c;
+    }
+    auto percentile = [&](float p){return costs[std::min(costs.size() - 1, (size_t) (p * costs.size()))];};
+    summary.mean = total / costs.size();
+    summary.p50 = percentile(0.5f);
+    summary.p90 = percentile(0.9f);
+    summary.p99 = percentile(0.99f);
+    summary.max = costs.back();
+    return summary;
+}
+
+
+// 3x5 pixel glyphs for the legend labels, rows top to bottom
+const std::string HEATMAP_GLYPHS = "0123456789kM";
+const char* const HEATMAP_FONT[] = {
+    "111101101101111", "010110010010111", "111001111100111", "111001111001111", "101101111001001", "111100111001111",
+    "111100111101111", "111001001001001", "111101111101111", "111101111001111", "100101110101101", "101111111101101"
+};
+
+// whole numbers, thousands and millions shortened so labels stay narrow
+inline std::string heatmap_label(float value){
+    long long v = (long long) (value + 0.5f);
+    if (v >= 10000000){
+        return std::to_string(v / 1000000) + "M";
+    }
+    if (v >= 10000){
+        return std::to_string(v / 1000) + "k";
+    }
+    return std::to_string(v);
+}
+
+// text in white into packed RGB, each glyph pixel drawn as a scale x scale block
+inline void draw_text(std::vector<uint8_t>& rgb, int width, int height, int x, int z, const std::string& text, int scale){
+    for (char c: text){
+        size_t glyph = HEATMAP_GLYPHS.find(c);
+        if (glyph != std::string::npos){
+            for (int i = 0; i < 15; i++){
+                if (HEATMAP_FONT[glyph][i] != '1'){
+                    continue;
+                }
+                for (int dz = 0; dz < scale; dz++){
+                    for (int dx = 0; dx < scale; dx++){
+                        int px = x + (i % 3) * scale + dx;
+                        int pz = z + (i / 3) * scale + dz;
+                        if (px >= 0 && px < width && pz >= 0 && pz < height){
+                            uint8_t* p = &rgb[((size_t) pz * width + px) * 3];
+                            p[0] = p[1] = p[2] = 255;
+                        }
+                    }
+                }
+            }
+        }
+        x += 4 * scale;
+    }
+}
+
+// colour bar from 0 to max_value along the bottom of the image, with values under it
+inline void draw_legend(std::vector<uint8_t>& rgb, int width, int height, float max_value){
+    const int scale = 2;
+    const int bar_height = 10;
+    const int margin = 4;
+    int legend_height = bar_height + 5 * scale + 3 * margin;
+    if (height < 4 * legend_height || width < 128){
+        return;
+    }
+    int z0 = height - legend_height;
+    int x0 = margin;
+    int x1 = width - margin;
+    for (int z = z0; z < height; z++){
+        for (int x = 0; x < width; x++){
+            uint8_t* p = &rgb[((size_t) z * width + x) * 3];
+            p[0] = p[1] = p[2] = 0;
+        }
+    }
+    for (int z = z0 + margin; z < z0 + margin + bar_height; z++){
+        for (int x = x0; x < x1; x++){
+            Vector3 c = heat_colour((float) (x - x0) / (x1 - x0 - 1));
+            uint8_t* p = &rgb[((size_t) z * width + x) * 3];
+            p[0] = c.x * 255;
+            p[1] = c.y * 255;
+            p[2] = c.z * 255;
+        }
+    }
+    // ticks at every quarter, the last label is pulled in so it fits
+    int text_z = z0 + 2 * margin + bar_height;
+    for (int i = 0; i <= 4; i++){
+        std::string label = heatmap_label(max_value * i / 4);
+        int label_width = label.size() * 4 * scale;
+        int x = x0 + (x1 - x0 - 1) * i / 4;
+        x = std::max(x0, std::min(x - label_width / 2, x1 - label_width));
+        draw_text(rgb, width, height, x, text_z, label, scale);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include "ImageWriter.h"
+#include "QOI.h"
+#include "PNG.h"
+
+
+
+// an encoder for filename by its extension, PNG for .png and QOI for anything else
+// kept out of ImageWriter.h because the writers include that for their base
+inline std::unique_ptr<ImageWriter> open_image_writer(std::ofstream& output, const std::string& filename, int width, int height){
+    if (filename.size() >= 4 && filename.substr(filename.size() - 4) == ".png"){
+        return std::make_unique<PNGWriter>(output, width, height);
+    }
+    return std::make_unique<QOIWriter>(output, width, height);
+}
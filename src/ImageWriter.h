@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// an image encoder fed scanlines top to bottom as they are rendered
+struct ImageWriter{
+    virtual ~ImageWriter(){}
+
+    // encode the next count pixels of packed 8 bit RGB
+    virtual void write_rgb8(const uint8_t* rgb, size_t count) = 0;
+
+    // flush everything once the last row has been written
+    virtual void finish() = 0;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "TriangleMesh.h"
+#include "Mat4.h"
+
+
+// a mesh placed in the scene by a transform, several instances share one mesh and its tree
+// rays are moved into the meshes space instead of moving the mesh into world space
+struct Instance: public Observable{
+    std::shared_ptr<TriangleMesh> mesh;
+    Mat4 object_matrix;
+    Mat4 inverse;
+    Mat4 normal_matrix;
+    Vector3 bounds[2];
+
+    Instance(std::shared_ptr<TriangleMesh> mesh_, const Mat4& matrix) : mesh(mesh_), object_matrix(matrix){
+        mat = mesh->mat;
+        inverse = Mat4::invert(object_matrix);
+        normal_matrix = Mat4::transpose(inverse);
+        // world bounds from the corners of the meshes box
+        bounds[0] = Vector3(1e8f);
+        bounds[1] = Vector3(-1e8f);
+        for (int i = 0; i < 8; i++){
+            Vector3 corner = Vector3(mesh->boundingBox[i & 1].x, mesh->boundingBox[(i >> 1) & 1].y, mesh->boundingBox[i >> 2].z);
+            Vector3 world = Mat4::transform_point(object_matrix, corner);
+            bounds[0] = Vector3::min(bounds[0], world);
+            bounds[1] = Vector3::max(bounds[1], world);
+        }
+    }
+
+    Vector3 centroid(){
+        return (bounds[0] + bounds[1]) * 0.5f;
+    }
+
+    Vector3 max_vertex(){
+        return bounds[1];
+    }
+
+    Vector3 min_vertex(){
+        return bounds[0];
+    }
+
+    // the ray in the meshes space, differentials included
+    // the direction isn't normalised, so distances along the local ray are distances along the world ray
+    Ray local_ray(const Ray& ray) const{
+        Ray local = Ray(Mat4::transform_point(inverse, ray.origin), Mat4::transform_direction(inverse, ray.direction));
+        if (ray.has_differentials){
+            local.has_differentials = true;
+            local.rx_origin = Mat4::transform_point(inverse, ray.rx_origin);
+            local.rx_direction = Mat4::transform_direction(inverse, ray.rx_direction);
+            local.rz_origin = Mat4::transform_point(inverse, ray.rz_origin);
+            local.rz_direction = Mat4::transform_direction(inverse, ray.rz_direction);
+        }
+        return local;
+    }
+
+    bool intersect(const Ray& ray, RayHit& inter){
+        if (!mesh->intersect(local_ray(ray), inter)){
+            return false;
+        }
+        inter.point = ray.at(inter.distance);
+        inter.normal = Vector3::normalize(Mat4::transform_direction(normal_matrix, inter.normal));
+        return true;
+    }
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+
+enum class JsonType{NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT};
+
+// just enough JSON for scene description files, parsed into a tree of values
+struct JsonValue{
+    JsonType type = JsonType::NUL;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+
+    bool has(const std::string& key) const{
+        return type == JsonType::OBJECT && object.find(key) != object.end();
+    }
+
+    // missing keys and out of range indices give a null value, so lookups can be chained
+    const JsonValue& operator[](const std::string& key) const{
+        static const JsonValue null_value;
+        if (type != JsonType::OBJECT){
+            return null_value;
+        }
+        auto it = object.find(key);
+        return (it == object.end()) ? null_value : it->second;
+    }
+
+    const JsonValue& operator[](size_t index) const{
+        static const JsonValue null_value;
+        if (type != JsonType::ARRAY || index >= array.size()){
+            return null_value;
+        }
+        return array[index];
+    }
+
+    size_t size() const{
+        return (type == JsonType::ARRAY) ? array.size() : object.size();
+    }
+
+    double as_number(double fallback = 0) const{
+        return (type == JsonType::NUMBER) ? number : fallback;
+    }
+
+    int as_int(int fallback = 0) const{
+        return (type == JsonType::NUMBER) ? (int) number : fallback;
+    }
+
+    const std::string& as_string() const{
+        return string;
+    }
+};
+
+
+// recursive descent parser, throws std::runtime_error on malformed input
+struct JsonParser{
+    const char* p;
+    const char* end;
+
+    JsonParser(const char* data, size_t size) : p(data), end(data + size){}
+
+    void fail(const char* message){
+        throw std::runtime_error(std::string("Invalid JSON: ") + message);
+    }
+
+    void skip_whitespace(){
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+
+    void expect(char c){
+        skip_whitespace();
+        if (p >= end || *p != c){
+            fail("unexpected character");
+        }
+        p++;
+    }
+
+    bool match(const char* word){
+        size_t length = strlen(word);
+        if ((size_t) (end - p) >= length && strncmp(p, word, length) == 0){
+            p += length;
+            return true;
+        }
+        return false;
+    }
+
+    // appends code point c as UTF-8
+    static void append_utf8(std::string& out, uint32_t c){
+        if (c < 0x80){
+            out += (char) c;
+        }
+        else if (c < 0x800){
+            out += (char) (0xc0 | (c >> 6));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+        else if (c < 0x10000){
+            out += (char) (0xe0 | (c >> 12));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+        else{
+            out += (char) (0xf0 | (c >> 18));
+            out += (char) (0x80 | ((c >> 12) & 0x3f));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+    }
+
+    uint32_t parse_hex4(){
+        if (end - p < 4){
+            fail("short unicode escape");
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++){
+            char c = *p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else fail("bad unicode escape");
+        }
+        return value;
+    }
+
+    std::string parse_string(){
+        expect('"');
+        std::string out;
+        while (true){
+            if (p >= end){
+                fail("unterminated string");
+            }
+            char c = *p++;
+            if (c == '"'){
+                return out;
+            }
+            if (c != '\\'){
+                out += c;
+                continue;
+            }
+            if (p >= end){
+                fail("unterminated string");
+            }
+            char e = *p++;
+            switch (e){
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':{
+                    uint32_t c = parse_hex4();
+                    // surrogate pair
+                    if (c >= 0xd800 && c < 0xdc00 && match("\\u")){
+                        uint32_t low = parse_hex4();
+                        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    append_utf8(out, c);
+                    break;
+                }
+                default: fail("bad escape");
+            }
+        }
+    }
+
+    JsonValue parse_value(){
+        skip_whitespace();
+        if (p >= end){
+            fail("unexpected end");
+        }
+        JsonValue value;
+        if (*p == '{'){
+            p++;
+            value.type = JsonType::OBJECT;
+            skip_whitespace();
+            if (p < end && *p == '}'){
+                p++;
+                return value;
+            }
+            while (true){
+                std::string key = parse_string();
+                expect(':');
+                value.object[key] = parse_value();
+                skip_whitespace();
+                if (p < end && *p == ','){
+                    p++;
+                    continue;
+                }
+                expect('}');
+                return value;
+            }
+        }
+        if (*p == '['){
+            p++;
+            value.type = JsonType::ARRAY;
+            skip_whitespace();
+            if (p < end && *p == ']'){
+                p++;
+                return value;
+            }
+            while (true){
+                value.array.push_back(parse_value());
+                skip_whitespace();
+                if (p < end && *p == ','){
+                    p++;
+                    continue;
+                }
+                expect(']');
+                return value;
+            }
+        }
+        if (*p == '"'){
+            value.type = JsonType::STRING;
+            value.string = parse_string();
+            return value;
+        }
+        if (match("true")){
+            value.type = JsonType::BOOLEAN;
+            value.boolean = true;
+            return value;
+        }
+        if (match("false")){
+            value.type = JsonType::BOOLEAN;
+            return value;
+        }
+        if (match("null")){
+            return value;
+        }
+        // strtod needs a terminated string, numbers are short so copy one out
+        const char* start = p;
+        while (p < end && (isdigit(*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) p++;
+        if (p == start){
+            fail("unexpected character");
+        }
+        std::string digits(start, p);
+        value.type = JsonType::NUMBER;
+        value.number = strtod(digits.c_str(), nullptr);
+        return value;
+    }
+
+    JsonValue parse(){
+        JsonValue value = parse_value();
+        skip_whitespace();
+        if (p != end){
+            fail("trailing characters");
+        }
+        return value;
+    }
+};
+
+
+// throws std::runtime_error if text isn't valid JSON
+inline JsonValue parse_json(const char* data, size_t size){
+    JsonParser parser = JsonParser(data, size);
+    return parser.parse();
+}
+
+// s as a quoted JSON string, for the few files written by hand
+inline std::string json_quote(const std::string& s){
+    std::string out = "\"";
+    for (char c: s){
+        if (c == '"' || c == '\\'){
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
@@ -5,15 +5,18 @@
 #include "SphericalLight.h"
 #include "TriangleMesh.h"
 #include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "ImageOutput.h"
 
-std::string DEFAULT_OUTPUT = "images/result.qoi";
+// the output format is picked from the extension, .png or .qoi
+std::string DEFAULT_OUTPUT = "images/result.png";
 int DEFAULT_WIDTH = 1920;
 int DEFAULT_HEIGHT = 1080;
 
 
 void bust(){
     std::ofstream output(DEFAULT_OUTPUT, std::ios::out|std::ios::binary);
-    QOIWriter qoi = QOIWriter(output, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, DEFAULT_OUTPUT, DEFAULT_WIDTH, DEFAULT_HEIGHT);
 
     Scene world = Scene();
 
@@ -25,24 +28,22 @@ void bust(){
     Mat4 object_matrix = Mat4::create_translation(Vector3(0, 20, -15)) * Mat4::create_rotation(Vector3(0, 0, M_PI/4));
     rhet->object_matrix = object_matrix;
     rhet->transform();
-    rhet->mat.K_Dtex = std::make_shared<ImageTexture>("objs/rhetorican/source/retheur_-_LowPoly_u1_v1.qoi");
+    rhet->mat.K_Dtex = texture_registry.get("objs/rhetorican/source/retheur_-_LowPoly_u1_v1.qoi");
     rhet->recalc_tree();
     world.add_object(rhet);
 
     world.ambientColour = Vector3::to_colour("#FFFFFF") * 0.3;
     world.add_light(std::make_shared<SphericalLight>(Vector3(-10,15,6), Vector3::to_colour("#FFFFFF"), 500, 0));
 
-    Renderer ren = Renderer(&qoi, DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
+    Renderer ren = Renderer(image.get(), DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
     ren.render();
-    std::cout << triangle_count << std::endl;
-    std::cout << AABBIntersectionCount << std::endl;
 
     output.close();
 }
 
 void jinx(){
     std::ofstream output(DEFAULT_OUTPUT, std::ios::out|std::ios::binary);
-    QOIWriter qoi = QOIWriter(output, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, DEFAULT_OUTPUT, DEFAULT_WIDTH, DEFAULT_HEIGHT);
 
     Scene world = Scene();
 
@@ -54,21 +55,19 @@ void jinx(){
 
     world.cam.setup(Vector3(-4.29, 0.4, 0.8), Vector3(0, 0.4, 0.8));
 
-    Renderer ren = Renderer(&qoi, DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
+    Renderer ren = Renderer(image.get(), DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
     ren.render();
-    std::cout << triangle_count << std::endl;
-    std::cout << AABBIntersectionCount << std::endl;
 
     output.close();
 }
 
 void apple(){
     std::ofstream output(DEFAULT_OUTPUT, std::ios::out|std::ios::binary);
-    QOIWriter qoi = QOIWriter(output, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, DEFAULT_OUTPUT, DEFAULT_WIDTH, DEFAULT_HEIGHT);
 
     Scene world = Scene();
 
-    SkySphere sky = SkySphere(std::make_shared<ImageTexture>("SkyTextures/peppermint_powerplant_4k.qoi"));
+    SkySphere sky = SkySphere(texture_registry.get("SkyTextures/peppermint_powerplant_4k.qoi"));
     world.sky = std::make_shared<SkySphere>(sky);
 
     std::shared_ptr<BVH> bvh = std::make_shared<BVH>(load_obj("objs/Apple/apple.obj"));
@@ -79,17 +78,15 @@ void apple(){
 
     world.cam.setup(Vector3(0, 0.4, 0), Vector3(0, 0, 0));
 
-    Renderer ren = Renderer(&qoi, DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
+    Renderer ren = Renderer(image.get(), DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
     ren.render();
-    std::cout << triangle_count << std::endl;
-    std::cout << AABBIntersectionCount << std::endl;
 
     output.close();
 }
 
 void cornell(){
     std::ofstream output(DEFAULT_OUTPUT, std::ios::out|std::ios::binary);
-    QOIWriter qoi = QOIWriter(output, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, DEFAULT_OUTPUT, DEFAULT_WIDTH, DEFAULT_HEIGHT);
 
     Scene world = Scene();
 
@@ -99,19 +96,53 @@ void cornell(){
     world.ambientColour = Vector3::to_colour("#FFFFFF") * 0.5;
     world.cam.setup(Vector3(0, 5, 10), Vector3(0, -5, 0));
 
-    Renderer ren = Renderer(&qoi, DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
+    Renderer ren = Renderer(image.get(), DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
     ren.render();
-    std::cout << triangle_count << std::endl;
-    std::cout << AABBIntersectionCount << std::endl;
 
     output.close();
 }
 
+// any .glb, the camera looks at it from a corner of its bounding box
+void gltf(const std::string& filename){
+    std::ofstream output(DEFAULT_OUTPUT, std::ios::out|std::ios::binary);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, DEFAULT_OUTPUT, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+
+    Scene world = Scene();
+
+    std::shared_ptr<BVH> bvh = std::make_shared<BVH>(load_glb(filename));
+    if (bvh->observables.empty()){
+        return;
+    }
+    world.add_object(bvh);
+
+    Vector3 centre = bvh->centroid();
+    float size = Vector3::length(bvh->max_vertex() - bvh->min_vertex());
+    world.ambientColour = Vector3::to_colour("#FFFFFF") * 0.35;
+    world.add_light(std::make_shared<SphericalLight>(centre + Vector3(-0.5, -1, 1.5) * size, Vector3::to_colour("#FFFFFF"), 300, 0));
+
+    world.cam.setup(centre + Vector3(-0.5, -0.6, 0.6) * size, centre);
+
+    Renderer ren = Renderer(image.get(), DEFAULT_WIDTH, DEFAULT_HEIGHT, world);
+    ren.render();
+
+    output.close();
+}
 
 
-int main(){
-    //bust();
-    //jinx();
-    //jinx();
-    cornell();
+// usage: main [scene.glb]
+int main(int argc, char** argv){
+    try{
+        if (argc > 1){
+            gltf(argv[1]);
+            return 0;
+        }
+        //bust();
+        //jinx();
+        //jinx();
+        cornell();
+    }
+    catch(MemoryBudgetExceeded& e){
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 }
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "texture.h"
+#include "TextureRegistry.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 
 struct Material{
@@ -16,9 +20,44 @@ struct Material{
     float N_i = 1;
     float d = 1;
     std::shared_ptr<Texture> K_Dtex = nullptr;
+    // where K_Dtex was loaded from, so cached scenes can load it again
+    std::string K_Dtex_file = "";
 };
 
 
+// materials that outlive the meshes they came from, for meshes that can be freed while hits on
+// them are still waiting to be shaded, equal materials are stored once
+struct MaterialArena{
+    std::mutex lock;
+    // a deque never moves what it holds, so the pointers handed out stay valid until the program ends
+    std::deque<Material> materials;
+    std::unordered_map<std::string, const Material*> by_key;
+
+    static std::string key(const Material& mat){
+        std::ostringstream key;
+        // hex floats so materials that differ in the last bit don't share an entry
+        key << std::hexfloat << mat.K_a.x << " " << mat.K_a.y << " " << mat.K_a.z << " " << mat.K_d.x << " " << mat.K_d.y << " " << mat.K_d.z << " "
+            << mat.K_s.x << " " << mat.K_s.y << " " << mat.K_s.z << " " << mat.N_s << " " << mat.N_i << " " << mat.d << " "
+            << mat.K_Dtex.get() << " " << mat.K_Dtex_file;
+        return key.str();
+    }
+
+    const Material* intern(const Material& mat){
+        std::string k = key(mat);
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = by_key.find(k);
+        if (it != by_key.end()){
+            return it->second;
+        }
+        materials.push_back(mat);
+        by_key[k] = &materials.back();
+        return &materials.back();
+    }
+};
+
+MaterialArena material_arena;
+
+
 
 struct DefaultMaterial: public Material{
     DefaultMaterial(std::string colour){
@@ -34,6 +73,15 @@ struct DefaultMaterial: public Material{
 Material parse_material(const std::string& filename){
     Material mat;
 
+    std::string path;
+    size_t last_slash = filename.find_last_of("/\\");
+    if (last_slash != std::string::npos){
+        path = filename.substr(0, last_slash + 1);
+    }
+    else{
+        path = "./";
+    }
+
     std::ifstream file(filename);
     if(!file.is_open()){
         std::cerr << "Could not open file " << filename << std::endl;
@@ -48,7 +96,21 @@ Material parse_material(const std::string& filename){
         std::string component;
         iss >> component;
 
-        if (component == "Ka"){
+        if (component == "map_Kd"){
+            std::string texture_name = "";
+            iss >> texture_name;
+            try{
+                mat.K_Dtex = texture_registry.get(path + texture_name);
+                mat.K_Dtex_file = path + texture_name;
+            }
+            catch(MemoryBudgetExceeded& e){
+                throw;
+            }
+            catch(std::runtime_error& e){
+                std::cout << "Missing texture: " << path + texture_name << std::endl;
+            }
+        }
+        else if (component == "Ka"){
             Vector3 v;
             iss >> v.x >> v.y >> v.z;
             mat.K_a = v;
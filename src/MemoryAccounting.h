@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+// bytes the accounted subsystems may hold together, 0 for no limit
+// going over throws when the charge is made, so a scene too big for the machine fails
+// while loading with the category to blame instead of being killed part way through a render
+unsigned long long MEMORY_BUDGET = 0;
+
+// what going over MEMORY_BUDGET throws, loaders that skip files they can't read let it through
+struct MemoryBudgetExceeded: public std::runtime_error{
+    MemoryBudgetExceeded(const std::string& message) : std::runtime_error(message){}
+};
+
+enum MemoryCategory{
+    MEMORY_MESH_ATTRIBUTES,
+    MEMORY_INDICES,
+    MEMORY_BVH_NODES,
+    MEMORY_PRIMITIVES,
+    MEMORY_TEXTURES,
+    MEMORY_FRAMEBUFFERS,
+    MEMORY_COUNT
+};
+
+const char* const MEMORY_CATEGORY_NAMES[MEMORY_COUNT] = {
+    "mesh attributes", "indices", "BVH nodes", "primitives", "textures", "framebuffers"
+};
+
+
+// current and peak bytes of each category, the sizes come from the containers that hold them
+// rather than from the allocator, so they leave out allocator overhead and anything unaccounted
+struct MemoryAccounting{
+    std::atomic<long long> current[MEMORY_COUNT] = {};
+    std::atomic<long long> peak[MEMORY_COUNT] = {};
+    std::atomic<long long> total{0};
+    std::atomic<long long> total_peak{0};
+
+    static void raise_peak(std::atomic<long long>& peak_, long long value){
+        long long seen = peak_.load(std::memory_order_relaxed);
+        while (value > seen && !peak_.compare_exchange_weak(seen, value, std::memory_order_relaxed)){}
+    }
+
+    // bytes is negative when memory is given back, a charge over the budget is not recorded
+    void add(MemoryCategory category, long long bytes){
+        if (bytes == 0){
+            return;
+        }
+        long long new_total = total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (bytes > 0 && MEMORY_BUDGET > 0 && new_total > (long long) MEMORY_BUDGET){
+            total.fetch_sub(bytes, std::memory_order_relaxed);
+            char message[256];
+            snprintf(message, sizeof(message), "Memory budget of %.1fMB exceeded: %.1fMB more %s on top of %.1fMB in use",
+                     MEMORY_BUDGET / 1048576.0, bytes / 1048576.0, MEMORY_CATEGORY_NAMES[category], (new_total - bytes) / 1048576.0);
+            report("at the budget");
+            throw MemoryBudgetExceeded(message);
+        }
+        raise_peak(total_peak, new_total);
+        raise_peak(peak[category], current[category].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    }
+
+    void report(const std::string& when){
+        printf("Memory %s:\n", when.c_str());
+        printf("  %-16s %12s %12s\n", "category", "current MB", "peak MB");
+        for (int i = 0; i < MEMORY_COUNT; i++){
+            printf("  %-16s %12.1f %12.1f\n", MEMORY_CATEGORY_NAMES[i], current[i] / 1048576.0, peak[i] / 1048576.0);
+        }
+        printf("  %-16s %12.1f %12.1f\n", "total", total / 1048576.0, total_peak / 1048576.0);
+        if (MEMORY_BUDGET > 0){
+            printf("  %-16s %12.1f\n", "budget", MEMORY_BUDGET / 1048576.0);
+        }
+    }
+};
+
+MemoryAccounting memory_accounting;
+
+
+// the bytes one owner holds in a category, kept as a member next to the containers it stands for
+// and given back when the owner goes, copies charge again and moves hand the bytes over
+struct MemoryCharge{
+    MemoryCategory category;
+    long long bytes = 0;
+
+    MemoryCharge(MemoryCategory category_, size_t bytes_ = 0) : category(category_){
+        set(bytes_);
+    }
+
+    MemoryCharge(const MemoryCharge& other) : category(other.category){
+        set(other.bytes);
+    }
+
+    MemoryCharge(MemoryCharge&& other) noexcept : category(other.category), bytes(other.bytes){
+        other.bytes = 0;
+    }
+
+    MemoryCharge& operator=(const MemoryCharge& other){
+        if (this != &other){
+            set(other.bytes);
+        }
+        return *this;
+    }
+
+    MemoryCharge& operator=(MemoryCharge&& other) noexcept{
+        if (this != &other){
+            memory_accounting.add(category, -bytes);
+            bytes = other.bytes;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+
+    ~MemoryCharge(){
+        memory_accounting.add(category, -bytes);
+    }
+
+    // charge for bytes in place of what was charged before, throws if that goes over the budget
+    void set(size_t bytes_){
+        memory_accounting.add(category, (long long) bytes_ - bytes);
+        bytes = bytes_;
+    }
+};
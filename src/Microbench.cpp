@@ -0,0 +1,317 @@
+// times the inner kernels, the AABB slab test, the triangle test and BVH traversal, over fixed ray sets
+// variants are picked when compiling, build once per variant and compare the outputs side by side
+//   -DAABB_SLAB_VARIANT=n  -DTRIANGLE_VARIANT=n  -DREC_INTERSECTION=1
+// ray sets are camera rays, bounces off their hits, random rays through the scene, and optionally
+// a dump recorded from a real render by setting RAY_DUMP_OUTPUT before rendering
+// usage: microbench [-scene cornell|sphere_field|instances] [-obj file.obj] [-rays dump.rays] [-repeat n] [-o results.json]
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <set>
+#include "Scene.h"
+#include "ObjLoader.h"
+#include "BenchScenes.h"
+#include "RayDump.h"
+#include "Json.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HAVE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+// every timing is the best of this many runs
+int MICRO_REPEAT = 5;
+// rays and primitives the AABB and triangle kernels test all pairs of
+int MICRO_KERNEL_RAYS = 4096;
+int MICRO_KERNEL_PRIMITIVES = 1024;
+int MICRO_WIDTH = 320;
+int MICRO_HEIGHT = 180;
+const uint32_t MICRO_SEED = 4321;
+
+// results are added in here so the compiler can't drop the kernels
+volatile float micro_sink = 0;
+
+
+// time stamp counter, counts reference cycles rather than core cycles on most CPUs
+inline unsigned long long read_cycles(){
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct Timing{
+    double ns_per_op;
+    double cycles_per_op;
+};
+
+// best of MICRO_REPEAT runs of f, which does ops operations each run
+Timing time_kernel(size_t ops, const std::function<void()>& f){
+    Timing best = {1e30, 1e30};
+    for (int i = 0; i < MICRO_REPEAT; i++){
+        auto start = std::chrono::high_resolution_clock::now();
+        unsigned long long cycles = read_cycles();
+        f();
+        cycles = read_cycles() - cycles;
+        auto end = std::chrono::high_resolution_clock::now();
+        best.ns_per_op = std::min(best.ns_per_op, std::chrono::duration<double, std::nano>(end - start).count() / ops);
+        best.cycles_per_op = std::min(best.cycles_per_op, (double) cycles / ops);
+    }
+    return best;
+}
+
+
+// the boxes and triangles a scene is made of, pulled out of the trees
+struct KernelData{
+    std::vector<AABB> boxes;
+    std::vector<Triangle*> triangles;
+    // instances share a mesh, its primitives only need collecting once
+    std::set<TriangleMesh*> instanced_meshes;
+};
+
+void collect_kernel_data(Observable* obs, KernelData& data){
+    if (BVH* bvh = dynamic_cast<BVH*>(obs)){
+        for (uint i = 0; i < bvh->nodes_used; i++){
+            data.boxes.push_back(bvh->nodes[i].aabb);
+        }
+        for (std::shared_ptr<Observable>& child: bvh->observables){
+            collect_kernel_data(child.get(), data);
+        }
+        for (Triangle& tri: bvh->triangles){
+            data.triangles.push_back(&tri);
+        }
+    }
+    else if (TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(obs)){
+        collect_kernel_data(mesh->active_tree().get(), data);
+    }
+    else if (Instance* instance = dynamic_cast<Instance*>(obs)){
+        if (data.instanced_meshes.insert(instance->mesh.get()).second){
+            collect_kernel_data(instance->mesh.get(), data);
+        }
+    }
+    else if (Triangle* tri = dynamic_cast<Triangle*>(obs)){
+        data.triangles.push_back(tri);
+    }
+}
+
+// every step-th element so the sample spreads over the whole scene
+template<typename T>
+std::vector<T> spread_sample(const std::vector<T>& items, size_t count){
+    if (items.size() <= count){
+        return items;
+    }
+    std::vector<T> sample;
+    double step = (double) items.size() / count;
+    for (size_t i = 0; i < count; i++){
+        sample.push_back(items[(size_t) (i * step)]);
+    }
+    return sample;
+}
+
+
+struct RaySet{
+    std::string name;
+    std::vector<Ray> rays;
+};
+
+std::vector<RaySet> make_ray_sets(Scene& world, Vector3 bounds[2], const std::string& dump){
+    std::vector<RaySet> sets;
+    RaySet camera = {"camera", {}};
+    for (int z = 0; z < MICRO_HEIGHT; z++){
+        for (int x = 0; x < MICRO_WIDTH; x++){
+            Ray ray = world.cam.cast_ray(x, z);
+            camera.rays.push_back(Ray(ray.origin, ray.direction));
+        }
+    }
+
+    // scattered off whatever the camera rays hit
+    seed_random(MICRO_SEED);
+    RaySet bounce = {"bounce", {}};
+    for (const Ray& ray: camera.rays){
+        RayHit hit;
+        world.closest_intersection(hit, ray);
+        if (hit.distance != FINF){
+            bounce.rays.push_back(Ray(hit.point + hit.normal * 1e-3f, random_hemisphere_vector(hit.normal)));
+        }
+    }
+
+    // no coherence at all, from anywhere in the scene in any direction
+    RaySet random = {"random", {}};
+    Vector3 extent = bounds[1] - bounds[0];
+    for (size_t i = 0; i < camera.rays.size(); i++){
+        Vector3 origin = bounds[0] + extent * Vector3(random_value(), random_value(), random_value());
+        random.rays.push_back(Ray(origin, random_unit_vector()));
+    }
+
+    sets.push_back(camera);
+    sets.push_back(bounce);
+    sets.push_back(random);
+    if (dump != ""){
+        RaySet recorded = {"dump", {}};
+        if (read_ray_dump(dump, recorded.rays) && !recorded.rays.empty()){
+            sets.push_back(recorded);
+        }
+    }
+    return sets;
+}
+
+
+struct KernelResult{
+    std::string kernel;
+    std::string rays;
+    size_t ops;
+    Timing timing;
+    double hit_rate;
+};
+
+std::string variant_name(){
+    return "aabb=" + std::to_string(AABB_SLAB_VARIANT) + " triangle=" + std::to_string(TRIANGLE_VARIANT)
+           + " traversal=" + (REC_INTERSECTION ? "recursive" : "iterative");
+}
+
+void write_results(const std::string& filename, const std::string& scene, const std::vector<KernelResult>& results){
+    std::ofstream file(filename);
+    if (!file.is_open()){
+        std::cerr << "Could not open file " << filename << std::endl;
+        return;
+    }
+    file << "{\n";
+    file << "  \"variant\": " << json_quote(variant_name()) << ",\n";
+    file << "  \"aabb_variant\": " << AABB_SLAB_VARIANT << ",\n";
+    file << "  \"triangle_variant\": " << TRIANGLE_VARIANT << ",\n";
+    file << "  \"recursive_traversal\": " << REC_INTERSECTION << ",\n";
+    file << "  \"scene\": " << json_quote(scene) << ",\n";
+    file << "  \"tsc\": " << (HAVE_TSC ? "true" : "false") << ",\n";
+    file << "  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); i++){
+        const KernelResult& r = results[i];
+        file << "    {\"kernel\": \"" << r.kernel << "\", \"rays\": \"" << r.rays << "\", \"ops\": " << r.ops
+             << ", \"ns_per_op\": " << r.timing.ns_per_op << ", \"cycles_per_op\": " << r.timing.cycles_per_op
+             << ", \"hit_rate\": " << r.hit_rate << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+
+int main(int argc, char** argv){
+    std::string scene_name = "sphere_field";
+    std::string obj = "";
+    std::string dump = "";
+    std::string output = "";
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "-scene"){
+            scene_name = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "-obj"){
+            obj = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "-rays"){
+            dump = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "-repeat"){
+            MICRO_REPEAT = std::max(1, atoi(argv[++i]));
+        }
+        else if (i + 1 < argc && arg == "-o"){
+            output = argv[++i];
+        }
+        else{
+            std::cerr << "usage: microbench [-scene cornell|sphere_field|instances] [-obj file.obj] [-rays dump.rays] [-repeat n] [-o results.json]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::shared_ptr<BVH> top;
+    Scene world = Scene();
+    if (obj != ""){
+        // an OBJ has no camera of its own, it is looked at from outside its bounds
+        top = std::make_shared<BVH>(load_obj(obj));
+        Vector3 centre = top->centroid();
+        Vector3 extent = top->max_vertex() - top->min_vertex();
+        world.cam.setup(centre - Vector3(0, 1.5f * Vector3::length(extent), 0), centre);
+        scene_name = obj;
+    }
+    else{
+        BenchScene scene;
+        if (scene_name == "cornell") scene = cornell_scene();
+        else if (scene_name == "instances") scene = instance_scene();
+        else scene = sphere_field_scene();
+        top = scene.build();
+        world.cam.setup(scene.camera_position, scene.camera_target);
+    }
+    world.add_object(top);
+    world.setup_camera(MICRO_WIDTH, MICRO_HEIGHT);
+
+    KernelData data;
+    collect_kernel_data(top.get(), data);
+    std::vector<AABB> boxes = spread_sample(data.boxes, MICRO_KERNEL_PRIMITIVES);
+    std::vector<Triangle*> triangles = spread_sample(data.triangles, MICRO_KERNEL_PRIMITIVES);
+    Vector3 bounds[2] = {top->min_vertex(), top->max_vertex()};
+    std::vector<RaySet> sets = make_ray_sets(world, bounds, dump);
+
+    std::cout << "Variant " << variant_name() << ", " << data.boxes.size() << " boxes, " << data.triangles.size() << " triangles" << std::endl;
+    if (!HAVE_TSC){
+        std::cout << "No time stamp counter, cycles/op are not measured" << std::endl;
+    }
+    std::vector<KernelResult> results;
+    for (const RaySet& set: sets){
+        std::vector<Ray> kernel_rays = spread_sample(set.rays, MICRO_KERNEL_RAYS);
+
+        size_t hits = 0;
+        size_t ops = kernel_rays.size() * boxes.size();
+        Timing aabb = time_kernel(ops, [&](){
+            float total = 0;
+            hits = 0;
+            for (const Ray& ray: kernel_rays){
+                for (const AABB& box: boxes){
+                    float t = AABBIntersection(box, ray);
+                    hits += t != FINF;
+                    total += t;
+                }
+            }
+            micro_sink = total;
+        });
+        results.push_back({"aabb", set.name, ops, aabb, (double) hits / ops});
+
+        ops = kernel_rays.size() * triangles.size();
+        Timing triangle = time_kernel(ops, [&](){
+            hits = 0;
+            for (const Ray& ray: kernel_rays){
+                for (Triangle* tri: triangles){
+                    RayHit hit;
+                    hits += tri->intersect(ray, hit);
+                }
+            }
+        });
+        results.push_back({"triangle", set.name, ops, triangle, (double) hits / ops});
+
+        ops = set.rays.size();
+        Timing traversal = time_kernel(ops, [&](){
+            float total = 0;
+            hits = 0;
+            for (const Ray& ray: set.rays){
+                RayHit hit;
+                hits += top->intersect(ray, hit);
+                total += hit.distance;
+            }
+            micro_sink = total;
+        });
+        results.push_back({"traversal", set.name, ops, traversal, (double) hits / ops});
+    }
+
+    for (const KernelResult& r: results){
+        printf("%-10s %-7s %10.2f ns/op %10.1f cycles/op  %5.1f%% hit  (%zu ops)\n", r.kernel.c_str(), r.rays.c_str(),
+               r.timing.ns_per_op, r.timing.cycles_per_op, 100 * r.hit_rate, r.ops);
+    }
+    if (output != ""){
+        write_results(output, scene_name, results);
+        std::cout << "Results written to " << output << std::endl;
+    }
+}
@@ -2,17 +2,49 @@
 
 #include "TriangleMesh.h"
 #include "BVH.h"
+#include "SceneCache.h"
 #include <map>
 
-void parse_face(std::vector<int>& face, std::string line);
-int face_type(std::string line);
 void load_mtllib(std::string filename, std::map<std::string, Material>& materials);
 
+// open addressing map from 1 based file indices to 1 based mesh indices, 0 marks an empty slot
+struct IndexMap{
+    std::vector<std::pair<int, int>> slots;
+    size_t mask = 0;
+
+    void reset(size_t count){
+        size_t size = 16;
+        while (size < 2 * count){
+            size <<= 1;
+        }
+        slots.assign(size, {0, 0});
+        mask = size - 1;
+    }
+
+    // the mesh index of key, copying the value over from source the first time it is seen
+    // key has to be a valid index of source, see obj_index_valid
+    int find_or_add(int key, std::vector<Vector3>& target, const std::vector<Vector3>& source){
+        size_t i = ((uint32_t) key * 2654435761u) & mask;
+        while (slots[i].first != 0){
+            if (slots[i].first == key){
+                return slots[i].second;
+            }
+            i = (i + 1) & mask;
+        }
+        target.push_back(source[key - 1]);
+        slots[i] = {key, (int) target.size()};
+        return slots[i].second;
+    }
+};
+
+inline bool obj_index_valid(int key, const std::vector<Vector3>& source){
+    return key >= 1 && key <= (int) source.size();
+}
+
+
 BVH load_obj(const std::string& filename){
+    TRACE_SCOPE("load_obj", filename);
     std::vector<TriangleMesh> meshes;
-    std::vector<Vector3> vertices;
-    std::vector<Vector3> normals;
-    std::vector<Vector3> texcoords;
     std::map<std::string, Material> materials;
 
     std::string path;
@@ -24,67 +56,55 @@ BVH load_obj(const std::string& filename){
         path = "./";
     }
 
-    std::ifstream file(filename);
-    if(!file.is_open()){
-        std::cerr << "Could not open file " << filename << std::endl;
+#if USE_SCENE_CACHE
+    {
+        BVH cached;
+        if (load_scene_cache(filename, cached)){
+            return cached;
+        }
+    }
+    // every file the meshes are built from, the cache is stale if any of them changes
+    std::vector<std::string> sources = {filename};
+#endif
+
+    ObjData obj;
+    if (!parse_obj(filename, obj)){
         return BVH();
     }
+    std::vector<Vector3>& vertices = obj.vertices;
+    std::vector<Vector3>& normals = obj.normals;
+    std::vector<Vector3>& texcoords = obj.texcoords;
 
+    // walk the object and material lines in file order, splitting the faces into meshes
     TriangleMesh mesh;
-    std::string line;
-    while(std::getline(file, line)){
-        if(line.empty() || line[0] == '#') continue;
-        std::istringstream iss(line);
-        std::string type;
-        iss >> type;
-        if(type == "o"){
-            if (mesh.faces.size() > 0){
-                meshes.push_back(mesh);
-            }
-            mesh = TriangleMesh();
+    std::vector<std::pair<size_t, size_t>> face_ranges;
+    size_t first_face = 0;
+    auto end_mesh = [&](size_t last_face){
+        if (last_face > first_face){
+            meshes.push_back(std::move(mesh));
+            face_ranges.push_back({first_face, last_face});
         }
-        else if (type == "mtllib"){
-            std::string mtllib_name;
-            iss >> mtllib_name;
-            load_mtllib(path + mtllib_name, materials);
+        first_face = last_face;
+    };
+    for (const ObjEvent& event: obj.events){
+        if (event.type == ObjEventType::OBJECT){
+            end_mesh(event.face);
+            mesh = TriangleMesh();
+            mesh.name = event.name;
         }
-        else if (type == "usemtl"){
-            std::string mat_name;
-            iss >> mat_name;
-            if (materials.find(mat_name) != materials.end()){
-                mesh.mat = materials[mat_name];
-            }
+        else if (event.type == ObjEventType::MTLLIB){
+            load_mtllib(path + event.name, materials);
+#if USE_SCENE_CACHE
+            sources.push_back(path + event.name);
+#endif
         }
-        else if(line[0] == 'v'){
-            // vertex
-            if(type == "v"){
-                Vector3 v;
-                iss >> v.x >> v.y >> v.z;
-                vertices.push_back(v);
-            }
-            // vertex normal
-            else if(type == "vn"){
-                Vector3 vn;
-                iss >> vn.x >> vn.y >> vn.z;                     
-                normals.push_back(vn);
-            }
-            // vertex texture
-            else if(type == "vt"){
-                Vector3 vt;
-                iss >> vt.x >> vt.y;
-                texcoords.push_back(vt);
+        else if (event.type == ObjEventType::USEMTL){
+            if (materials.find(event.name) != materials.end()){
+                mesh.mat = materials[event.name];
             }
         }
-        // face
-        else if (line[0] == 'f'){
-            std::vector<int> face;
-            parse_face(face, line);
-            mesh.faces.push_back(face);
-        }
-    }
-    if (mesh.faces.size() > 0){
-        meshes.push_back(mesh);
     }
+    end_mesh(obj.faces.size());
 
     if (texcoords.size() == 0){
         texcoords.resize(vertices.size(), Vector3(0,0,0));
@@ -95,50 +115,64 @@ BVH load_obj(const std::string& filename){
         need_to_calc_normals = true;
     }
 
-    for (auto& mesh: meshes){
-        std::vector<std::vector<int>> new_faces;
-        for (auto face: mesh.faces){
-            std::vector<int> new_face;
-            // maps
-            std::map<int, int> vmap;
-            std::map<int, int> vtmap;
-            std::map<int, int> vnmap;
-            for (int i = 0; i < face.size(); i += 3){
-                int v = face[i];
-                int vt = face[i + 1];
-                int vn = face[i + 2];
-                if (vmap.find(v-1) == vmap.end()){
-                    mesh.vertices.push_back(vertices[v-1]);
-                    vmap[v-1] = mesh.vertices.size();
-                }
-                if (vtmap.find(vt-1) == vtmap.end()){
-                    mesh.texcoords.push_back(texcoords[vt-1]);
-                    vtmap[vt-1] = mesh.texcoords.size();
+    // renumber the file wide indices of each mesh, corners sharing an index share the entry
+    // faces with a vertex or normal index past the end of its array are skipped, a texcoord index
+    // past the end happens when a file mixes v//vn with v/vt/vn faces and reads as a zero texcoord
+    IndexMap vmap, vtmap, vnmap;
+    size_t skipped = 0;
+    for (size_t m = 0; m < meshes.size(); m++){
+        TriangleMesh& mesh = meshes[m];
+        TRACE_SCOPE("build mesh", mesh.name);
+        size_t first = face_ranges[m].first;
+        size_t last = face_ranges[m].second;
+        vmap.reset(3 * (last - first));
+        vtmap.reset(3 * (last - first));
+        vnmap.reset(3 * (last - first));
+        int zero_texcoord = 0;
+        mesh.faces.reserve(last - first);
+        for (size_t f = first; f < last; f++){
+            const Face& face = obj.faces[f];
+            if (!obj_index_valid(face[0], vertices) || !obj_index_valid(face[3], vertices) || !obj_index_valid(face[6], vertices)
+                || !obj_index_valid(face[2], normals) || !obj_index_valid(face[5], normals) || !obj_index_valid(face[8], normals)){
+                skipped++;
+                continue;
+            }
+            Face new_face;
+            for (int i = 0; i < 9; i += 3){
+                new_face[i] = vmap.find_or_add(face[i], mesh.vertices, vertices);
+                if (obj_index_valid(face[i + 1], texcoords)){
+                    new_face[i + 1] = vtmap.find_or_add(face[i + 1], mesh.texcoords, texcoords);
                 }
-                if (vnmap.find(vn-1) == vnmap.end()){
-                    mesh.normals.push_back(normals[vn-1]);
-                    vnmap[vn-1] = mesh.normals.size();
+                else{
+                    if (zero_texcoord == 0){
+                        mesh.texcoords.push_back(Vector3(0,0,0));
+                        zero_texcoord = mesh.texcoords.size();
+                    }
+                    new_face[i + 1] = zero_texcoord;
                 }
-                new_face.push_back(vmap[v-1]);
-                new_face.push_back(vtmap[vt-1]);
-                new_face.push_back(vnmap[vn-1]);
+                new_face[i + 2] = vnmap.find_or_add(face[i + 2], mesh.normals, normals);
             }
-            new_faces.push_back(new_face);
+            mesh.faces.push_back(new_face);
+        }
+        if (mesh.faces.empty()){
+            continue;
         }
-        mesh.faces = new_faces;
         if (need_to_calc_normals){
             mesh.calculate_normals();
         }
         mesh.recalc_bounding_box();
         mesh.recalc_tree();
     }
-    file.close();
+
+    if (skipped > 0){
+        std::cerr << "Skipped " << skipped << " faces with out of range indices in " << filename << std::endl;
+    }
 
     long long int vsum = 0;
     long long int vnsum = 0;
     long long int vtsum = 0;
     long long int fsum = 0;
-    for (auto mesh: meshes){
+    for (const auto& mesh: meshes){
         vsum += mesh.vertices.size();
         vnsum += mesh.normals.size();
         vtsum += mesh.texcoords.size();
@@ -150,77 +184,26 @@ BVH load_obj(const std::string& filename){
     std::cout << "faces: " << fsum << std::endl;
 
     std::vector<std::shared_ptr<Observable>> meshes_ptrs;
-    for (auto mesh: meshes){
-        std::shared_ptr<Observable> mesh_ptr = std::make_shared<TriangleMesh>(mesh);
+    for (auto& mesh: meshes){
+        if (mesh.faces.empty()){
+            continue;
+        }
+        std::shared_ptr<Observable> mesh_ptr = std::make_shared<TriangleMesh>(std::move(mesh));
         meshes_ptrs.push_back(mesh_ptr);
     }
+    if (meshes_ptrs.empty()){
+        std::cerr << "No faces in " << filename << std::endl;
+        return BVH();
+    }
     BVH bvh(meshes_ptrs);
+#if USE_SCENE_CACHE
+    save_scene_cache(filename, sources, bvh);
+#endif
     return bvh;
 }
 
-void parse_face(std::vector<int>& face, std::string line){
-    std::istringstream iss(line);
-    std::string type;
-    iss >> type;
-    std::string fc;
-
-    while (iss >> fc){
-        fc = replace_slash(fc);
-        int v;
-        std::istringstream fcss(fc);
-        fcss >> v;
-        face.push_back(v);
-        fcss >> v;
-        face.push_back(v);
-        fcss >> v;
-        face.push_back(v);
-    }
-
-    int ftype = face_type(line);
-    if (ftype == 1){
-        face[2] = face[0];
-        face[5] = face[3];
-        face[8] = face[6];
-        return;
-    }
-    else if(ftype == -1){
-        std::cerr << "Unknown face type" << std::endl;
-        return;
-    }
-}
-
-int face_type(std::string line){
-    // type 0 - f 1/2/3 4/5/6 7/8/9
-    // type 1 - f 1/2 3/4 5/6
-    // type 2 - f 1//2 3//4 5//6
-    // type 3 - f 1 2 3
-    if (line.find("//") != std::string::npos){
-        return 2;
-    }
-    if (line.find("/") == std::string::npos){
-        return 3;
-    }
-    // count number of "/"
-    int count = 0;
-    for (int i = 0; i < line.length(); i++){
-        if (line[i] == '/'){
-            count++;
-        }
-    }
-    if (count == 6){
-        return 0;
-    }
-    else if (count == 3){
-        return 1;
-    }
-    else {
-        std::cout << line << std::endl;
-        std::cerr << "Unknown face type" << std::endl;
-        return -1;
-    }
-}
-
 void load_mtllib(std::string filename, std::map<std::string, Material>& materials){
+    TRACE_SCOPE("load_mtllib", filename);
     std::ifstream file(filename);
     if(!file.is_open()){
         std::cerr << "Could not open file " << filename << std::endl;
@@ -239,6 +222,9 @@ void load_mtllib(std::string filename, std::map<std::string, Material>& material
     std::string line;
     Material mat;
     std::string mat_name = "";
+    // textures are loaded together at the end so distinct files load in parallel
+    std::string texture_file = "";
+    std::map<std::string, std::string> material_textures;
     while (std::getline(file, line)){
         if (line.empty()) continue;
 
@@ -249,18 +235,14 @@ void load_mtllib(std::string filename, std::map<std::string, Material>& material
         if (component == "newmtl"){
             if (mat_name != ""){
                 materials[mat_name] = mat;
+                material_textures[mat_name] = texture_file;
             }
             iss >> mat_name;
         }
         else if (component == "map_Kd"){
             std::string texure_name = "";
             iss >> texure_name;
-            try{
-                mat.K_Dtex = std::make_shared<ImageTexture>(path + texure_name);
-            }
-            catch(std::runtime_error& e){
-                std::cout << "Missing texture: " << path + texure_name << std::endl;
-            }
+            texture_file = path + texure_name;
         }
         else if (component == "Ka"){
             Vector3 v;
@@ -296,5 +278,25 @@ void load_mtllib(std::string filename, std::map<std::string, Material>& material
     }
     if (mat_name != ""){
         materials[mat_name] = mat;
+        material_textures[mat_name] = texture_file;
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::string> texture_files;
+    for (auto& entry: material_textures){
+        if (entry.second != ""){
+            names.push_back(entry.first);
+            texture_files.push_back(entry.second);
+        }
+    }
+    std::vector<std::shared_ptr<Texture>> textures = texture_registry.load_all(texture_files);
+    for (size_t i = 0; i < names.size(); i++){
+        if (textures[i] == nullptr){
+            std::cout << "Missing texture: " << texture_files[i] << std::endl;
+        }
+        else{
+            materials[names[i]].K_Dtex_file = texture_files[i];
+        }
+        materials[names[i]].K_Dtex = textures[i];
     }
 }
\ No newline at end of file
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <iostream>
+#include "Vector.h"
+#include "Face.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "MappedFile.h"
+#include "Trace.h"
+
+// files are split into roughly this many bytes per parsing job
+const size_t OBJ_CHUNK_SIZE = 4 << 20;
+
+
+inline bool is_space(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skip_space(const char* p, const char* end){
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+inline const char* skip_line(const char* p, const char* end){
+    while (p < end && *p != '\n') p++;
+    return p < end ? p + 1 : p;
+}
+
+const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// decimal float with optional sign, fraction and exponent, p is left after the number
+inline float parse_float(const char*& p, const char* end){
+    p = skip_space(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    // digits past what fits in the mantissa only move the exponent
+    while (p < end && *p >= '0' && *p <= '9'){
+        if (digits < 19){
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) digits++;
+        }
+        else{
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.'){
+        p++;
+        while (p < end && *p >= '0' && *p <= '9'){
+            if (digits < 19){
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')){
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')){
+            negative_exponent = *p == '-';
+            p++;
+        }
+        int e = 0;
+        while (p < end && *p >= '0' && *p <= '9'){
+            e = std::min(e * 10 + (*p - '0'), 1000);
+            p++;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    double value = mantissa;
+    while (exponent > 22){
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22){
+        value /= 1e22;
+        exponent += 22;
+    }
+    value = exponent >= 0 ? value * POWERS_OF_TEN[exponent] : value / POWERS_OF_TEN[-exponent];
+    return negative ? -value : value;
+}
+
+// signed integer, returns false if there were no digits
+inline bool parse_int(const char*& p, const char* end, int& value){
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+    const char* start = p;
+    int v = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    value = negative ? -v : v;
+    return p != start;
+}
+
+// the first whitespace separated word on the rest of the line
+inline std::string parse_name(const char* p, const char* end){
+    p = skip_space(p, end);
+    const char* start = p;
+    while (p < end && !is_space(*p) && *p != '\n') p++;
+    return std::string(start, p);
+}
+
+inline bool starts_with(const char* p, const char* end, const char* word){
+    for (; *word; word++, p++){
+        if (p >= end || *p != *word) return false;
+    }
+    return p >= end || is_space(*p) || *p == '\n';
+}
+
+
+enum class ObjEventType{OBJECT, USEMTL, MTLLIB};
+
+// a line that isn't geometry, kept in order with the faces
+struct ObjEvent{
+    ObjEventType type;
+    std::string name;
+    // number of triangles read before the line
+    size_t face;
+};
+
+// a face index that was negative, so relative to the elements read before it
+// which is only known once the chunks before it are counted
+struct ObjFixup{
+    size_t face;
+    int slot;
+    // 0 vertices, 1 texcoords, 2 normals
+    int kind;
+};
+
+
+// everything read from one chunk of the file
+struct ObjChunk{
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> texcoords;
+    std::vector<Vector3> normals;
+    std::vector<Face> faces;
+    std::vector<ObjFixup> fixups;
+    std::vector<ObjEvent> events;
+};
+
+
+// parse the lines between begin and end, which start and end on line boundaries
+inline void parse_obj_chunk(const char* begin, const char* end, ObjChunk& chunk){
+    // corners of the current face, n-gons are split into a fan
+    std::vector<int> corners;
+    std::vector<int> corner_kinds;
+    const char* p = begin;
+    while (p < end){
+        p = skip_space(p, end);
+        if (p >= end){
+            break;
+        }
+        char c = *p;
+        if (c == 'v' && p + 1 < end){
+            char t = p[1];
+            if (is_space(t)){
+                p += 2;
+                Vector3 v;
+                v.x = parse_float(p, end);
+                v.y = parse_float(p, end);
+                v.z = parse_float(p, end);
+                chunk.vertices.push_back(v);
+            }
+            else if (t == 'n' && p + 2 < end && is_space(p[2])){
+                p += 3;
+                Vector3 vn;
+                vn.x = parse_float(p, end);
+                vn.y = parse_float(p, end);
+                vn.z = parse_float(p, end);
+                chunk.normals.push_back(vn);
+            }
+            else if (t == 't' && p + 2 < end && is_space(p[2])){
+                p += 3;
+                Vector3 vt;
+                vt.x = parse_float(p, end);
+                vt.y = parse_float(p, end);
+                chunk.texcoords.push_back(vt);
+            }
+        }
+        else if (c == 'f' && p + 1 < end && is_space(p[1])){
+            p += 2;
+            corners.clear();
+            corner_kinds.clear();
+            int counts[3] = {(int) chunk.vertices.size(), (int) chunk.texcoords.size(), (int) chunk.normals.size()};
+            while (true){
+                p = skip_space(p, end);
+                if (p >= end || *p == '\n' || *p == '#'){
+                    break;
+                }
+                // v, v/vt, v//vn or v/vt/vn
+                int index[3] = {0, 0, 0};
+                bool given[3] = {false, false, false};
+                given[0] = parse_int(p, end, index[0]);
+                if (!given[0]){
+                    break;
+                }
+                for (int k = 1; k < 3 && p < end && *p == '/'; k++){
+                    p++;
+                    given[k] = parse_int(p, end, index[k]);
+                }
+                // a missing texcoord or normal uses the vertex index, as load_obj pads those arrays to match
+                int kinds[3] = {0, 1, 2};
+                for (int k = 0; k < 3; k++){
+                    if (index[k] < 0){
+                        // relative to the elements read so far in this chunk, fixed up once the chunk is placed
+                        index[k] = counts[k] + index[k] + 1;
+                    }
+                    else{
+                        kinds[k] = -1;
+                    }
+                }
+                for (int k = 1; k < 3; k++){
+                    if (!given[k]){
+                        index[k] = index[0];
+                        kinds[k] = kinds[0];
+                    }
+                }
+                for (int k = 0; k < 3; k++){
+                    corners.push_back(index[k]);
+                    corner_kinds.push_back(kinds[k]);
+                }
+            }
+            int corner_count = corners.size() / 3;
+            for (int i = 1; i + 1 < corner_count; i++){
+                int fan[3] = {0, i, i + 1};
+                Face face;
+                for (int k = 0; k < 3; k++){
+                    for (int j = 0; j < 3; j++){
+                        int slot = fan[k] * 3 + j;
+                        if (corner_kinds[slot] >= 0){
+                            chunk.fixups.push_back({chunk.faces.size(), k * 3 + j, corner_kinds[slot]});
+                        }
+                        face[k * 3 + j] = corners[slot];
+                    }
+                }
+                chunk.faces.push_back(face);
+            }
+        }
+        else if (c == 'o' && p + 1 < end && is_space(p[1])){
+            chunk.events.push_back({ObjEventType::OBJECT, parse_name(p + 1, end), chunk.faces.size()});
+        }
+        else if (c == 'u' && starts_with(p, end, "usemtl")){
+            chunk.events.push_back({ObjEventType::USEMTL, parse_name(p + 6, end), chunk.faces.size()});
+        }
+        else if (c == 'm' && starts_with(p, end, "mtllib")){
+            chunk.events.push_back({ObjEventType::MTLLIB, parse_name(p + 6, end), chunk.faces.size()});
+        }
+        p = skip_line(p, end);
+    }
+}
+
+
+// the whole file merged back together in file order
+struct ObjData{
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> texcoords;
+    std::vector<Vector3> normals;
+    std::vector<Face> faces;
+    std::vector<ObjEvent> events;
+};
+
+
+// memory map an OBJ and parse it on several threads
+// returns false if the file can't be opened
+inline bool parse_obj(const std::string& filename, ObjData& obj){
+    TRACE_SCOPE("parse_obj", filename);
+    auto start = std::chrono::high_resolution_clock::now();
+    MappedFile file;
+    if (!file.open(filename)){
+        std::cerr << "Could not open file " << filename << std::endl;
+        return false;
+    }
+    const char* data = file.data;
+    const char* end = file.data + file.size;
+
+    // chunk boundaries are moved forward to the start of the next line
+    std::vector<const char*> bounds = {data};
+    while (bounds.back() < end){
+        const char* next = bounds.back() + std::min<size_t>(OBJ_CHUNK_SIZE, end - bounds.back());
+        bounds.push_back(skip_line(next == end ? next : next - 1, end));
+    }
+    int chunk_count = bounds.size() - 1;
+    std::vector<ObjChunk> chunks(chunk_count);
+
+    std::atomic<int> next_chunk{0};
+    auto worker = [&](){
+        trace_thread_name("OBJ parser");
+        for (int i = next_chunk++; i < chunk_count; i = next_chunk++){
+            TRACE_SCOPE("parse_obj_chunk");
+            parse_obj_chunk(bounds[i], bounds[i + 1], chunks[i]);
+        }
+    };
+    int thread_count = std::max(1, std::min<int>(std::thread::hardware_concurrency(), chunk_count));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++){
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread: threads){
+        thread.join();
+    }
+
+    // append the chunks in order, shifting relative indices by what came before
+    size_t totals[4] = {0, 0, 0, 0};
+    for (ObjChunk& chunk: chunks){
+        totals[0] += chunk.vertices.size();
+        totals[1] += chunk.texcoords.size();
+        totals[2] += chunk.normals.size();
+        totals[3] += chunk.faces.size();
+    }
+    obj.vertices.reserve(totals[0]);
+    obj.texcoords.reserve(totals[1]);
+    obj.normals.reserve(totals[2]);
+    obj.faces.reserve(totals[3]);
+    for (ObjChunk& chunk: chunks){
+        int offsets[3] = {(int) obj.vertices.size(), (int) obj.texcoords.size(), (int) obj.normals.size()};
+        size_t face_offset = obj.faces.size();
+        for (const ObjFixup& fixup: chunk.fixups){
+            chunk.faces[fixup.face][fixup.slot] += offsets[fixup.kind];
+        }
+        for (ObjEvent& event: chunk.events){
+            event.face += face_offset;
+            obj.events.push_back(std::move(event));
+        }
+        obj.vertices.insert(obj.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        obj.texcoords.insert(obj.texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        obj.normals.insert(obj.normals.end(), chunk.normals.begin(), chunk.normals.end());
+        obj.faces.insert(obj.faces.end(), chunk.faces.begin(), chunk.faces.end());
+        chunk = ObjChunk();
+    }
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::cout << "Parsed " << filename << ": " << (file.size >> 20) << "MB in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count() << "ms on "
+              << thread_count << " threads" << std::endl;
+    return true;
+}
@@ -4,7 +4,9 @@
 #include "Ray.h"
 #include "Material.h"
 #include "Texture.h"
+#include "Camera.h"
 #include <memory>
+#include <vector>
 
 #define uint unsigned int
 
@@ -15,4 +17,13 @@ struct Observable{
     virtual inline Vector3 centroid()=0;
     virtual Vector3 max_vertex()=0;
     virtual Vector3 min_vertex()=0;
+    // choose a level of detail for the camera, only meshes with LODs do anything
+    virtual void select_lod(const Camera&){}
+    // closest hits for a batch of rays, objects that page their geometry in override this
+    // to sort the batch by what each ray touches
+    virtual void intersect_batch(const std::vector<Ray>& rays, std::vector<RayHit>& hits){
+        for (size_t i = 0; i < rays.size(); i++){
+            intersect(rays[i], hits[i]);
+        }
+    }
 };
\ No newline at end of file
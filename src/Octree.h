@@ -1,6 +1,7 @@
 #pragma once
 
 #include "AABB.h"
+#include "Face.h"
 #include <iostream>
 #include <vector>
 #include <stack>
@@ -14,7 +15,7 @@ struct SpaceTreeNode{
     int index = -1;
     bool is_leaf = false;
     bool is_dead = false;
-    std::vector<std::vector<int>> faces;
+    std::vector<Face> faces;
     std::vector<int> children;
 
     SpaceTreeNode(){
@@ -43,7 +44,7 @@ struct Octree{
     Octree(){
     }
 
-    Octree(Vector3 boundingBox_[2], std::vector<std::vector<int>>& faces_, std::vector<Vector3>& vertices_, uint8_t depth_){
+    Octree(Vector3 boundingBox_[2], std::vector<Face>& faces_, std::vector<Vector3>& vertices_, uint8_t depth_){
         // add the meshes bounding box to the roots 
         root = SpaceTreeNode(boundingBox_[0], boundingBox_[1], -1);
         root.is_dead = false;
@@ -115,9 +116,9 @@ struct Octree{
         }
     }
 
-    void insert(std::vector<std::vector<int>>& faces_){
+    void insert(std::vector<Face>& faces_){
         std::vector<int> face_count(nodes.size(), 0);
-        for (std::vector<int> face: faces_){
+        for (Face& face: faces_){
             std::stack<SpaceTreeNode> stack;
             for (int j = 0; j < 8; j++){
                 stack.push(nodes[j]);
@@ -209,12 +210,12 @@ struct Octree{
     }
     
 
-    std::vector<std::vector<int>> intersection(Ray ray){       
+    std::vector<Face> intersection(Ray ray){       
         if (!AABBIntersection(root.box[0], root.box[1], ray)){
             return {};
         }
         // find the faces we need to test
-        std::vector<std::vector<int>> tests = {};
+        std::vector<Face> tests = {};
         
         std::stack<int> stack;
         for (int j = 0; j < starting_max_index; j++){
@@ -242,7 +243,7 @@ struct Octree{
         }
 
         // return array with no duplicate faces
-        std::set<std::vector<int>> s;
+        std::set<Face> s;
         unsigned size = tests.size();
         for(unsigned i = 0; i < size; i++){
             s.insert(tests[i]);
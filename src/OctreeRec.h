@@ -2,6 +2,7 @@
 
 #include "AABB.h"
 #include "Triangle.h"
+#include "Face.h"
 #include <iostream>
 #include <vector>
 #include <set>
@@ -123,7 +124,7 @@ struct Octree: public Observable{
     Octree(){
     }
 
-    Octree(Vector3 boundingBox_[2], std::vector<std::vector<int> >& faces_, std::vector<Vector3>& vertices_, uint8_t depth_){
+    Octree(Vector3 boundingBox_[2], std::vector<Face>& faces_, std::vector<Vector3>& vertices_, uint8_t depth_){
         // add the meshes bounding box to the roots 
         root = OctreeNode(boundingBox_[0], boundingBox_[1]);
         depth = depth_;
@@ -131,7 +132,7 @@ struct Octree: public Observable{
         root.build(depth);
         for (int i = 0; i < faces_.size(); i++){
             // inserting each face into the tree
-            std::vector<int> face = faces_[i];
+            Face& face = faces_[i];
             for (OctreeNode& child: root.children){
                 Triangle tri = Triangle(vertices[face[0] - 1], vertices[face[3] - 1], vertices[face[6] - 1], i);
                 child.insert(tri, depth);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+
+// portable float map, three little endian floats per pixel
+// rows are stored bottom to top, so rows are placed with a seek as they arrive
+struct PFMWriter{
+    std::ofstream& filestream;
+    int width;
+    int height;
+    std::streamoff header_size;
+
+    PFMWriter(std::ofstream& file, int w, int h) : filestream(file), width(w), height(h){
+        // a negative scale marks the data as little endian
+        std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+        filestream.write(header.data(), header.size());
+        header_size = header.size();
+    }
+
+    // write rows scanlines of linear RGB starting at image row z
+    void write_rows(int z, const float* rgb, int rows){
+        std::streamoff row_bytes = (std::streamoff) width * 3 * sizeof(float);
+        for (int r = 0; r < rows; r++){
+            filestream.seekp(header_size + (height - 1 - (z + r)) * row_bytes);
+            filestream.write((const char*) (rgb + (size_t) r * width * 3), row_bytes);
+        }
+    }
+};
+
+
+// reads scanlines of a colour PFM top to bottom, a band at a time so the whole file needn't fit in memory
+struct PFMReader{
+    std::ifstream file;
+    int width = 0;
+    int height = 0;
+    bool big_endian = false;
+    std::streamoff header_size = 0;
+
+    PFMReader(const std::string& filename){
+        file.open(filename, std::ios::in|std::ios::binary);
+        if (!file.is_open()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            throw std::runtime_error("Could not open file");
+        }
+        std::string magic;
+        float scale;
+        file >> magic >> width >> height >> scale;
+        // exactly one whitespace character separates the header from the data
+        file.get();
+        if (!file || magic != "PF" || width <= 0 || height <= 0){
+            std::cerr << "Invalid PFM file " << filename << std::endl;
+            throw std::runtime_error("Invalid PFM file");
+        }
+        big_endian = scale > 0;
+        header_size = file.tellg();
+    }
+
+    // read rows scanlines starting at image row z into rgb
+    void read_rows(int z, float* rgb, int rows){
+        std::streamoff row_bytes = (std::streamoff) width * 3 * sizeof(float);
+        for (int r = 0; r < rows; r++){
+            file.seekg(header_size + (height - 1 - (z + r)) * row_bytes);
+            file.read((char*) (rgb + (size_t) r * width * 3), row_bytes);
+        }
+        if (big_endian){
+            uint32_t* words = (uint32_t*) rgb;
+            for (size_t i = 0; i < (size_t) rows * width * 3; i++){
+                words[i] = __builtin_bswap32(words[i]);
+            }
+        }
+    }
+};
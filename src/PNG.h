@@ -0,0 +1,243 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
+#include "ImageWriter.h"
+#include "Deflate.h"
+
+// scanlines filtered and compressed together as one deflate block
+const int PNG_JOB_ROWS = 64;
+
+const uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+
+inline uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size){
+    static const std::vector<uint32_t> table = [](){
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; n++){
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++){
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++){
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+// adler32 of two pieces of data joined, from the checksums of each piece
+inline uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2){
+    const uint32_t base = 65521;
+    uint32_t rem = size2 % base;
+    uint32_t sum1 = adler1 & 0xffff;
+    uint32_t sum2 = (rem * sum1) % base;
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= 2 * base) sum2 -= 2 * base;
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+
+inline uint8_t paeth(int a, int b, int c){
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+
+// filter one RGB scanline with the filter giving the smallest sum of absolute differences
+// out gets the filter type byte followed by the filtered row
+inline void filter_row(const uint8_t* row, const uint8_t* above, size_t row_bytes, uint8_t* out, std::vector<uint8_t>& scratch){
+    const size_t bpp = 3;
+    scratch.resize(5 * row_bytes);
+    uint8_t* f[5];
+    for (int type = 0; type < 5; type++){
+        f[type] = &scratch[type * row_bytes];
+    }
+    // one loop per filter type so each one vectorizes, the first pixel has no left neighbour
+    for (size_t i = 0; i < row_bytes; i++){
+        f[0][i] = row[i];
+        f[2][i] = row[i] - above[i];
+    }
+    for (size_t i = 0; i < bpp; i++){
+        f[1][i] = row[i];
+        f[3][i] = row[i] - above[i] / 2;
+        f[4][i] = row[i] - above[i];
+    }
+    for (size_t i = bpp; i < row_bytes; i++){
+        f[1][i] = row[i] - row[i - bpp];
+        f[3][i] = row[i] - (row[i - bpp] + above[i]) / 2;
+    }
+    for (size_t i = bpp; i < row_bytes; i++){
+        f[4][i] = row[i] - paeth(row[i - bpp], above[i], above[i - bpp]);
+    }
+
+    uint64_t best_cost = ~0ull;
+    int best = 0;
+    for (int type = 0; type < 5; type++){
+        uint64_t cost = 0;
+        for (size_t i = 0; i < row_bytes; i++){
+            cost += abs((int8_t) f[type][i]);
+        }
+        if (cost < best_cost){
+            best_cost = cost;
+            best = type;
+        }
+    }
+    out[0] = best;
+    memcpy(out + 1, f[best], row_bytes);
+}
+
+
+// a group of rows compressed on its own thread
+struct PNGJob{
+    std::vector<uint8_t> compressed;
+    uint32_t adler;
+    size_t filtered_size;
+    long long compress_us;
+};
+
+
+// streams an RGB PNG, rows are filtered and deflated in groups on several threads
+// each group is an independent block so they are simply written out in order
+struct PNGWriter : public ImageWriter{
+    std::ofstream& filestream;
+    int width;
+    int height;
+    size_t row_bytes;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    // raw rows not yet handed to a job, and the raw row before them
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> previous_row;
+    std::deque<std::future<PNGJob>> jobs;
+    bool started = false;
+    uint32_t adler = 1;
+    size_t compressed_bytes = 0;
+    long long compress_us = 0;
+
+    PNGWriter(std::ofstream& file, int w, int h) : filestream(file), width(w), height(h){
+        row_bytes = (size_t) width * 3;
+        previous_row.assign(row_bytes, 0);
+        filestream.write((const char*) PNG_SIGNATURE, 8);
+        uint8_t header[13];
+        put32(header, width);
+        put32(header + 4, height);
+        // 8 bit RGB, deflate, adaptive filtering, not interlaced
+        header[8] = 8;
+        header[9] = 2;
+        header[10] = 0;
+        header[11] = 0;
+        header[12] = 0;
+        write_chunk("IHDR", header, 13);
+    }
+
+    static void put32(uint8_t* out, uint32_t value){
+        out[0] = value >> 24;
+        out[1] = value >> 16;
+        out[2] = value >> 8;
+        out[3] = value;
+    }
+
+    void write_chunk(const char* type, const uint8_t* data, size_t size){
+        uint8_t length[4];
+        put32(length, size);
+        filestream.write((const char*) length, 4);
+        filestream.write(type, 4);
+        filestream.write((const char*) data, size);
+        uint32_t crc = crc32(0, (const uint8_t*) type, 4);
+        crc = crc32(crc, data, size);
+        uint8_t crc_bytes[4];
+        put32(crc_bytes, crc);
+        filestream.write((const char*) crc_bytes, 4);
+    }
+
+    static PNGJob compress(std::vector<uint8_t> above, std::vector<uint8_t> rows, size_t row_bytes){
+        auto job_start = std::chrono::high_resolution_clock::now();
+        size_t count = rows.size() / row_bytes;
+        std::vector<uint8_t> filtered(count * (row_bytes + 1));
+        std::vector<uint8_t> scratch;
+        for (size_t r = 0; r < count; r++){
+            const uint8_t* row = &rows[r * row_bytes];
+            filter_row(row, r == 0 ? above.data() : row - row_bytes, row_bytes, &filtered[r * (row_bytes + 1)], scratch);
+        }
+        PNGJob job;
+        job.compressed = deflate_block(filtered.data(), filtered.size());
+        job.adler = adler32(1, filtered.data(), filtered.size());
+        job.filtered_size = filtered.size();
+        auto job_end = std::chrono::high_resolution_clock::now();
+        job.compress_us = std::chrono::duration_cast<std::chrono::microseconds>(job_end - job_start).count();
+        return job;
+    }
+
+    void submit(size_t rows){
+        std::vector<uint8_t> data(pending.begin(), pending.begin() + rows * row_bytes);
+        pending.erase(pending.begin(), pending.begin() + rows * row_bytes);
+        std::vector<uint8_t> above = previous_row;
+        previous_row.assign(data.end() - row_bytes, data.end());
+        jobs.push_back(std::async(std::launch::async, compress, std::move(above), std::move(data), row_bytes));
+        // keep at most one job per thread in flight
+        while ((int) jobs.size() > threads){
+            write_job();
+        }
+    }
+
+    void write_job(){
+        PNGJob job = jobs.front().get();
+        jobs.pop_front();
+        if (!started){
+            // zlib header, 32KB window and default compression
+            job.compressed.insert(job.compressed.begin(), {0x78, 0x9c});
+            started = true;
+        }
+        write_chunk("IDAT", job.compressed.data(), job.compressed.size());
+        adler = adler32_combine(adler, job.adler, job.filtered_size);
+        compressed_bytes += job.compressed.size();
+        compress_us += job.compress_us;
+    }
+
+    void write_rgb8(const uint8_t* rgb, size_t count) override{
+        pending.insert(pending.end(), rgb, rgb + count * 3);
+        size_t job_bytes = PNG_JOB_ROWS * row_bytes;
+        while (pending.size() >= job_bytes){
+            submit(PNG_JOB_ROWS);
+        }
+    }
+
+    void finish() override{
+        if (pending.size() >= row_bytes){
+            submit(pending.size() / row_bytes);
+        }
+        while (!jobs.empty()){
+            write_job();
+        }
+        std::vector<uint8_t> end(DEFLATE_FINAL_BLOCK, DEFLATE_FINAL_BLOCK + 5);
+        if (!started){
+            end.insert(end.begin(), {0x78, 0x9c});
+        }
+        end.resize(end.size() + 4);
+        put32(&end[end.size() - 4], adler);
+        write_chunk("IDAT", end.data(), end.size());
+        write_chunk("IEND", nullptr, 0);
+        filestream.flush();
+
+        std::cout << "PNG encode: " << (compressed_bytes >> 10) << "KB from " << ((size_t) height * (row_bytes + 1) >> 10) << "KB, "
+                  << compress_us / 1000 << "ms compressing on up to " << threads << " threads" << std::endl;
+    }
+};
@@ -3,7 +3,10 @@
 #include <iostream>
 #include <fstream>
 #include "Vector.h"
+#include "ImageWriter.h"
+#include "Trace.h"
 #include <vector>
+#include <algorithm>
 
 
 // byte headers for QOI file
@@ -15,196 +18,280 @@ const int QOI_OP_RGB   = 0xfe;
 const int QOI_OP_RGBA  = 0xff;
 
 
-inline int gen_key(Vector3 colour){
-    return ((int)(colour.x * 3 + colour.y * 5 + colour.z * 7) % 64);
+// index into the recently seen colours, alpha isn't hashed as files are always RGB
+inline int gen_key(int r, int g, int b){
+    return (r * 3 + g * 5 + b * 7) % 64;
 }
 
-struct QOIWriter{
+// pack 0-255 channels into a RGBA8 word, red in the lowest byte
+inline uint32_t pack_rgba8(int r, int g, int b, int a = 255){
+    return (uint32_t) r | ((uint32_t) g << 8) | ((uint32_t) b << 16) | ((uint32_t) a << 24);
+}
+
+// the 8 byte marker ending every QOI stream
+const uint8_t QOI_END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// encoded bytes are collected in memory and written out in blocks of this size
+const size_t QOI_FLUSH_SIZE = 1 << 20;
+
+
+struct QOIWriter : public ImageWriter{
     std::ofstream& filestream;
-    Vector3 previous_colour = Vector3(0);
-    Vector3 lookup[64] = {};
+    std::vector<uint8_t> buffer;
+    int previous_r = 0, previous_g = 0, previous_b = 0;
+    uint32_t lookup[64] = {};
     int run_length = 0;
 
     QOIWriter(std::ofstream& file, int width, int height) : filestream(file){
+        buffer.reserve(QOI_FLUSH_SIZE + 64);
         // init attributes and write magic numbers and headers to file
         write32(0x716f6966);
         write32(width);
         write32(height);
-        filestream << (unsigned char) 3;
-        filestream << (unsigned char) 1;
+        buffer.push_back(3);
+        buffer.push_back(1);
     }
 
     // write 32 bit number to the file
-    void write32(long value){
-        filestream << (unsigned char) ((value & 0xff000000) >> 24);
-        filestream << (unsigned char) ((value & 0x00ff0000) >> 16);
-        filestream << (unsigned char) ((value & 0x0000ff00) >> 8);
-        filestream << (unsigned char) ((value & 0x000000ff));
+    void write32(uint32_t value){
+        buffer.push_back((value & 0xff000000) >> 24);
+        buffer.push_back((value & 0x00ff0000) >> 16);
+        buffer.push_back((value & 0x0000ff00) >> 8);
+        buffer.push_back((value & 0x000000ff));
     }
 
+    void flush(){
+        filestream.write((const char*) buffer.data(), buffer.size());
+        buffer.clear();
+    }
 
-    void write_pixel(Vector3 pixel){
-        // clamp pixel values between 0-255
-        pixel = Vector3::apply(pixel, [](float a){return floorf(a);});
-        pixel = Vector3::apply(pixel, [](float a){return fmax(0, fmin(a, 255));});
-
+    inline void encode(int r, int g, int b){
         // run length encoding
-        if (pixel == previous_colour){
+        if (r == previous_r && g == previous_g && b == previous_b){
             run_length++;
             if (run_length == 62){
-                filestream << (unsigned char) (QOI_OP_RUN | (run_length - 1));
+                buffer.push_back(QOI_OP_RUN | (run_length - 1));
                 run_length = 0;
             }
+            return;
+        }
+        // write previous run to the file
+        if (run_length > 0){
+            buffer.push_back(QOI_OP_RUN | (run_length - 1));
+            run_length = 0;
+        }
+
+        // look to see if weve recently had the pixel colour
+        int key = gen_key(r, g, b);
+        uint32_t packed = pack_rgba8(r, g, b, 0);
+        if (lookup[key] == packed){
+            buffer.push_back(QOI_OP_INDEX | key);
         }
         else{
-            // write previous run to the file
-            if (run_length > 0){
-                filestream << (unsigned char) (QOI_OP_RUN | (run_length - 1));
-                run_length = 0;
-            }
+            // put the pixel into the buffer
+            lookup[key] = packed;
+            // calculate the difference in colours
+            int dr = r - previous_r;
+            int dg = g - previous_g;
+            int db = b - previous_b;
+            int dr_dg = dr - dg;
+            int db_dg = db - dg;
 
-            // look to see if weve recently had the pixel colour
-            int key = gen_key(pixel);
-            if (pixel == lookup[key]){
-                filestream << (unsigned char) (QOI_OP_INDEX | key);
+            if (-2 <= dr && dr <= 1 && -2 <= dg && dg <= 1 && -2 <= db && db <= 1){
+                buffer.push_back(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            }
+            // larger differeence of -32 to 31 in green channel and -8 to 7 in red and blue channels
+            else if (-32 <= dg && dg <= 31 && -8 <= dr_dg && dr_dg <= 7 && -8 <= db_dg && db_dg <= 7){
+                buffer.push_back(QOI_OP_LUMA | (dg + 32));
+                buffer.push_back(((dr_dg + 8) << 4) | (db_dg + 8));
             }
             else{
-                // put the pixel into the buffer
-                lookup[key] = pixel;
-                // calculate the difference in colours
-                Vector3 diff = pixel - previous_colour;
-                int dr_dg = diff.x - diff.y;
-                int db_dg = diff.z - diff.y;
-
-                if ((-2 <= diff.x && diff.x <= 1) && (-2 <= diff.y && diff.y <= 1) && (-2 <= diff.z && diff.z <= 1)){
-                    filestream << (unsigned char) (QOI_OP_DIFF | (((int)diff.x + 2)) << 4 | (((int)diff.y + 2) << 2) | ((int)diff.z + 2));
-                }
-                // larger differeence of -32 to 31 in green channel and -8 to 7 in red and blue channels
-                else if (-32 <= diff.y && diff.y <= 31 && -8 <= dr_dg && dr_dg <= 7 && -8 <= db_dg && db_dg <= 7){
-                    filestream << (unsigned char) (QOI_OP_LUMA | ((int)diff.y + 32));
-                    filestream << (unsigned char) (((dr_dg + 8) << 4) | (db_dg + 8));
-                }
-                else{
-                    // no encoding possible so write RGB header and RGB values
-                    filestream << (unsigned char) QOI_OP_RGB;
-                    filestream << (unsigned char) (int)pixel.x;
-                    filestream << (unsigned char) (int)pixel.y;
-                    filestream << (unsigned char) (int)pixel.z;
-                }
+                // no encoding possible so write RGB header and RGB values
+                buffer.push_back(QOI_OP_RGB);
+                buffer.push_back(r);
+                buffer.push_back(g);
+                buffer.push_back(b);
             }
         }
-        previous_colour = pixel;
+        previous_r = r;
+        previous_g = g;
+        previous_b = b;
+    }
+
+    // encode count pixels of packed 8 bit RGB
+    void write_rgb8(const uint8_t* rgb, size_t count) override{
+        TRACE_SCOPE("QOIWriter::write_rgb8");
+        for (size_t i = 0; i < count; i++){
+            encode(rgb[0], rgb[1], rgb[2]);
+            rgb += 3;
+            if (buffer.size() >= QOI_FLUSH_SIZE){
+                flush();
+            }
+        }
+    }
+
+    void write_pixel(Vector3 pixel){
+        // clamp pixel values between 0-255
+        uint8_t rgb[3];
+        for (int i = 0; i < 3; i++){
+            rgb[i] = fmax(0, fmin(floorf(pixel[i]), 255));
+        }
+        QOIWriter::write_rgb8(rgb, 1);
     }
 
-    void finish_run(){
-        // write any remaining run length
+    // write any remaining run length and the end marker
+    void finish() override{
+        TRACE_SCOPE("QOIWriter::finish");
         if (run_length > 0){
-            filestream << (unsigned char) (QOI_OP_RUN | (run_length - 1));
+            buffer.push_back(QOI_OP_RUN | (run_length - 1));
+            run_length = 0;
         }
+        buffer.insert(buffer.end(), QOI_END_MARKER, QOI_END_MARKER + 8);
+        flush();
     }
 };
 
 
+// the 14 byte header at the start of every QOI file
+struct QOIHeader{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t channels = 0;
+    uint8_t colour_space = 0;
+
+    // parse the header from the first 14 bytes of data
+    bool parse(const uint8_t* data, size_t size){
+        if (size < 14 || data[0] != 'q' || data[1] != 'o' || data[2] != 'i' || data[3] != 'f'){
+            std::cerr << "Invalid QOI file" << std::endl;
+            return false;
+        }
+        width = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+        height = (data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+        channels = data[12];
+        colour_space = data[13];
+        return true;
+    }
+
+    // read only the header, leaving the rest of the file alone
+    bool read(std::istream& stream){
+        uint8_t data[14];
+        stream.read((char*) data, 14);
+        return parse(data, stream.gcount());
+    }
+};
+
+
+// decodes a whole QOI file held in memory
+// the file is read with one bulk read and decoded straight into a buffer sized from the header
 struct QOIReader{
-    std::ifstream& filestream;
-    Vector3 previous_colour = Vector3(0);
-    Vector3 lookup[64] = {};
+    std::vector<uint8_t> data;
     uint32_t width;
     uint32_t height;
     uint8_t channels;
     uint8_t colour_space;
+    bool valid;
+    // size of the file, data carries some padding past it
+    size_t end_offset;
+
+    QOIReader(std::ifstream& file){
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        size_t file_size = size > 0 ? size : 0;
+        // zero padding lets the decoder read a whole opcode without bounds checks on a truncated file
+        data.resize(file_size + 8, 0);
+        file.read((char*) data.data(), file_size);
+        end_offset = file_size;
 
-    uint32_t read32(){
-        uint32_t value = 0;
-        value |= filestream.get() << 24;
-        value |= filestream.get() << 16;
-        value |= filestream.get() << 8;
-        value |= filestream.get();
-        return value;
+        QOIHeader header;
+        valid = header.parse(data.data(), file_size);
+        width = header.width;
+        height = header.height;
+        channels = header.channels;
+        colour_space = header.colour_space;
     }
 
-    QOIReader(std::ifstream& file) : filestream(file){
-        std::string header;
-        for (int i = 0; i < 4; i++){
-            header += filestream.get();
-        }
-        if (header != "qoif"){
-            std::cerr << "Invalid QOI file" << std::endl;
+    void read_all(std::vector<Vector3>& pixels){
+        std::vector<uint32_t> packed;
+        read_all(packed);
+        pixels.resize(packed.size());
+        for (size_t i = 0; i < packed.size(); i++){
+            uint32_t c = packed[i];
+            pixels[i] = Vector3(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff) / 255.0;
         }
-        // read in the magic numbers and headers
-        width = read32();
-        height = read32();
-        channels = filestream.get();
-        colour_space = filestream.get();
     }
 
-    void read_all(std::vector<Vector3>& pixels){
-        // go through all the file
-        while (!filestream.eof()){
-            // get the current byte
-            uint8_t byte = filestream.get();
-            // no encoding
+    // decode to packed RGBA8, red in the lowest byte
+    void read_all(std::vector<uint32_t>& pixels){
+        size_t count = valid ? (size_t) width * height : 0;
+        pixels.assign(count, pack_rgba8(0, 0, 0));
+        if (count == 0){
+            return;
+        }
+
+        uint32_t* out = pixels.data();
+        uint32_t* out_end = out + count;
+        const uint8_t* p = data.data() + 14;
+        const uint8_t* end = data.data() + end_offset;
+
+        uint8_t r = 0, g = 0, b = 0, a = 255;
+        uint32_t lookup[64] = {};
+        while (out < out_end && p < end){
+            uint8_t byte = *p++;
             if (byte == QOI_OP_RGB){
-                Vector3 pixel;
-                pixel.x = filestream.get();
-                pixel.y = filestream.get();
-                pixel.z = filestream.get();
-                pixels.push_back(pixel / 255.0);
-                // add current pixel to lookup
-                // and set previous colour to it
-                previous_colour = pixel;
-                int key = gen_key(pixel);
-                lookup[key] = pixel;
+                r = p[0];
+                g = p[1];
+                b = p[2];
+                p += 3;
             }
-            // run of same pixels
-            else if ((byte & 0xc0) == QOI_OP_RUN){
-                int run_length = (byte & 0x3f) + 1;
-                // add that many pixels to the vector
-                for (int i = 0; i < run_length; i++){
-                    pixels.push_back(previous_colour / 255.0);
-                }
+            else if (byte == QOI_OP_RGBA){
+                r = p[0];
+                g = p[1];
+                b = p[2];
+                a = p[3];
+                p += 4;
             }
-            // seen pixel in the buffer
             else if ((byte & 0xc0) == QOI_OP_INDEX){
-                int key = byte & 0x3f;
-                Vector3 pixel = lookup[key];
-                pixels.push_back(pixel / 255.0);
-                previous_colour = pixel;
+                uint32_t c = lookup[byte];
+                *out++ = c;
+                r = c & 0xff;
+                g = (c >> 8) & 0xff;
+                b = (c >> 16) & 0xff;
+                a = c >> 24;
+                continue;
             }
-            // small difference in r, g, b values
             else if ((byte & 0xc0) == QOI_OP_DIFF){
-                int dr = ((byte & 0x30) >> 4) - 2;
-                int dg = ((byte & 0x0c) >> 2) - 2;
-                int db = (byte & 0x03) - 2;
-                // should stay under 255 but mod just incase
-                previous_colour.x = int(previous_colour.x + dr) % 256;
-                previous_colour.y = int(previous_colour.y + dg) % 256;
-                previous_colour.z = int(previous_colour.z + db) % 256;
-                pixels.push_back(previous_colour / 255.0);
-                int key = gen_key(previous_colour);
-                lookup[key] = previous_colour;
+                r += ((byte >> 4) & 0x03) - 2;
+                g += ((byte >> 2) & 0x03) - 2;
+                b += (byte & 0x03) - 2;
             }
-            // larger difference in Green channel
             else if ((byte & 0xc0) == QOI_OP_LUMA){
-                // get green difference
                 int dg = (byte & 0x3f) - 32;
-                // get next bit for R, B channel diffs
-                byte = filestream.get();
-                int dr_dg = ((byte & 0xf0) >> 4) - 8;
-                int db_dg = (byte & 0x0f) - 8;
-                int dr = dr_dg + dg;
-                int db = db_dg + dg;
-                previous_colour.x = int(previous_colour.x + dr) % 256;
-                previous_colour.y = int(previous_colour.y + dg) % 256;
-                previous_colour.z = int(previous_colour.z + db) % 256;
-                pixels.push_back(previous_colour / 255.0);
-                int key = gen_key(previous_colour);
-                lookup[key] = previous_colour;
+                uint8_t next = *p++;
+                r += dg - 8 + ((next >> 4) & 0x0f);
+                g += dg;
+                b += dg - 8 + (next & 0x0f);
             }
-            // unkown encoding / error in program
             else{
-                std::cerr << std::hex << (int)byte << std::endl;
+                // run of the previous pixel, the lookup doesn't change
+                int run = (byte & 0x3f) + 1;
+                uint32_t c = pack_rgba8(r, g, b, a);
+                if (run > out_end - out){
+                    run = out_end - out;
+                }
+                std::fill(out, out + run, c);
+                out += run;
+                continue;
             }
+            uint32_t c = pack_rgba8(r, g, b, a);
+            lookup[gen_key(r, g, b)] = c;
+            *out++ = c;
+        }
+
+        // decoding stops at the last pixel, so the end marker is never read as opcodes
+        // files from before the writer added the marker simply end here
+        if (out < out_end){
+            std::cerr << "QOI stream ended after " << (out - pixels.data()) << " of " << count << " pixels" << std::endl;
         }
     }
-};
\ No newline at end of file
+};
@@ -6,6 +6,11 @@ struct Ray{
     Vector3 origin;
     Vector3 direction;
     Vector3 inv_direction;
+    // rays through the neighbouring pixels in x and z
+    // used to find the footprint of the pixel on a surface
+    bool has_differentials = false;
+    Vector3 rx_origin, rx_direction;
+    Vector3 rz_origin, rz_direction;
 
     Ray(Vector3 O, Vector3 D){
         origin = O;
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "Ray.h"
+
+const uint32_t RAY_DUMP_MAGIC = 0x53594152;
+const uint32_t RAY_DUMP_VERSION = 1;
+
+
+// origin and direction of a recorded ray, all a kernel benchmark needs to rebuild it
+struct RayRecord{
+    float origin[3];
+    float direction[3];
+};
+
+// collects rays traced by a render into a file, so kernels can be benchmarked on real ray distributions
+// the file is the magic, the version, then RayRecords until the end
+struct RayDumpWriter{
+    std::ofstream file;
+    std::mutex lock;
+    // only every stride-th ray is kept so long renders give files of a sensible size
+    unsigned int stride;
+    unsigned long long seen = 0;
+    unsigned long long written = 0;
+
+    RayDumpWriter(const std::string& filename, unsigned int stride_) : stride(std::max(1u, stride_)){
+        file.open(filename, std::ios::out|std::ios::binary);
+        if (!file.is_open()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            return;
+        }
+        file.write((const char*) &RAY_DUMP_MAGIC, sizeof(uint32_t));
+        file.write((const char*) &RAY_DUMP_VERSION, sizeof(uint32_t));
+    }
+
+    void record(const std::vector<Ray>& rays){
+        thread_local std::vector<RayRecord> records;
+        std::lock_guard<std::mutex> guard(lock);
+        records.clear();
+        for (const Ray& ray: rays){
+            if (seen++ % stride == 0){
+                records.push_back({{ray.origin.x, ray.origin.y, ray.origin.z}, {ray.direction.x, ray.direction.y, ray.direction.z}});
+            }
+        }
+        file.write((const char*) records.data(), records.size() * sizeof(RayRecord));
+        written += records.size();
+    }
+};
+
+// appends the rays of a dump file to rays, false if it can't be read
+bool read_ray_dump(const std::string& filename, std::vector<Ray>& rays){
+    std::ifstream file(filename, std::ios::in|std::ios::binary);
+    uint32_t magic = 0, version = 0;
+    file.read((char*) &magic, sizeof(uint32_t));
+    file.read((char*) &version, sizeof(uint32_t));
+    if (!file || magic != RAY_DUMP_MAGIC || version != RAY_DUMP_VERSION){
+        std::cerr << filename << " is not a ray dump of this version" << std::endl;
+        return false;
+    }
+    RayRecord record;
+    while (file.read((char*) &record, sizeof(RayRecord))){
+        rays.push_back(Ray(Vector3(record.origin[0], record.origin[1], record.origin[2]),
+                           Vector3(record.direction[0], record.direction[1], record.direction[2])));
+    }
+    return true;
+}
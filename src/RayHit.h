@@ -3,16 +3,20 @@
 #include "Vector.h"
 #include "Material.h"
 
-
 struct RayHit{
     float distance;
     Vector3 point;
     Vector3 normal;
     int index = -1;
-    std::shared_ptr<Material> mat = nullptr;
+    // cost attribution id of the mesh the hit is on, the mesh itself may be evicted before the hit is shaded
+    int object = -1;
+    // the meshes material, or its copy in the material arena, valid for as long as the scene
+    const Material* mat = nullptr;
     // object u, v coordinates
     float u;
     float v;
+    // how u, v change across the pixel
+    TextureFootprint footprint;
     // hit objects u, v coordinates
     // (i.e. objects triangle u, v)
     float hu;
@@ -0,0 +1,625 @@
+#pragma once
+
+#include "Renderer.h"
+#include "SphericalLight.h"
+
+// renderers put together at compile time from policies, so each combination is its own
+// hot loop with nothing virtual between the tile and the shaded colour
+//   accelerator  what rays are traced against, the scene objects or one flat triangle BVH
+//   intersector  the ray triangle test the flat BVH uses
+//   integrator   how the light reaching a point is gathered
+//   shading      what a surface reflects of one light
+//   sampler      where the rays of a tile go and how they are filtered into pixels
+// textures are still sampled through the Texture interface, they belong to the materials not the variant
+// the variants compiled in are listed in RENDER_VARIANTS at the bottom, RENDER_VARIANT picks one by name
+
+
+// a light as the variants see it, every light in the scene has to be a SphericalLight
+struct KernelLight{
+    Vector3 position;
+    Vector3 colour;
+    float intensity;
+};
+
+// the same falloff as SphericalLight::ilumination_at
+inline Vector3 kernel_illumination(const KernelLight& light, float dist){
+    return light.colour * light.intensity / (M_PI * 4 * dist * dist);
+}
+
+// what the integrators and shading models need of a hit, with the texture already sampled
+struct ShadingPoint{
+    Vector3 P;
+    Vector3 N;
+    // towards the eye
+    Vector3 V;
+    Vector3 K_d;
+    Vector3 K_s;
+    int alpha;
+};
+
+// one light seen from a shading point
+struct LightSample{
+    // towards the light
+    Vector3 L;
+    float dist;
+    Vector3 I;
+    Vector3 colour;
+};
+
+
+// ---- accelerators ----
+
+// every object of the scene through Observable::intersect, so it renders anything the general path does
+struct SceneAccelerator{
+    Scene* world = nullptr;
+
+    bool build(Scene& world_){
+        world = &world_;
+        return true;
+    }
+
+    inline void closest(const std::vector<Ray>& rays, std::vector<RayHit>& hits){
+        world->closest_intersections(rays, hits);
+    }
+
+    inline bool occluded(const Ray& ray, float max_distance){
+        RayHit hit;
+        hit.distance = max_distance;
+        world->closest_intersection(hit, ray);
+        return hit.distance < max_distance;
+    }
+};
+
+
+// triangles with the edges from the first vertex precomputed for the intersectors
+struct FlatTriangle{
+    Vector3 v0;
+    Vector3 e1;
+    Vector3 e2;
+};
+
+// moller trumbore dividing by the determinant up front, the same test as Triangle with TRIANGLE_VARIANT 0
+struct MollerTrumbore{
+    static inline bool intersect(const FlatTriangle& tri, const Ray& ray, float max_t, float& t, float& u, float& v){
+        Vector3 pvec = Vector3::cross(ray.direction, tri.e2);
+        float det = Vector3::dot(tri.e1, pvec);
+        float invdet = 1.0 / det;
+        Vector3 tvec = ray.origin - tri.v0;
+        u = Vector3::dot(tvec, pvec) * invdet;
+        if (u < 0 || u > 1){
+            return false;
+        }
+        Vector3 qvec = Vector3::cross(tvec, tri.e1);
+        v = Vector3::dot(ray.direction, qvec) * invdet;
+        if (v < 0 || u + v > 1){
+            return false;
+        }
+        t = Vector3::dot(tri.e2, qvec) * invdet;
+        return t > EPSILON && t < max_t;
+    }
+};
+
+// the determinant scaled test of TRIANGLE_VARIANT 1, rays that miss never pay for the division
+struct DeferredDivide{
+    static inline bool intersect(const FlatTriangle& tri, const Ray& ray, float max_t, float& t, float& u, float& v){
+        Vector3 pvec = Vector3::cross(ray.direction, tri.e2);
+        float det = Vector3::dot(tri.e1, pvec);
+        if (det == 0){
+            return false;
+        }
+        float sign = (det > 0) ? 1.0f : -1.0f;
+        float adet = det * sign;
+        Vector3 tvec = ray.origin - tri.v0;
+        u = Vector3::dot(tvec, pvec) * sign;
+        if (u < 0 || u > adet){
+            return false;
+        }
+        Vector3 qvec = Vector3::cross(tvec, tri.e1);
+        v = Vector3::dot(ray.direction, qvec) * sign;
+        if (v < 0 || u + v > adet){
+            return false;
+        }
+        t = Vector3::dot(tri.e2, qvec) * sign;
+        if (t <= EPSILON * adet || t >= max_t * adet){
+            return false;
+        }
+        float invdet = 1.0f / adet;
+        t *= invdet;
+        u *= invdet;
+        v *= invdet;
+        return true;
+    }
+};
+
+struct FlatNode{
+    AABB aabb;
+    // leaves hold count triangles from first, inner nodes have count 0 and children first and first + 1
+    uint first;
+    uint count;
+};
+
+// the mesh a flattened triangle came from
+struct FlatSource{
+    TriangleMesh* mesh;
+    const std::vector<Face>* faces;
+};
+
+struct FlatPrimitive{
+    uint source;
+    int face;
+};
+
+// every triangle of the scene in world space under one BVH, the leaves hold the triangles themselves
+// meshes use the level of detail they had picked when it was built
+// scenes with objects it can't flatten, like out of core chunks or instances, have to use the scene accelerator
+// copying every instance out would multiply the triangles and the build time by the instance count
+template<typename Intersector>
+struct FlatBVH{
+    std::vector<FlatNode> nodes;
+    std::vector<FlatTriangle> triangles;
+    std::vector<FlatPrimitive> primitives;
+    std::vector<FlatSource> sources;
+    MemoryCharge node_memory = MemoryCharge(MEMORY_BVH_NODES);
+    MemoryCharge primitive_memory = MemoryCharge(MEMORY_PRIMITIVES);
+
+    bool add(Observable* obs){
+        if (BVH* bvh = dynamic_cast<BVH*>(obs)){
+            for (std::shared_ptr<Observable>& child: bvh->observables){
+                if (!add(child.get())){
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(obs)){
+            add_mesh(mesh);
+            return true;
+        }
+        return false;
+    }
+
+    void add_mesh(TriangleMesh* mesh){
+        const std::vector<Face>& faces = (mesh->lod == 0) ? mesh->faces : mesh->lods[mesh->lod - 1].faces;
+        uint source = sources.size();
+        sources.push_back({mesh, &faces});
+        for (int i = 0; i < (int) faces.size(); i++){
+            Vector3 v[3];
+            for (int c = 0; c < 3; c++){
+                v[c] = mesh->vertices[faces[i][c * 3] - 1];
+            }
+            triangles.push_back({v[0], v[1] - v[0], v[2] - v[0]});
+            primitives.push_back({source, i});
+        }
+    }
+
+    bool build(Scene& world){
+        TRACE_SCOPE("FlatBVH::build");
+        for (std::shared_ptr<Observable>& obs: world.objects){
+            if (!add(obs.get())){
+                return false;
+            }
+        }
+        if (triangles.empty()){
+            return false;
+        }
+        // bounds and centroids of the triangles, the order is what the nodes split
+        std::vector<AABB> boxes(triangles.size());
+        std::vector<Vector3> centroids(triangles.size());
+        std::vector<uint> order(triangles.size());
+        for (uint i = 0; i < triangles.size(); i++){
+            const FlatTriangle& tri = triangles[i];
+            Vector3 v1 = tri.v0 + tri.e1;
+            Vector3 v2 = tri.v0 + tri.e2;
+            boxes[i].min = Vector3::min(tri.v0, Vector3::min(v1, v2));
+            boxes[i].max = Vector3::max(tri.v0, Vector3::max(v1, v2));
+            centroids[i] = (tri.v0 + v1 + v2) / 3.0;
+            order[i] = i;
+        }
+        nodes.reserve(triangles.size() * 2 - 1);
+        nodes.push_back({AABB(), 0, (uint) triangles.size()});
+        divide(0, 0, boxes, centroids, order);
+
+        // leaves point straight at their triangles
+        std::vector<FlatTriangle> sorted_triangles(triangles.size());
+        std::vector<FlatPrimitive> sorted_primitives(primitives.size());
+        for (uint i = 0; i < order.size(); i++){
+            sorted_triangles[i] = triangles[order[i]];
+            sorted_primitives[i] = primitives[order[i]];
+        }
+        triangles = std::move(sorted_triangles);
+        primitives = std::move(sorted_primitives);
+        node_memory.set(nodes.capacity() * sizeof(FlatNode));
+        primitive_memory.set(triangles.capacity() * sizeof(FlatTriangle) + primitives.capacity() * sizeof(FlatPrimitive));
+        std::cout << "Flat BVH: " << triangles.size() << " triangles from " << sources.size() << " meshes, " << nodes.size() << " nodes" << std::endl;
+        return true;
+    }
+
+    // binned SAH split like BVH::sah_divide, leaves of up to two triangles unless no split helps
+    // or the node is as deep as the traversal stack allows
+    void divide(uint ind, uint depth, std::vector<AABB>& boxes, std::vector<Vector3>& centroids, std::vector<uint>& order){
+        uint first = nodes[ind].first;
+        uint count = nodes[ind].count;
+        AABB box;
+        for (uint i = first; i < first + count; i++){
+            box.fix(boxes[order[i]]);
+        }
+        nodes[ind].aabb = box;
+        if (count <= 2 || depth + 1 >= BVH_MAX_DEPTH){
+            return;
+        }
+
+        constexpr int nbuckets = 20;
+        BVHSplitBucket buckets[nbuckets];
+        AABB centre_box;
+        for (uint i = first; i < first + count; i++){
+            centre_box.min = Vector3::min(centre_box.min, centroids[order[i]]);
+            centre_box.max = Vector3::max(centre_box.max, centroids[order[i]]);
+        }
+        Vector3 extents = centre_box.extents();
+        uint axis = 0;
+        if (extents.y > extents.x) axis = 1;
+        if (extents.z > extents[axis]) axis = 2;
+        if (extents[axis] <= 0){
+            return;
+        }
+        auto bucket_of = [&](uint i){
+            int b = nbuckets * (centroids[i][axis] - centre_box.min[axis]) / extents[axis];
+            return std::min(b, nbuckets - 1);
+        };
+        for (uint i = first; i < first + count; i++){
+            BVHSplitBucket& bucket = buckets[bucket_of(order[i])];
+            bucket.count++;
+            bucket.box.fix(boxes[order[i]]);
+        }
+
+        float min_cost = FINF;
+        int min_cost_split = 0;
+        for (int i = 0; i < nbuckets - 1; i++){
+            AABB box0, box1;
+            uint count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; j++){
+                box0.fix(buckets[j].box);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nbuckets; j++){
+                box1.fix(buckets[j].box);
+                count1 += buckets[j].count;
+            }
+            if (count0 == 0 || count1 == 0){
+                continue;
+            }
+            float cost = 0.125f + (count0 * box0.area() + count1 * box1.area()) / box.area();
+            if (cost < min_cost){
+                min_cost = cost;
+                min_cost_split = i;
+            }
+        }
+        if (min_cost == FINF){
+            return;
+        }
+
+        uint* middle = std::partition(&order[first], &order[first] + count, [&](uint i){return bucket_of(i) <= min_cost_split;});
+        uint left_count = middle - &order[first];
+        uint left = nodes.size();
+        nodes.push_back({AABB(), first, left_count});
+        nodes.push_back({AABB(), first + left_count, count - left_count});
+        nodes[ind].first = left;
+        nodes[ind].count = 0;
+        divide(left, depth + 1, boxes, centroids, order);
+        divide(left + 1, depth + 1, boxes, centroids, order);
+    }
+
+    // closest triangle along the ray nearer than max_t, any_hit stops at the first one found
+    template<bool any_hit>
+    inline int traverse(const Ray& ray, float& max_t, float& hu, float& hv){
+        int found = -1;
+        if (AABBIntersection(nodes[0].aabb, ray) == FINF){
+            return found;
+        }
+        const FlatNode* node = &nodes[0];
+        const FlatNode* stack[BVH_MAX_DEPTH];
+        uint stack_ptr = 0;
+        while (true){
+            PERF_COUNT(COUNTER_NODES_VISITED);
+            if (node->count > 0){
+                for (uint i = node->first; i < node->first + node->count; i++){
+                    PERF_COUNT(COUNTER_TRIANGLE_TESTS);
+                    float t, u, v;
+                    if (Intersector::intersect(triangles[i], ray, max_t, t, u, v)){
+                        PERF_COUNT(COUNTER_TRIANGLE_HITS);
+                        max_t = t;
+                        hu = u;
+                        hv = v;
+                        found = i;
+                        if (any_hit){
+                            return found;
+                        }
+                    }
+                }
+                if (stack_ptr == 0){
+                    break;
+                }
+                node = stack[--stack_ptr];
+                continue;
+            }
+            const FlatNode* child1 = &nodes[node->first];
+            const FlatNode* child2 = &nodes[node->first + 1];
+            float t1 = AABBIntersection(child1->aabb, ray);
+            float t2 = AABBIntersection(child2->aabb, ray);
+            if (t1 > t2){
+                std::swap(child1, child2);
+                std::swap(t1, t2);
+            }
+            if (t1 == FINF || t1 > max_t){
+                if (stack_ptr == 0){
+                    break;
+                }
+                node = stack[--stack_ptr];
+            }
+            else{
+                node = child1;
+                if (t2 != FINF && t2 < max_t){
+                    stack[stack_ptr++] = child2;
+                }
+            }
+        }
+        return found;
+    }
+
+    // fills in the hit the way TriangleMesh::intersect would
+    inline void finish_hit(const Ray& ray, int triangle, RayHit& hit){
+        const FlatPrimitive& primitive = primitives[triangle];
+        const FlatSource& source = sources[primitive.source];
+        TriangleMesh* mesh = source.mesh;
+        const Face& face = (*source.faces)[primitive.face];
+        hit.index = primitive.face;
+        hit.object = mesh->cost_id;
+        hit.mat = mesh->material();
+        hit.point = ray.at(hit.distance);
+        float w = 1 - hit.hu - hit.hv;
+        Vector3 normal = Vector3::normalize(mesh->normals[face[2] - 1] * w + mesh->normals[face[5] - 1] * hit.hu + mesh->normals[face[8] - 1] * hit.hv);
+        Vector3 uv = mesh->texcoords[face[1] - 1] * w + mesh->texcoords[face[4] - 1] * hit.hu + mesh->texcoords[face[7] - 1] * hit.hv;
+        hit.u = uv.x;
+        hit.v = uv.y;
+        hit.normal = normal;
+        if (ray.has_differentials){
+            hit.footprint = mesh->footprint(ray, face, uv);
+        }
+    }
+
+    inline void closest(const std::vector<Ray>& rays, std::vector<RayHit>& hits){
+        for (size_t i = 0; i < rays.size(); i++){
+            RayHit& hit = hits[i];
+            int triangle = traverse<false>(rays[i], hit.distance, hit.hu, hit.hv);
+            if (triangle >= 0){
+                finish_hit(rays[i], triangle, hit);
+            }
+        }
+    }
+
+    inline bool occluded(const Ray& ray, float max_distance){
+        float hu, hv;
+        return traverse<true>(ray, max_distance, hu, hv) >= 0;
+    }
+};
+
+
+// ---- shading models ----
+
+// what Renderer::illuminate does, phong specular off the reflected light direction
+struct BlinnPhongShading{
+    static inline void reflect(const ShadingPoint& s, const LightSample& light, Vector3& colour){
+        float theta = Vector3::dot(s.N, light.L);
+        colour += s.K_d * fmax(theta, 0) * light.I;
+        Vector3 R = Vector3::normalize(s.N * 2 * theta - light.L);
+        float phi = Vector3::dot(R, s.V);
+        colour += light.colour * s.K_s * light.I * pow(fmax(phi, 0), s.alpha);
+    }
+};
+
+// diffuse only
+struct LambertShading{
+    static inline void reflect(const ShadingPoint& s, const LightSample& light, Vector3& colour){
+        colour += s.K_d * fmax(Vector3::dot(s.N, light.L), 0) * light.I;
+    }
+};
+
+
+// ---- integrators ----
+
+inline LightSample sample_light(const KernelLight& light, const Vector3& P){
+    LightSample sample;
+    sample.dist = Vector3::length(light.position - P);
+    sample.I = kernel_illumination(light, sample.dist);
+    sample.L = (light.position - P) / sample.dist;
+    sample.colour = light.colour;
+    return sample;
+}
+
+// ambient and every light as if nothing were in the way, the same image as the general path
+struct DirectLighting{
+    template<typename Shading, typename Accelerator>
+    static inline Vector3 radiance(Accelerator&, const std::vector<KernelLight>& lights, Vector3 ambient, const ShadingPoint& s){
+        Vector3 colour = Vector3(0,0,0);
+        colour += s.K_d * ambient;
+        for (const KernelLight& light: lights){
+            Shading::reflect(s, sample_light(light, s.P), colour);
+        }
+        return colour;
+    }
+};
+
+// only lights the point can see add to it, one shadow ray each
+struct ShadowedLighting{
+    template<typename Shading, typename Accelerator>
+    static inline Vector3 radiance(Accelerator& accelerator, const std::vector<KernelLight>& lights, Vector3 ambient, const ShadingPoint& s){
+        Vector3 colour = Vector3(0,0,0);
+        colour += s.K_d * ambient;
+        for (const KernelLight& light: lights){
+            LightSample sample = sample_light(light, s.P);
+            PERF_COUNT(COUNTER_SHADOW_RAYS);
+            // pushed off the surface so the ray doesn't find the point it starts from
+            if (accelerator.occluded(Ray(s.P + s.N * 1e-3f, sample.L), sample.dist)){
+                continue;
+            }
+            Shading::reflect(s, sample, colour);
+        }
+        return colour;
+    }
+};
+
+
+// ---- samplers ----
+
+// the renderers own sampling, a grid for square spp and jittered samples otherwise, through the filter
+struct FilteredSampler{
+    template<typename Tracer>
+    static inline void sample(Renderer& renderer, Tracer& tracer, int tx, int ty, int tw, int th, std::vector<float> colour[3]){
+        renderer.sample_tile(tracer, tx, ty, tw, th, colour);
+    }
+};
+
+// one ray through each pixel centre whatever spp and the filter are, for quick previews
+struct CentreSampler{
+    template<typename Tracer>
+    static inline void sample(Renderer& renderer, Tracer& tracer, int tx, int ty, int tw, int th, std::vector<float> colour[3]){
+        thread_local std::vector<Ray> rays;
+        thread_local std::vector<Vector3> traced;
+        rays.clear();
+        for (int z = 0; z < th; z++){
+            for (int x = 0; x < tw; x++){
+                rays.push_back(renderer.world.cam.cast_ray(tx * renderer.tile_size + x, ty * renderer.tile_size + z));
+            }
+        }
+        tracer.trace_batch(rays, traced);
+        for (int c = 0; c < 3; c++){
+            colour[c].resize(tw * th);
+        }
+        for (int p = 0; p < tw * th; p++){
+            colour[0][p] = traced[p].x;
+            colour[1][p] = traced[p].y;
+            colour[2][p] = traced[p].z;
+        }
+    }
+};
+
+
+// ---- the kernel ----
+
+template<typename Accelerator, typename Integrator, typename Shading, typename Sampler>
+struct PolicyKernel final: public RenderKernel{
+    Renderer& renderer;
+    Accelerator accelerator;
+    std::vector<KernelLight> lights;
+
+    PolicyKernel(Renderer& renderer_) : renderer(renderer_){}
+
+    bool build(){
+        for (std::shared_ptr<Light>& light: renderer.world.lights){
+            SphericalLight* spherical = dynamic_cast<SphericalLight*>(light.get());
+            if (spherical == nullptr){
+                return false;
+            }
+            lights.push_back({spherical->position, spherical->colour, spherical->intensity});
+        }
+        return accelerator.build(renderer.world);
+    }
+
+    inline Vector3 shade(const Ray& ray, const RayHit& hit){
+        if (hit.distance == FINF){
+            if (renderer.world.sky != nullptr){
+                PERF_COUNT(COUNTER_TEXTURE_SAMPLES);
+                return renderer.world.sky->get_colour(ray);
+            }
+            return Vector3(0);
+        }
+        PERF_COUNT(COUNTER_SHADING);
+        const Material& mat = *hit.mat;
+        ShadingPoint s;
+        s.P = hit.point;
+        s.N = hit.normal;
+        s.V = Vector3::normalize(ray.origin - hit.point);
+        s.K_d = mat.K_d;
+        if (mat.K_Dtex != nullptr){
+            PERF_COUNT(COUNTER_TEXTURE_SAMPLES);
+            s.K_d = mat.K_Dtex->get_colour(hit.u, hit.v, hit.footprint);
+        }
+        s.K_s = mat.K_s;
+        s.alpha = mat.N_s;
+        return Integrator::template radiance<Shading>(accelerator, lights, renderer.world.ambientColour, s);
+    }
+
+    inline void trace_batch(const std::vector<Ray>& rays, std::vector<Vector3>& colours){
+        thread_local std::vector<RayHit> hits;
+        PERF_ADD(COUNTER_PRIMARY_RAYS, rays.size());
+        if (renderer.ray_dump != nullptr){
+            renderer.ray_dump->record(rays);
+        }
+        hits.assign(rays.size(), RayHit());
+        accelerator.closest(rays, hits);
+        colours.resize(rays.size());
+        for (size_t i = 0; i < rays.size(); i++){
+            colours[i] = shade(rays[i], hits[i]);
+        }
+    }
+
+    void sample_tile(Renderer& renderer_, int tx, int ty, int tw, int th, std::vector<float> colour[3]){
+        Sampler::sample(renderer_, *this, tx, ty, tw, th, colour);
+    }
+};
+
+template<typename Accelerator, typename Integrator, typename Shading, typename Sampler>
+std::shared_ptr<RenderKernel> build_policy_kernel(Renderer& renderer){
+    std::shared_ptr<PolicyKernel<Accelerator, Integrator, Shading, Sampler>> kernel =
+        std::make_shared<PolicyKernel<Accelerator, Integrator, Shading, Sampler>>(renderer);
+    if (!kernel->build()){
+        return nullptr;
+    }
+    return kernel;
+}
+
+
+struct RenderVariant{
+    const char* name;
+    const char* description;
+    std::shared_ptr<RenderKernel> (*build)(Renderer& renderer);
+};
+
+// every variant compiled into the binary, add a line here to ship another
+const RenderVariant RENDER_VARIANTS[] = {
+    {"scene", "scene objects, direct light, Blinn-Phong, filtered",
+        build_policy_kernel<SceneAccelerator, DirectLighting, BlinnPhongShading, FilteredSampler>},
+    {"flat", "flat BVH, direct light, Blinn-Phong, filtered",
+        build_policy_kernel<FlatBVH<MollerTrumbore>, DirectLighting, BlinnPhongShading, FilteredSampler>},
+    {"flat_deferred", "flat BVH with the deferred divide test, direct light, Blinn-Phong, filtered",
+        build_policy_kernel<FlatBVH<DeferredDivide>, DirectLighting, BlinnPhongShading, FilteredSampler>},
+    {"flat_shadows", "flat BVH, shadowed direct light, Blinn-Phong, filtered",
+        build_policy_kernel<FlatBVH<MollerTrumbore>, ShadowedLighting, BlinnPhongShading, FilteredSampler>},
+    {"preview", "flat BVH, direct light, Lambert, one ray per pixel",
+        build_policy_kernel<FlatBVH<DeferredDivide>, DirectLighting, LambertShading, CentreSampler>},
+};
+
+std::shared_ptr<RenderKernel> make_render_kernel(const std::string& name, Renderer& renderer){
+    for (const RenderVariant& variant: RENDER_VARIANTS){
+        if (name != variant.name){
+            continue;
+        }
+        TRACE_SCOPE("make_render_kernel", name);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::shared_ptr<RenderKernel> kernel = variant.build(renderer);
+        if (kernel == nullptr){
+            std::cerr << "Render variant " << name << " can't render this scene, using the general path" << std::endl;
+            return nullptr;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Render variant " << name << " (" << variant.description << "), set up in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+        return kernel;
+    }
+    std::cerr << "Unknown render variant " << name << ", the variants are:";
+    for (const RenderVariant& variant: RENDER_VARIANTS){
+        std::cerr << " " << variant.name;
+    }
+    std::cerr << std::endl;
+    return nullptr;
+}
@@ -3,20 +3,74 @@
 #include "Scene.h"
 #include "QOI.h"
 #include "Camera.h"
+#include "TextureRegistry.h"
+#include "GeometryCache.h"
+#include "PFM.h"
+#include "Tonemap.h"
+#include "Filter.h"
+#include "RayDump.h"
+#include "Counters.h"
+#include "Heatmap.h"
+#include "MemoryAccounting.h"
 #include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 
+// when set the linear framebuffer is also saved here as a PFM
+// so exposure and tonemapping can be redone with the tonemap tool
+std::string HDR_OUTPUT = "";
+// when set every RAY_DUMP_STRIDE-th camera ray is saved here for the kernel benchmarks
+std::string RAY_DUMP_OUTPUT = "";
+unsigned int RAY_DUMP_STRIDE = 16;
+// name of one of the RENDER_VARIANTS to render with, empty for the general path through the scene objects
+std::string RENDER_VARIANT = "";
+
+
+struct Renderer;
+
+// a renderer specialised at compile time on its policies, the variants are listed in RenderVariants.h
+// it is called once per tile and everything under that is inlined for the variant
+struct RenderKernel{
+    virtual ~RenderKernel(){}
+    // samples of tile tx, ty filtered into planar RGB, colour[c][z * tw + x]
+    virtual void sample_tile(Renderer& renderer, int tx, int ty, int tw, int th, std::vector<float> colour[3])=0;
+};
+
+// the variant of that name built for the renderers scene, null if there is none or it can't render the scene
+std::shared_ptr<RenderKernel> make_render_kernel(const std::string& name, Renderer& renderer);
 
 struct Renderer{
     int width, height;
-    QOIWriter* out;
+    ImageWriter* out;
     Scene world;
     int max_bounces = 2;
     int shadow_rays = 10;
-    int spp = 5;
+    // samples per pixel, a square number puts them on a regular grid so the separable filter path is used
+    // anything else is jittered over the filter footprint of each pixel
+    int spp = 1;
+    ReconstructionFilter filter = ReconstructionFilter(FilterType::BOX);
+    // image is rendered in square tiles spread over the worker threads
+    int tile_size = 32;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    // bytes of framebuffer kept in memory, 0 holds the whole image
+    // otherwise the image is rendered in horizontal bands that are encoded as they finish
+    unsigned long long framebuffer_budget = 0;
     std::shared_ptr<Observable> previous_object = nullptr;
+    // anything but NONE renders what each pixel cost to trace instead of its colour
+    // counts need a build with PERF_COUNTERS=1, without it the heatmap falls back to time
+    HeatmapMetric heatmap = HeatmapMetric::NONE;
+    // only set while a render with RAY_DUMP_OUTPUT is running
+    RayDumpWriter* ray_dump = nullptr;
+    // built for RENDER_VARIANT by the first render that asks for it and kept for the ones after,
+    // the scene is copied in when the renderer is made so the kernel can't go out of date
+    std::shared_ptr<RenderKernel> kernel = nullptr;
+    // the variant kernel was built for, it is null if that variant can't render the scene
+    std::string kernel_variant = "";
 
-    Renderer(QOIWriter* output, int w, int h, Scene s){
+    Renderer(ImageWriter* output, int w, int h, Scene s){
         out = output;
         width = w;
         height = h;
@@ -24,51 +78,90 @@ struct Renderer{
         world.setup_camera(width, height);
     }
 
+    // builds the kernel for RENDER_VARIANT unless it is already there
+    void prepare_kernel(){
+        if (kernel_variant == RENDER_VARIANT){
+            return;
+        }
+        kernel = (RENDER_VARIANT != "") ? make_render_kernel(RENDER_VARIANT, *this) : nullptr;
+        kernel_variant = RENDER_VARIANT;
+    }
+
     // trace ray through scene and find information of intersection
     Vector3 trace(Ray& ray){
+        PERF_COUNT(COUNTER_PRIMARY_RAYS);
         RayHit closest;
         world.closest_intersection(closest, ray);
+        return shade(ray, closest);
+    }
+
+    // trace a batch of rays together, so objects that stream their geometry in can
+    // group the rays by the parts of the scene they touch
+    void trace_batch(const std::vector<Ray>& rays, std::vector<Vector3>& colours){
+        thread_local std::vector<RayHit> hits;
+        PERF_ADD(COUNTER_PRIMARY_RAYS, rays.size());
+        if (ray_dump != nullptr){
+            ray_dump->record(rays);
+        }
+        hits.assign(rays.size(), RayHit());
+        world.closest_intersections(rays, hits);
+        colours.resize(rays.size());
+        for (size_t i = 0; i < rays.size(); i++){
+            colours[i] = shade(rays[i], hits[i]);
+        }
+    }
 
+    // colour seen along ray given its closest hit
+    Vector3 shade(const Ray& ray, RayHit& closest){
         if (closest.distance == FINF){
             if (world.sky != nullptr){
-                return world.sky->get_colour(ray.direction);
+                PERF_COUNT(COUNTER_TEXTURE_SAMPLES);
+                return world.sky->get_colour(ray);
             }
             return Vector3(0);
         }
 
+#if COST_ATTRIBUTION
+        if (closest.object >= 0)
+            object_cost(closest.object).hits++;
+#endif
         //ray.origin = closest.point + closest.normal * EPSILON;
         //ray.direction = random_hemisphere_vector(closest.normal);
-        return illuminate(closest.mat, closest.point, closest.normal, ray.origin, closest.u, closest.v);
+        return illuminate(*closest.mat, closest.point, closest.normal, ray.origin, closest.u, closest.v, closest.footprint);
     }
 
     // illuminate a point on an object
     // using Blinn-Phong Shading model
-    Vector3 illuminate(std::shared_ptr<Material> mat, Vector3 P, Vector3 N, Vector3 O, float u, float v){
+    Vector3 illuminate(const Material& mat, Vector3 P, Vector3 N, Vector3 O, float u, float v, const TextureFootprint& footprint){
         // colour of point to be returned
         Vector3 colour = Vector3(0,0,0);
+        PERF_COUNT(COUNTER_SHADING);
 
         Vector3 V = Vector3::normalize(O-P);
-        Vector3 K_d = mat->K_d;
+        Vector3 K_d = mat.K_d;
 
         // if object has a diffuse texture sample it
-        if (mat->K_Dtex != nullptr){
-            K_d = mat->K_Dtex->get_colour(u, v);
+        if (mat.K_Dtex != nullptr){
+            PERF_COUNT(COUNTER_TEXTURE_SAMPLES);
+            K_d = mat.K_Dtex->get_colour(u, v, footprint);
         }
-        Vector3 K_s = mat->K_s;
+        Vector3 K_s = mat.K_s;
         Vector3 I_a = world.ambientColour;
-        int alpha = mat->N_s;
+        int alpha = mat.N_s;
 
         // ambient lighting
         colour += K_d * I_a;
 
         // calculate diffuse and specular components for each light
+        // the lights are used through references, copying their shared pointers would
+        // bounce the reference counts between the render threads
         for (int i = 0; i < world.lights.size(); i++){
-            std::shared_ptr<Light> light = world.lights[i];
-            float dist = Vector3::length(light->position - P);
-            Vector3 C_spec = light->colour;
-            Vector3 I = light->ilumination_at(dist);
+            Light& light = *world.lights[i];
+            float dist = Vector3::length(light.position - P);
+            Vector3 C_spec = light.colour;
+            Vector3 I = light.ilumination_at(dist);
 
-            Vector3 L = (light->position - P) / dist;
+            Vector3 L = (light.position - P) / dist;
 
             // Diffuse
             float theta = Vector3::dot(N, L);
@@ -82,28 +175,409 @@ struct Renderer{
         return colour;
     }
 
+    // linear colour to an 8 bit channel, floored and clamped to 0-255
+    static inline uint8_t to_byte(float c){
+        return fmax(0, fmin(floorf(c * 255), 255));
+    }
+
+    // regular n x n sample grid over the tile and a margin wide enough for the filter
+    // samples are filtered horizontally then vertically into planar RGB, colour[c][z * tw + x]
+    template<typename Tracer>
+    void sample_tile_grid(Tracer& tracer, int x0, int z0, int tw, int th, int n, std::vector<float> colour[3]){
+        thread_local std::vector<float> samples[3];
+        thread_local std::vector<float> rows[3];
+        int m = filter.grid_margin(n);
+        std::vector<float> taps = filter.grid_taps(n);
+        int taps_count = taps.size();
+        int sw = tw * n + 2 * m;
+        int sh = th * n + 2 * m;
+        for (int c = 0; c < 3; c++){
+            samples[c].resize(sw * sh);
+            rows[c].assign(sh * tw, 0);
+            colour[c].assign(tw * th, 0);
+        }
+
+        // every sample of the tile is traced as one batch
+        thread_local std::vector<Ray> rays;
+        thread_local std::vector<Vector3> traced;
+        rays.clear();
+        float spacing = 1.0f / n;
+        for (int j = 0; j < sh; j++){
+            float z = z0 + (j - m + 0.5f) * spacing - 0.5f;
+            for (int i = 0; i < sw; i++){
+                float x = x0 + (i - m + 0.5f) * spacing - 0.5f;
+                rays.push_back(world.cam.cast_ray(x, z, spacing));
+            }
+        }
+        tracer.trace_batch(rays, traced);
+        for (int i = 0; i < sw * sh; i++){
+            samples[0][i] = traced[i].x;
+            samples[1][i] = traced[i].y;
+            samples[2][i] = traced[i].z;
+        }
+
+        // the kernel is the same for every pixel so both passes are plain multiply adds
+        for (int c = 0; c < 3; c++){
+            for (int j = 0; j < sh; j++){
+                const float* in = &samples[c][j * sw];
+                float* out = &rows[c][j * tw];
+                for (int k = 0; k < taps_count; k++){
+                    float w = taps[k];
+                    for (int x = 0; x < tw; x++){
+                        out[x] += w * in[x * n + k];
+                    }
+                }
+            }
+            for (int z = 0; z < th; z++){
+                float* out = &colour[c][z * tw];
+                for (int k = 0; k < taps_count; k++){
+                    float w = taps[k];
+                    const float* in = &rows[c][(z * n + k) * tw];
+                    for (int x = 0; x < tw; x++){
+                        out[x] += w * in[x];
+                    }
+                }
+            }
+        }
+    }
+
+    // spp random samples spread over each pixels filter footprint, weighted by the filter
+    template<typename Tracer>
+    void sample_tile_jittered(Tracer& tracer, int x0, int z0, int tw, int th, std::vector<float> colour[3]){
+        float radius = filter.radius();
+        float spacing = 1.0f / sqrtf(spp);
+        for (int c = 0; c < 3; c++){
+            colour[c].assign(tw * th, 0);
+        }
+        // every sample of the tile is traced as one batch, then weighted into its pixel
+        thread_local std::vector<Ray> rays;
+        thread_local std::vector<std::pair<int, float>> sample_pixels;
+        thread_local std::vector<Vector3> traced;
+        rays.clear();
+        sample_pixels.clear();
+        for (int z = 0; z < th; z++){
+            for (int x = 0; x < tw; x++){
+                for (int s = 0; s < spp; s++){
+                    float dx = (random_value() * 2 - 1) * radius;
+                    float dz = (random_value() * 2 - 1) * radius;
+                    float w = filter.weight(dx) * filter.weight(dz);
+                    if (w == 0){
+                        continue;
+                    }
+                    rays.push_back(world.cam.cast_ray(x0 + x + dx, z0 + z + dz, spacing));
+                    sample_pixels.push_back({z * tw + x, w});
+                }
+            }
+        }
+        tracer.trace_batch(rays, traced);
+        thread_local std::vector<Vector3> totals;
+        thread_local std::vector<float> total_weights;
+        totals.assign(tw * th, Vector3(0));
+        total_weights.assign(tw * th, 0);
+        for (size_t i = 0; i < rays.size(); i++){
+            totals[sample_pixels[i].first] += traced[i] * sample_pixels[i].second;
+            total_weights[sample_pixels[i].first] += sample_pixels[i].second;
+        }
+        for (int p = 0; p < tw * th; p++){
+            Vector3 total = totals[p];
+            if (total_weights[p] > 0){
+                total = total / total_weights[p];
+            }
+            colour[0][p] = total.x;
+            colour[1][p] = total.y;
+            colour[2][p] = total.z;
+        }
+    }
+
+    // the tiles samples through the filter, traced by tracer.trace_batch
+    // the renderer is the tracer of the general path, compiled variants pass themselves
+    template<typename Tracer>
+    void sample_tile(Tracer& tracer, int tx, int ty, int tw, int th, std::vector<float> colour[3]){
+        int x0 = tx * tile_size;
+        int z0 = ty * tile_size;
+        int n = (int) roundf(sqrtf(spp));
+        if (n * n == spp){
+            sample_tile_grid(tracer, x0, z0, tw, th, n, colour);
+        }
+        else{
+            // seeded per tile so the image doesn't depend on which thread rendered what
+            seed_random((ty << 16) + tx + 1);
+            sample_tile_jittered(tracer, x0, z0, tw, th, colour);
+        }
+    }
+
+    // rows and hdr_rows point at the first scanline of the tiles row inside the band buffers
+    // hdr_rows is null when no linear output is wanted
+    void render_tile(int tx, int ty, uint8_t* rows, float* hdr_rows){
+        thread_local std::vector<float> colour[3];
+        int x0 = tx * tile_size;
+        int z0 = ty * tile_size;
+        int tw = std::min(width, x0 + tile_size) - x0;
+        int th = std::min(height, z0 + tile_size) - z0;
+
+        if (kernel != nullptr){
+            kernel->sample_tile(*this, tx, ty, tw, th, colour);
+        }
+        else{
+            sample_tile(*this, tx, ty, tw, th, colour);
+        }
+
+        for (int z = 0; z < th; z++){
+            for (int x = 0; x < tw; x++){
+                size_t offset = (z * width + x0 + x) * 3;
+                uint8_t* pixel = &rows[offset];
+                for (int c = 0; c < 3; c++){
+                    pixel[c] = to_byte(colour[c][z * tw + x]);
+                }
+                if (hdr_rows != nullptr){
+                    for (int c = 0; c < 3; c++){
+                        hdr_rows[offset + c] = colour[c][z * tw + x];
+                    }
+                }
+            }
+        }
+    }
+
+    // one ray through each pixel centre through the usual trace path, timed or counted,
+    // drawn in false colour scaled to the 99th percentile so a few extreme pixels don't wash it out
+    void render_heatmap(){
+        HeatmapMetric metric = heatmap;
+        if (!PERF_COUNTERS && metric != HeatmapMetric::TIME){
+            std::cerr << "Counting " << heatmap_metric_name(metric) << " needs PERF_COUNTERS=1, showing time instead" << std::endl;
+            metric = HeatmapMetric::TIME;
+        }
+        PerfCounter counter = COUNTER_NODES_VISITED;
+        if (metric == HeatmapMetric::AABB_TESTS) counter = COUNTER_AABB_TESTS;
+        if (metric == HeatmapMetric::TRIANGLES) counter = COUNTER_TRIANGLE_TESTS;
+        std::cout << "Rendering heatmap of " << heatmap_metric_name(metric) << " per pixel..." << std::endl;
+
+        MemoryCharge framebuffer_memory = MemoryCharge(MEMORY_FRAMEBUFFERS, (size_t) width * height * (sizeof(float) + 3));
+        std::vector<float> costs((size_t) width * height);
+        std::atomic<int> next_row{0};
+        // the first exception out of a worker, rethrown here so it doesn't end the process
+        std::exception_ptr failure;
+        std::mutex failure_lock;
+        auto worker = [&](){
+            CounterBlock& counters = thread_counters();
+            try{
+                for (int z = next_row++; z < height; z = next_row++){
+                    for (int x = 0; x < width; x++){
+                        Ray ray = world.cam.cast_ray(x, z);
+                        unsigned long long before = counters.values[counter].load(std::memory_order_relaxed);
+                        auto start = std::chrono::high_resolution_clock::now();
+                        trace(ray);
+                        auto end = std::chrono::high_resolution_clock::now();
+                        costs[(size_t) z * width + x] = (metric == HeatmapMetric::TIME)
+                            ? std::chrono::duration<float, std::nano>(end - start).count()
+                            : counters.values[counter].load(std::memory_order_relaxed) - before;
+                    }
+                }
+            }
+            catch(...){
+                std::lock_guard<std::mutex> guard(failure_lock);
+                if (!failure){
+                    failure = std::current_exception();
+                }
+                next_row = height;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++){
+            workers.emplace_back(worker);
+        }
+        for (std::thread& thread: workers){
+            thread.join();
+        }
+        if (failure){
+            std::rethrow_exception(failure);
+        }
+
+        HeatmapSummary summary = summarise_costs(costs);
+        std::cout << "Heatmap " << heatmap_metric_name(metric) << " per pixel: mean " << summary.mean << ", p50 " << summary.p50
+                  << ", p90 " << summary.p90 << ", p99 " << summary.p99 << ", max " << summary.max << std::endl;
+        float scale = (summary.p99 > 0) ? summary.p99 : std::max(summary.max, 1.0f);
+        std::vector<uint8_t> rgb((size_t) width * height * 3);
+        for (size_t i = 0; i < costs.size(); i++){
+            Vector3 c = heat_colour(costs[i] / scale);
+            rgb[i * 3] = to_byte(c.x);
+            rgb[i * 3 + 1] = to_byte(c.y);
+            rgb[i * 3 + 2] = to_byte(c.z);
+        }
+        draw_legend(rgb, width, height, scale);
+        out->write_rgb8(rgb.data(), (size_t) width * height);
+        out->finish();
+        memory_accounting.report("after render");
+    }
+
     void render(){
+        TRACE_SCOPE("Renderer::render");
+        memory_accounting.report("after load");
+        // fewer than one sample would divide by zero when spacing them
+        spp = std::max(spp, 1);
+        if (heatmap != HeatmapMetric::NONE){
+            render_heatmap();
+            return;
+        }
         // timer for render time
         auto start = std::chrono::high_resolution_clock::now();
-
-        // used for outputting the renders current %
-        int tenpercent = height/10;
         std::cout << "Rendering..." << std::endl;
 
-        // iterate through the pixel coordinates
-        for (int z = 0; z < height; z++){
-            for (int x = 0; x < width; x++){
-                // get the ray from the camera goinf through that coordinate
-                Ray r = world.cam.cast_ray(x,z);
-                Vector3 lin_rgb = trace(r);
-                // write value to file
-                out->write_pixel(lin_rgb*255);
+        int tiles_x = (width + tile_size - 1) / tile_size;
+        int tiles_y = (height + tile_size - 1) / tile_size;
+
+        std::ofstream hdr_file;
+        std::unique_ptr<PFMWriter> hdr_out;
+        if (HDR_OUTPUT != ""){
+            hdr_file.open(HDR_OUTPUT, std::ios::out|std::ios::binary);
+            hdr_out = std::make_unique<PFMWriter>(hdr_file, width, height);
+        }
+        int pixel_bytes = hdr_out ? 3 + 3 * sizeof(float) : 3;
+        std::unique_ptr<RayDumpWriter> dump;
+        if (RAY_DUMP_OUTPUT != ""){
+            dump = std::make_unique<RayDumpWriter>(RAY_DUMP_OUTPUT, RAY_DUMP_STRIDE);
+            ray_dump = dump.get();
+        }
+        prepare_kernel();
+
+        // the image is split into bands of whole tile rows, two bands are kept so
+        // one can be encoded while the next renders, without a budget one band covers the image
+        int band_tiles = tiles_y;
+        if (framebuffer_budget > 0){
+            unsigned long long tile_row_bytes = 2ull * width * tile_size * pixel_bytes;
+            band_tiles = std::max(1, (int) std::min<unsigned long long>(tiles_y, framebuffer_budget / tile_row_bytes));
+        }
+        int bands = (tiles_y + band_tiles - 1) / band_tiles;
+        int slots = std::min(bands, 2);
+        size_t band_values = (size_t) band_tiles * tile_size * width * 3;
+        MemoryCharge framebuffer_memory = MemoryCharge(MEMORY_FRAMEBUFFERS, slots * band_values / 3 * pixel_bytes);
+        std::vector<uint8_t> framebuffer(slots * band_values);
+        std::vector<float> hdr_framebuffer(hdr_out ? slots * band_values : 0);
+        if (bands > 1){
+            std::cout << "Streaming " << bands << " bands of " << band_tiles * tile_size << " rows, "
+                      << slots * band_values / 3 * pixel_bytes / 1048576.0 << "MB framebuffer" << std::endl;
+        }
+        // offset of the first scanline of a tile row inside its band slot
+        auto tile_rows = [&](int ty){
+            int band = ty / band_tiles;
+            return (band % slots) * band_values + (size_t) (ty - band * band_tiles) * tile_size * width * 3;
+        };
+
+        // finished tiles in each row of tiles
+        std::unique_ptr<std::atomic<int>[]> tiles_done(new std::atomic<int>[tiles_y]);
+        for (int i = 0; i < tiles_y; i++){
+            tiles_done[i] = 0;
+        }
+        std::atomic<int> next_tile{0};
+        int bands_encoded = 0;
+        std::mutex lock;
+        std::condition_variable row_done;
+        std::condition_variable band_free;
+        // the first exception out of a worker or the encoder, such as going over the memory budget
+        // while paging in chunks, everyone stops and it is rethrown here so it doesn't end the process
+        std::exception_ptr failure;
+        std::atomic<bool> failed{false};
+        auto fail = [&](){
+            std::lock_guard<std::mutex> guard(lock);
+            if (!failure){
+                failure = std::current_exception();
+            }
+            failed = true;
+            row_done.notify_all();
+            band_free.notify_all();
+        };
+
+        // the encoder takes scanlines as soon as every tile covering them is done
+        // tiles are handed out in scanline order so rows finish roughly top to bottom
+        // time the encoder spends outside of waiting for rows
+        long long encode_us = 0;
+        std::thread encoder([&](){
+            trace_thread_name("encoder");
+            try{
+                int percent = 0;
+                for (int ty = 0; ty < tiles_y; ty++){
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        row_done.wait(guard, [&](){return failed || tiles_done[ty] == tiles_x;});
+                        if (failed){
+                            return;
+                        }
+                    }
+                    TRACE_SCOPE("encode rows");
+                    auto encode_start = std::chrono::high_resolution_clock::now();
+                    int z0 = ty * tile_size;
+                    int z1 = std::min(height, z0 + tile_size);
+                    out->write_rgb8(&framebuffer[tile_rows(ty)], (z1 - z0) * width);
+                    if (hdr_out){
+                        hdr_out->write_rows(z0, &hdr_framebuffer[tile_rows(ty)], z1 - z0);
+                    }
+                    encode_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - encode_start).count();
+                    // last row of a band, its slot can be rendered into again
+                    if ((ty + 1) % band_tiles == 0 || ty + 1 == tiles_y){
+                        std::lock_guard<std::mutex> guard(lock);
+                        bands_encoded++;
+                        band_free.notify_all();
+                    }
+                    // used for outputting the renders current %
+                    while (percent + 10 <= (100 * z1) / height && percent < 90){
+                        percent += 10;
+                        std::cout << percent << "% complete" << std::endl;
+                    }
+                }
+                auto finish_start = std::chrono::high_resolution_clock::now();
+                out->finish();
+                encode_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - finish_start).count();
             }
-            if (z % tenpercent == 0){
-                std::cout << (100.0*z)/(height) << "% complete" << std::endl;
+            catch(...){
+                fail();
             }
+        });
+
+        auto worker = [&](){
+            trace_thread_name("render worker");
+            try{
+                for (int t = next_tile++; !failed && t < tiles_x * tiles_y; t = next_tile++){
+                    int tx = t % tiles_x;
+                    int ty = t / tiles_x;
+                    // wait for the band that last used this slot to be written out
+                    int band = ty / band_tiles;
+                    if (band >= slots){
+                        std::unique_lock<std::mutex> guard(lock);
+                        band_free.wait(guard, [&](){return failed || bands_encoded > band - slots;});
+                        if (failed){
+                            break;
+                        }
+                    }
+                    size_t offset = tile_rows(ty);
+                    TRACE_SCOPE("render_tile");
+                    render_tile(tx, ty, &framebuffer[offset], hdr_out ? &hdr_framebuffer[offset] : nullptr);
+                    if (++tiles_done[ty] == tiles_x){
+                        std::lock_guard<std::mutex> guard(lock);
+                        row_done.notify_one();
+                    }
+                }
+            }
+            catch(...){
+                fail();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++){
+            workers.emplace_back(worker);
+        }
+        for (std::thread& thread: workers){
+            thread.join();
+        }
+        encoder.join();
+        if (hdr_out){
+            hdr_file.close();
+        }
+        if (dump){
+            std::cout << "Dumped " << dump->written << " rays to " << RAY_DUMP_OUTPUT << std::endl;
+            ray_dump = nullptr;
+        }
+        if (failure){
+            std::rethrow_exception(failure);
         }
-        out->finish_run();
 
         std::cout << "100% complete" << std::endl;
         // output the render time
@@ -116,16 +590,24 @@ struct Renderer{
         else{
             std::cout << "Render time: " << (r_time_ms / 1000) << "s" << std::endl;
         }
+        std::cout << "Encode time: " << encode_us / 1000 << "ms" << std::endl;
+        texture_registry.report();
+        texture_cache.report();
+        geometry_cache.report();
+        perf_counters.report();
+        cost_attribution.report();
+        memory_accounting.report("after render");
     }
 
+    // same curve the tonemap tool applies to saved PFMs
     Vector3 tonemap(Vector3 lin_rgb){
-        double inv_gamma = 1./2.2;
-        double a = 2;
-        double b = 1.3;
-
-        Vector3 powered = Vector3::power(lin_rgb, b);
-        Vector3 display = powered * ( Vector3::invert(powered + pow(0.5/a, b)) );
-
-        return Vector3::power(display, inv_gamma);
+        TonemapSettings settings;
+        float inv_gamma = 1.0f / settings.gamma;
+        return Vector3(tonemap_channel(fmax(lin_rgb.x, 0), settings.a, settings.b, inv_gamma),
+                       tonemap_channel(fmax(lin_rgb.y, 0), settings.a, settings.b, inv_gamma),
+                       tonemap_channel(fmax(lin_rgb.z, 0), settings.a, settings.b, inv_gamma));
     }
-};
\ No newline at end of file
+};
+
+// the compiled variants need the whole renderer
+#include "RenderVariants.h"
@@ -25,7 +25,7 @@
 */
 
 struct Scene{
-    // keeps track of objects and lights
+    // keeps track of objects and lights, owned through shared pointers that are not copied per ray
     std::vector<std::shared_ptr<Observable>> objects;
     std::vector<std::shared_ptr<Light>> lights;
     std::shared_ptr<SkySphere> sky = nullptr;
@@ -43,6 +43,10 @@ struct Scene{
 
     void setup_camera(int width, int height){
         cam.set_screensize(width, height);
+        // levels of detail depend on how large objects appear on screen
+        for (int i = 0; i < (int) objects.size(); i++){
+            objects[i]->select_lod(cam);
+        }
     }
 
     void closest_intersection(RayHit& intersection, const Ray ray){
@@ -51,4 +55,11 @@ struct Scene{
             objects[i]->intersect(ray, intersection);
         }
     }
+
+    // hits[i] is the closest intersection of rays[i]
+    void closest_intersections(const std::vector<Ray>& rays, std::vector<RayHit>& hits){
+        for (int i = 0; i < (int) objects.size(); i++){
+            objects[i]->intersect_batch(rays, hits);
+        }
+    }
 };
\ No newline at end of file
@@ -0,0 +1,382 @@
+#pragma once
+
+#include "TriangleMesh.h"
+#include "BVH.h"
+#include "MappedFile.h"
+#include "TextureRegistry.h"
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+// load_obj saves the meshes it builds, with their trees and levels of detail, and reads them back next time
+// a copy on load cache: the file is mapped to read it, but every array is copied out and the triangles are
+// rebuilt from the faces, so each process holds its own copy and no pages are shared between them
+// every source file is hashed in full on each load to tell whether the cache is still good
+#define USE_SCENE_CACHE 1
+
+std::string SCENE_CACHE_DIR = "scene_cache/";
+const uint32_t SCENE_CACHE_MAGIC = 0x4e435353;
+const uint32_t SCENE_CACHE_VERSION = 3;
+// arrays start on this boundary so they can be copied straight out of the mapping
+const size_t SCENE_CACHE_ALIGN = 16;
+
+
+// fast 64 bit hash of a block of bytes, eight at a time
+inline uint64_t hash_bytes(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull){
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8){
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++){
+        hash = (hash ^ (unsigned char) data[i]) * 0x100000001b3ull;
+    }
+    return hash ^ size;
+}
+
+// false if the file can't be read
+inline bool file_content_hash(const std::string& filename, uint64_t& hash){
+    MappedFile file;
+    if (!file.open(filename)){
+        return false;
+    }
+    hash = hash_bytes(file.data, file.size);
+    return true;
+}
+
+// everything that changes what load_obj builds, a cache made with other settings is stale
+inline uint64_t scene_cache_settings(){
+    uint64_t settings[] = {SCENE_CACHE_VERSION, sizeof(Vector3), sizeof(Face), sizeof(BVHNode), sizeof(Mat4),
+                           BUILD_LODS, BUILD_OCTREE, LOD_LEVELS, LOD_MIN_FACES, 0};
+    memcpy(&settings[9], &LOD_MAX_ERROR, sizeof(float));
+    return hash_bytes((const char*) settings, sizeof(settings));
+}
+
+// cache files are named after the source path
+inline std::string scene_cache_filename(const std::string& filename){
+    std::filesystem::path source = std::filesystem::absolute(filename);
+    return SCENE_CACHE_DIR + std::to_string(std::hash<std::string>()(source.string())) + ".scene";
+}
+
+
+struct SceneCacheWriter{
+    std::ofstream& file;
+    size_t offset = 0;
+
+    SceneCacheWriter(std::ofstream& file_) : file(file_){}
+
+    void write(const void* data, size_t size){
+        file.write((const char*) data, size);
+        offset += size;
+    }
+
+    template<typename T>
+    void put(const T& value){
+        static_assert(std::is_standard_layout<T>::value, "cached values are copied as bytes");
+        write(&value, sizeof(T));
+    }
+
+    void align(){
+        const char zeros[SCENE_CACHE_ALIGN] = {};
+        write(zeros, (SCENE_CACHE_ALIGN - offset % SCENE_CACHE_ALIGN) % SCENE_CACHE_ALIGN);
+    }
+
+    template<typename T>
+    void put_array(const std::vector<T>& values){
+        static_assert(std::is_standard_layout<T>::value, "cached arrays are copied as bytes");
+        put((uint64_t) values.size());
+        align();
+        write(values.data(), values.size() * sizeof(T));
+    }
+
+    void put_string(const std::string& value){
+        put((uint64_t) value.size());
+        write(value.data(), value.size());
+    }
+
+    void put_material(const Material& mat){
+        put(mat.K_a);
+        put(mat.K_d);
+        put(mat.K_s);
+        put(mat.N_s);
+        put(mat.N_i);
+        put(mat.d);
+        put_string(mat.K_Dtex_file);
+    }
+
+    // only bounding volume hierarchies can be cached, false for anything else
+    bool put_tree(const std::shared_ptr<Observable>& tree){
+        std::shared_ptr<BVH> bvh = std::dynamic_pointer_cast<BVH>(tree);
+        if (bvh == nullptr){
+            return false;
+        }
+        std::vector<BVHNode> used(bvh->nodes.begin(), bvh->nodes.begin() + bvh->nodes_used);
+        put_array(used);
+        put_array(bvh->indices);
+        return true;
+    }
+
+    // every mesh of bvh and the tree over them, false if bvh holds anything but meshes with BVH trees
+    bool put_meshes(BVH& bvh){
+        bool cacheable = true;
+        put((uint64_t) bvh.observables.size());
+        for (const std::shared_ptr<Observable>& obs: bvh.observables){
+            std::shared_ptr<TriangleMesh> mesh = std::dynamic_pointer_cast<TriangleMesh>(obs);
+            if (mesh == nullptr){
+                return false;
+            }
+            put_string(mesh->name);
+            put_material(mesh->mat);
+            put(mesh->object_matrix);
+            put(mesh->boundingBox[0]);
+            put(mesh->boundingBox[1]);
+            put_array(mesh->vertices);
+            put_array(mesh->normals);
+            put_array(mesh->texcoords);
+            put_array(mesh->faces);
+            cacheable &= put_tree(mesh->tree);
+            // levels of detail are stored without trees, select_lod builds the one in use
+            put((uint64_t) mesh->lods.size());
+            for (const MeshLOD& lod: mesh->lods){
+                put_array(lod.faces);
+                put(lod.error);
+            }
+        }
+        std::vector<BVHNode> used(bvh.nodes.begin(), bvh.nodes.begin() + std::min<size_t>(bvh.nodes_used, bvh.nodes.size()));
+        put_array(used);
+        put_array(bvh.indices);
+        return cacheable;
+    }
+};
+
+
+// reads the values back in the same order, straight out of the mapped file
+// every get returns false once the data runs out, so a truncated file is just stale
+struct SceneCacheReader{
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+
+    SceneCacheReader(const MappedFile& file) : data(file.data), size(file.size){}
+
+    bool read(void* out, size_t bytes){
+        if (bytes > size - offset){
+            return false;
+        }
+        memcpy(out, data + offset, bytes);
+        offset += bytes;
+        return true;
+    }
+
+    template<typename T>
+    bool get(T& value){
+        return read(&value, sizeof(T));
+    }
+
+    bool align(){
+        size_t padding = (SCENE_CACHE_ALIGN - offset % SCENE_CACHE_ALIGN) % SCENE_CACHE_ALIGN;
+        if (padding > size - offset){
+            return false;
+        }
+        offset += padding;
+        return true;
+    }
+
+    // one bulk copy from the mapping into the array
+    template<typename T>
+    bool get_array(std::vector<T>& values){
+        uint64_t count;
+        if (!get(count) || !align() || count > (size - offset) / sizeof(T)){
+            return false;
+        }
+        const T* first = (const T*) (data + offset);
+        values.assign(first, first + count);
+        offset += count * sizeof(T);
+        return true;
+    }
+
+    bool get_string(std::string& value){
+        uint64_t length;
+        if (!get(length) || length > size - offset){
+            return false;
+        }
+        value.assign(data + offset, length);
+        offset += length;
+        return true;
+    }
+
+    bool get_material(Material& mat){
+        return get(mat.K_a) && get(mat.K_d) && get(mat.K_s) && get(mat.N_s) && get(mat.N_i) && get(mat.d)
+            && get_string(mat.K_Dtex_file);
+    }
+
+    // every corner of faces indexes the meshes arrays
+    static bool faces_valid(const TriangleMesh& mesh, const std::vector<Face>& faces){
+        for (const Face& face: faces){
+            for (int i = 0; i < 9; i += 3){
+                if (face[i] < 1 || (size_t) face[i] > mesh.vertices.size() || face[i + 1] < 1 || (size_t) face[i + 1] > mesh.texcoords.size()
+                    || face[i + 2] < 1 || (size_t) face[i + 2] > mesh.normals.size()){
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // rebuilds the triangles from the faces and reuses the stored nodes instead of building the tree again
+    // a cache that doesn't hold together is treated as stale rather than trusted by traversal
+    bool get_tree(TriangleMesh& mesh, const std::vector<Face>& faces, std::shared_ptr<Observable>& tree){
+        std::vector<BVHNode> nodes;
+        std::vector<int> indices;
+        if (!get_array(nodes) || !get_array(indices) || !faces_valid(mesh, faces) || !BVH::valid_tree(nodes, indices, faces.size())){
+            return false;
+        }
+        tree = std::make_shared<BVH>(mesh.build_triangles(faces), std::move(nodes), std::move(indices));
+        return true;
+    }
+
+    // the meshes written by put_meshes, with their textures loaded through the registry
+    bool get_meshes(BVH& bvh){
+        uint64_t mesh_count;
+        if (!get(mesh_count)){
+            return false;
+        }
+        std::vector<std::shared_ptr<Observable>> meshes;
+        for (uint64_t m = 0; m < mesh_count; m++){
+            std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+            uint64_t lod_count;
+            if (!get_string(mesh->name) || !get_material(mesh->mat) || !get(mesh->object_matrix)
+                || !get(mesh->boundingBox[0]) || !get(mesh->boundingBox[1])
+                || !get_array(mesh->vertices) || !get_array(mesh->normals)
+                || !get_array(mesh->texcoords) || !get_array(mesh->faces)
+                || !get_tree(*mesh, mesh->faces, mesh->tree) || !get(lod_count) || lod_count > LOD_LEVELS){
+                return false;
+            }
+            mesh->lods.resize(lod_count);
+            for (MeshLOD& lod: mesh->lods){
+                if (!get_array(lod.faces) || !get(lod.error) || !faces_valid(*mesh, lod.faces)){
+                    return false;
+                }
+            }
+            mesh->account_memory();
+            meshes.push_back(mesh);
+        }
+        std::vector<BVHNode> nodes;
+        std::vector<int> indices;
+        if (!get_array(nodes) || !get_array(indices) || !BVH::valid_tree(nodes, indices, meshes.size())){
+            return false;
+        }
+
+        // textures go through the registry like any other, their decoded tiles have a cache of their own
+        std::vector<std::string> texture_files;
+        for (std::shared_ptr<Observable>& mesh: meshes){
+            if (mesh->mat.K_Dtex_file != ""){
+                texture_files.push_back(mesh->mat.K_Dtex_file);
+            }
+        }
+        std::vector<std::shared_ptr<Texture>> textures = texture_registry.load_all(texture_files);
+        int t = 0;
+        for (std::shared_ptr<Observable>& mesh: meshes){
+            if (mesh->mat.K_Dtex_file != ""){
+                if (textures[t] == nullptr){
+                    std::cout << "Missing texture: " << texture_files[t] << std::endl;
+                }
+                mesh->mat.K_Dtex = textures[t++];
+            }
+        }
+
+        bvh = BVH(meshes, std::move(nodes), std::move(indices));
+        return true;
+    }
+};
+
+
+// writes the meshes of bvh to the cache of filename, sources are every file they were built from
+// written to a temporary file first so other processes never map a half written cache
+bool save_scene_cache(const std::string& filename, const std::vector<std::string>& sources, BVH& bvh){
+    TRACE_SCOPE("save_scene_cache", filename);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string cache_filename = scene_cache_filename(filename);
+    std::string temp_filename = cache_filename + "." + std::to_string(start.time_since_epoch().count()) + ".tmp";
+    std::filesystem::create_directories(SCENE_CACHE_DIR);
+    std::ofstream file(temp_filename, std::ios::out|std::ios::binary);
+    if (!file.is_open()){
+        std::cerr << "Could not open file " << temp_filename << std::endl;
+        return false;
+    }
+
+    SceneCacheWriter writer = SceneCacheWriter(file);
+    writer.put(SCENE_CACHE_MAGIC);
+    writer.put(SCENE_CACHE_VERSION);
+    writer.put(scene_cache_settings());
+    writer.put((uint64_t) sources.size());
+    for (const std::string& source: sources){
+        uint64_t hash;
+        if (!file_content_hash(source, hash)){
+            hash = 0;
+        }
+        writer.put_string(source);
+        writer.put(hash);
+    }
+
+    bool cacheable = writer.put_meshes(bvh);
+    file.close();
+
+    std::error_code error;
+    if (!cacheable || !file){
+        std::filesystem::remove(temp_filename, error);
+        return false;
+    }
+    std::filesystem::rename(temp_filename, cache_filename, error);
+    if (error){
+        std::filesystem::remove(temp_filename, error);
+        return false;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Scene cache: wrote " << (writer.offset >> 20) << "MB to " << cache_filename << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    return true;
+}
+
+
+// loads the meshes cached for filename into bvh
+// false if there is no cache or any of the files it was built from has changed
+bool load_scene_cache(const std::string& filename, BVH& bvh){
+    TRACE_SCOPE("load_scene_cache", filename);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string cache_filename = scene_cache_filename(filename);
+    MappedFile file;
+    if (!file.open(cache_filename)){
+        return false;
+    }
+    SceneCacheReader reader = SceneCacheReader(file);
+    uint32_t magic, version;
+    uint64_t settings, source_count;
+    if (!reader.get(magic) || !reader.get(version) || !reader.get(settings) || !reader.get(source_count)
+        || magic != SCENE_CACHE_MAGIC || version != SCENE_CACHE_VERSION || settings != scene_cache_settings()){
+        std::cout << "Scene cache: " << cache_filename << " was made by another version, rebuilding" << std::endl;
+        return false;
+    }
+    for (uint64_t i = 0; i < source_count; i++){
+        std::string source;
+        uint64_t cached_hash, hash;
+        if (!reader.get_string(source) || !reader.get(cached_hash)){
+            return false;
+        }
+        if (!file_content_hash(source, hash) || hash != cached_hash){
+            std::cout << "Scene cache: " << source << " has changed, rebuilding" << std::endl;
+            return false;
+        }
+    }
+
+    if (!reader.get_meshes(bvh)){
+        std::cout << "Scene cache: " << cache_filename << " is damaged, rebuilding" << std::endl;
+        return false;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Scene cache: loaded " << bvh.observables.size() << " meshes (" << (file.size >> 20) << "MB) from " << cache_filename << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    return true;
+}
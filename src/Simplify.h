@@ -0,0 +1,278 @@
+#pragma once
+
+#include "Vector.h"
+#include "Face.h"
+#include <vector>
+#include <queue>
+#include <unordered_map>
+
+// weight of the planes added along open edges so borders don't shrink
+const double BOUNDARY_WEIGHT = 10.0;
+
+
+// symmetric 4x4 error quadric (Garland & Heckbert)
+// only the upper triangle is stored
+struct Quadric{
+    double q[10] = {};
+
+    Quadric(){}
+
+    // quadric of the plane ax + by + cz + d = 0
+    Quadric(double a, double b, double c, double d){
+        q[0] = a * a; q[1] = a * b; q[2] = a * c; q[3] = a * d;
+        q[4] = b * b; q[5] = b * c; q[6] = b * d;
+        q[7] = c * c; q[8] = c * d;
+        q[9] = d * d;
+    }
+
+    Quadric& operator+=(const Quadric& other){
+        for (int i = 0; i < 10; i++){
+            q[i] += other.q[i];
+        }
+        return *this;
+    }
+
+    Quadric operator*(double s) const{
+        Quadric result;
+        for (int i = 0; i < 10; i++){
+            result.q[i] = q[i] * s;
+        }
+        return result;
+    }
+
+    // sum of squared distances from p to the accumulated planes
+    double error(const Vector3& p) const{
+        double x = p.x, y = p.y, z = p.z;
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z
+             + q[9];
+    }
+};
+
+
+struct EdgeCollapse{
+    double cost;
+    int keep, remove;
+    // vertex stamps at the time the collapse was queued
+    // used to throw away stale heap entries
+    int keep_stamp, remove_stamp;
+
+    // reversed so the priority queue pops the cheapest collapse
+    bool operator<(const EdgeCollapse& other) const{
+        return cost > other.cost;
+    }
+};
+
+
+// a simplified face list, faces still index the original vertex arrays
+struct SimplifiedLevel{
+    std::vector<Face> faces;
+    float error;
+};
+
+
+// quadric error edge collapse decimation
+// vertices are never moved, a collapse keeps one endpoint of the edge,
+// so every level can share the vertex, normal and texcoord arrays of the full mesh
+struct MeshSimplifier{
+    const std::vector<Vector3>& vertices;
+    std::vector<Face> faces;
+    std::vector<bool> face_alive;
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<int>> vertex_faces;
+    std::vector<int> stamps;
+    std::priority_queue<EdgeCollapse> heap;
+    int alive_faces;
+    double max_cost = 0;
+
+    MeshSimplifier(const std::vector<Vector3>& vertices_, const std::vector<Face>& faces_) : vertices(vertices_){
+        faces = faces_;
+        alive_faces = faces.size();
+        face_alive.resize(faces.size(), true);
+        quadrics.resize(vertices.size());
+        vertex_faces.resize(vertices.size());
+        stamps.resize(vertices.size(), 0);
+
+        // count how many faces use each edge to find the open ones
+        std::unordered_map<unsigned long long, int> edge_count;
+        for (int f = 0; f < (int) faces.size(); f++){
+            for (int k = 0; k < 3; k++){
+                int a = corner(f, k);
+                int b = corner(f, (k + 1) % 3);
+                edge_count[edge_key(a, b)]++;
+            }
+        }
+
+        for (int f = 0; f < (int) faces.size(); f++){
+            int a = corner(f, 0), b = corner(f, 1), c = corner(f, 2);
+            Vector3 n = Vector3::cross(vertices[b] - vertices[a], vertices[c] - vertices[a]);
+            float area = Vector3::length(n);
+            for (int k = 0; k < 3; k++){
+                vertex_faces[corner(f, k)].push_back(f);
+            }
+            if (area == 0){
+                continue;
+            }
+            n = n / area;
+            // planes are unweighted so the error stays a squared distance
+            Quadric plane = Quadric(n.x, n.y, n.z, -Vector3::dot(n, vertices[a]));
+            quadrics[a] += plane;
+            quadrics[b] += plane;
+            quadrics[c] += plane;
+
+            // open edges get a perpendicular plane so the border is kept in place
+            for (int k = 0; k < 3; k++){
+                int e0 = corner(f, k);
+                int e1 = corner(f, (k + 1) % 3);
+                if (edge_count[edge_key(e0, e1)] != 1){
+                    continue;
+                }
+                Vector3 edge = vertices[e1] - vertices[e0];
+                Vector3 bn = Vector3::cross(edge, n);
+                float len = Vector3::length(bn);
+                if (len == 0){
+                    continue;
+                }
+                bn = bn / len;
+                Quadric border = Quadric(bn.x, bn.y, bn.z, -Vector3::dot(bn, vertices[e0])) * BOUNDARY_WEIGHT;
+                quadrics[e0] += border;
+                quadrics[e1] += border;
+            }
+        }
+
+        for (int f = 0; f < (int) faces.size(); f++){
+            for (int k = 0; k < 3; k++){
+                queue_collapse(corner(f, k), corner(f, (k + 1) % 3));
+            }
+        }
+    }
+
+    // 0 based position index of a face corner
+    inline int corner(int f, int k){
+        return faces[f][k * 3] - 1;
+    }
+
+    static unsigned long long edge_key(int a, int b){
+        if (a > b) std::swap(a, b);
+        return ((unsigned long long) a << 32) | (unsigned int) b;
+    }
+
+    void queue_collapse(int a, int b){
+        if (a == b){
+            return;
+        }
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        double cost_a = q.error(vertices[a]);
+        double cost_b = q.error(vertices[b]);
+        if (cost_a <= cost_b){
+            heap.push({cost_a, a, b, stamps[a], stamps[b]});
+        }
+        else{
+            heap.push({cost_b, b, a, stamps[b], stamps[a]});
+        }
+    }
+
+    // would moving remove onto keep fold any of the surrounding faces over
+    bool flips(int keep, int remove){
+        for (int f: vertex_faces[remove]){
+            if (!face_alive[f]){
+                continue;
+            }
+            Vector3 p[3];
+            bool has_keep = false;
+            for (int k = 0; k < 3; k++){
+                int v = corner(f, k);
+                has_keep |= v == keep;
+                p[k] = vertices[v];
+            }
+            // face collapses to a line and is removed
+            if (has_keep){
+                continue;
+            }
+            Vector3 before = Vector3::cross(p[1] - p[0], p[2] - p[0]);
+            for (int k = 0; k < 3; k++){
+                if (corner(f, k) == remove){
+                    p[k] = vertices[keep];
+                }
+            }
+            Vector3 after = Vector3::cross(p[1] - p[0], p[2] - p[0]);
+            if (Vector3::dot(before, after) <= 0.2f * Vector3::length(before) * Vector3::length(after)){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void collapse(int keep, int remove){
+        for (int f: vertex_faces[remove]){
+            if (!face_alive[f]){
+                continue;
+            }
+            bool has_keep = false;
+            for (int k = 0; k < 3; k++){
+                has_keep |= corner(f, k) == keep;
+            }
+            if (has_keep){
+                face_alive[f] = false;
+                alive_faces--;
+                continue;
+            }
+            // only the position index moves, the corner keeps its texcoord and normal
+            for (int k = 0; k < 3; k++){
+                if (corner(f, k) == remove){
+                    faces[f][k * 3] = keep + 1;
+                }
+            }
+            vertex_faces[keep].push_back(f);
+        }
+        vertex_faces[remove].clear();
+        quadrics[keep] += quadrics[remove];
+        stamps[keep]++;
+        stamps[remove]++;
+
+        // drop dead faces and requeue every edge around the kept vertex
+        std::vector<int> kept_faces;
+        for (int f: vertex_faces[keep]){
+            if (face_alive[f]){
+                kept_faces.push_back(f);
+                for (int k = 0; k < 3; k++){
+                    queue_collapse(keep, corner(f, k));
+                }
+            }
+        }
+        vertex_faces[keep] = kept_faces;
+    }
+
+    // collapse edges until target_faces remain or the next collapse would cost more than max_error
+    void run(int target_faces, double max_error){
+        double max_error_sq = max_error * max_error;
+        while (alive_faces > target_faces && !heap.empty()){
+            EdgeCollapse c = heap.top();
+            if (c.cost > max_error_sq){
+                return;
+            }
+            heap.pop();
+            if (c.keep_stamp != stamps[c.keep] || c.remove_stamp != stamps[c.remove]){
+                continue;
+            }
+            if (flips(c.keep, c.remove)){
+                continue;
+            }
+            collapse(c.keep, c.remove);
+            max_cost = fmax(max_cost, c.cost);
+        }
+    }
+
+    SimplifiedLevel snapshot(){
+        SimplifiedLevel level;
+        for (int f = 0; f < (int) faces.size(); f++){
+            if (face_alive[f]){
+                level.faces.push_back(faces[f]);
+            }
+        }
+        level.error = sqrt(max_cost);
+        return level;
+    }
+};
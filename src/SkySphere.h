@@ -6,13 +6,36 @@
 
 
 struct SkySphere {
-    std::shared_ptr<ImageTexture> texture;
+    std::shared_ptr<Texture> texture;
 
-    SkySphere(std::shared_ptr<ImageTexture> texture) : texture(texture) {}
+    SkySphere(std::shared_ptr<Texture> texture) : texture(texture) {}
 
     Vector3 get_colour(Vector3 direction) {
         float u = atan2(direction.x, direction.y) / (2 * M_PI) + 0.5;
         float v = direction.z * 0.5 + 0.5;
         return texture->get_colour(u, v);
     }
+
+    // filtered lookup using the directions of the ray differentials
+    Vector3 get_colour(const Ray& ray) {
+        if (!ray.has_differentials){
+            return get_colour(ray.direction);
+        }
+        float u = atan2(ray.direction.x, ray.direction.y) / (2 * M_PI) + 0.5;
+        float v = ray.direction.z * 0.5 + 0.5;
+        TextureFootprint footprint;
+        footprint.dudx = wrapped_difference(atan2(ray.rx_direction.x, ray.rx_direction.y) / (2 * M_PI) + 0.5, u);
+        footprint.dvdx = ray.rx_direction.z * 0.5 + 0.5 - v;
+        footprint.dudy = wrapped_difference(atan2(ray.rz_direction.x, ray.rz_direction.y) / (2 * M_PI) + 0.5, u);
+        footprint.dvdy = ray.rz_direction.z * 0.5 + 0.5 - v;
+        return texture->get_colour(u, v, footprint);
+    }
+
+    // difference of two u coordinates taking the seam at u = 0 / 1 into account
+    static float wrapped_difference(float a, float b){
+        float d = a - b;
+        if (d > 0.5f) d -= 1;
+        if (d < -0.5f) d += 1;
+        return d;
+    }
 };
\ No newline at end of file
@@ -1,14 +1,52 @@
 #pragma once
 
 #include "QOI.h"
+#include "MemoryAccounting.h"
 #include <vector>
+#include <algorithm>
+#include <chrono>
+
+
+// screen space derivatives of the texture coordinates
+// all zero when the ray carried no differentials
+struct TextureFootprint{
+    float dudx = 0;
+    float dvdx = 0;
+    float dudy = 0;
+    float dvdy = 0;
+};
 
 
 struct Texture{
     bool implemented = false;
     virtual Vector3 get_colour(float u, float v)=0;
+    // filtered lookup, textures without filtering ignore the footprint
+    virtual Vector3 get_colour(float u, float v, const TextureFootprint&){
+        return get_colour(u, v);
+    }
+    // bytes of decoded texel data the texture holds
+    virtual size_t memory_bytes(){
+        return 0;
+    }
+    // bytes a full decoded copy of the texture would take, whatever of it is held right now
+    virtual size_t decoded_bytes(){
+        return 0;
+    }
 };
 
+// RGBA8 texels of a width x height image and every mip level below it
+inline size_t mip_chain_bytes(int width, int height){
+    size_t bytes = 0;
+    while (true){
+        bytes += (size_t) width * height * sizeof(uint32_t);
+        if (width == 1 && height == 1){
+            return bytes;
+        }
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+}
+
 struct DefaultTexture : public Texture{
     DefaultTexture(){
         implemented = false;
@@ -18,29 +56,201 @@ struct DefaultTexture : public Texture{
     }
 };
 
+// converts a channel byte to a float colour, texels are stored as bytes
+// and only turned into floats when they are sampled
+struct ByteToFloat{
+    float values[256];
+
+    ByteToFloat(){
+        for (int i = 0; i < 256; i++){
+            values[i] = i / 255.0f;
+        }
+    }
+};
+const ByteToFloat BYTE_TO_FLOAT;
+
+inline Vector3 unpack_rgba8(uint32_t texel){
+    return Vector3(BYTE_TO_FLOAT.values[texel & 0xff], BYTE_TO_FLOAT.values[(texel >> 8) & 0xff], BYTE_TO_FLOAT.values[(texel >> 16) & 0xff]);
+}
+
+
+// texels are RGBA8 laid out in 8x8 tiles with morton order inside each tile
+// a 4x4 block of texels fills one 64 byte cache line, so the lookups of a
+// bilinear sample and of neighbouring pixels mostly hit the same lines
+struct MipLevel{
+    int width;
+    int height;
+    int tiles_x;
+    std::vector<uint32_t> texels;
+    MemoryCharge memory = MemoryCharge(MEMORY_TEXTURES);
+
+    MipLevel(int w, int h){
+        width = w;
+        height = h;
+        tiles_x = (w + 7) / 8;
+        int tiles_y = (h + 7) / 8;
+        memory.set((size_t) tiles_x * tiles_y * 64 * sizeof(uint32_t));
+        texels.resize(tiles_x * tiles_y * 64);
+    }
+
+    // interleave the low 3 bits of x and y
+    static inline int morton(int x, int y){
+        return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+    }
+
+    inline int index(int x, int y) const{
+        int tile = (y >> 3) * tiles_x + (x >> 3);
+        return (tile << 6) | morton(x & 7, y & 7);
+    }
+
+    inline uint32_t get(int x, int y) const{
+        return texels[index(x, y)];
+    }
+
+    inline void set(int x, int y, uint32_t texel){
+        texels[index(x, y)] = texel;
+    }
+};
+
+// texture coordinates wrap around
+inline int wrap_texel(int x, int size){
+    x %= size;
+    return (x < 0) ? x + size : x;
+}
+
+// bilinear lookup in a width x height level
+// fetch(x, y) returns the RGBA8 texel at already wrapped coordinates
+template<typename Fetch>
+inline Vector3 bilinear_filter(int width, int height, float u, float v, const Fetch& fetch){
+    // image is flipped in vertically
+    float fx = u * width - 0.5f;
+    float fy = (1 - v) * height - 0.5f;
+    int x = (int)floorf(fx);
+    int y = (int)floorf(fy);
+    float tx = fx - x;
+    float ty = fy - y;
+    int x0 = wrap_texel(x, width), x1 = wrap_texel(x + 1, width);
+    int y0 = wrap_texel(y, height), y1 = wrap_texel(y + 1, height);
+    Vector3 top = unpack_rgba8(fetch(x0, y0)) * (1 - tx) + unpack_rgba8(fetch(x1, y0)) * tx;
+    Vector3 bottom = unpack_rgba8(fetch(x0, y1)) * (1 - tx) + unpack_rgba8(fetch(x1, y1)) * tx;
+    return top * (1 - ty) + bottom * ty;
+}
+
+// fractional mip level from the longest side of the footprint in texels
+// anything at or below 0 means the full resolution image
+inline float footprint_level(const TextureFootprint& footprint, int width, int height){
+    float len_x = sqrtf(footprint.dudx * footprint.dudx * width * width + footprint.dvdx * footprint.dvdx * height * height);
+    float len_y = sqrtf(footprint.dudy * footprint.dudy * width * width + footprint.dvdy * footprint.dvdy * height * height);
+    float len = fmax(len_x, len_y);
+    return (len <= 1) ? 0 : log2f(len);
+}
+
+// blend the two levels around lod, bilinear(l) samples level l
+template<typename Bilinear>
+inline Vector3 trilinear_filter(float lod, int level_count, const Bilinear& bilinear){
+    if (lod <= 0){
+        return bilinear(0);
+    }
+    int last = level_count - 1;
+    if (lod >= last){
+        return bilinear(last);
+    }
+    int l = (int)lod;
+    float t = lod - l;
+    return bilinear(l) * (1 - t) + bilinear(l + 1) * t;
+}
+
 struct ImageTexture : public Texture{
     int width;
     int height;
-    std::vector<Vector3> pixels;
+    // levels[0] is the full image, each level after is half the size of the last
+    std::vector<MipLevel> levels;
 
     ImageTexture(std::string filename){
+        TRACE_SCOPE("ImageTexture", filename);
         implemented = true;
         std::ifstream input(filename, std::ios::in|std::ios::binary);
         if(!input.is_open()){
             std::cerr << "Could not open file " << filename << std::endl;
             throw std::runtime_error("Could not open file");
         }
+        auto start = std::chrono::high_resolution_clock::now();
         QOIReader qoi = QOIReader(input);
+        if (!qoi.valid || qoi.width == 0 || qoi.height == 0){
+            throw std::runtime_error("Invalid QOI file " + filename);
+        }
         width = qoi.width;
         height = qoi.height;
+        // the scanlines are held until they are reordered into the first level
+        MemoryCharge pixel_memory = MemoryCharge(MEMORY_TEXTURES, (size_t) width * height * sizeof(uint32_t));
+        std::vector<uint32_t> pixels;
         qoi.read_all(pixels);
         input.close();
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << "Decoded " << filename << " (" << width << "x" << height << ") at "
+                  << (qoi.end_offset / 1e6) / fmax(seconds, 1e-9) << "MB/s of file" << std::endl;
+
+        // reorder the scanlines into tiles
+        MipLevel base = MipLevel(width, height);
+        for (int y = 0; y < height; y++){
+            for (int x = 0; x < width; x++){
+                base.set(x, y, pixels[y * width + x]);
+            }
+        }
+        levels.push_back(std::move(base));
+        build_mips();
+    }
+
+    // box filter each level down into the next until it is a single texel
+    void build_mips(){
+        TRACE_SCOPE("ImageTexture::build_mips");
+        while (levels.back().width > 1 || levels.back().height > 1){
+            const MipLevel& prev = levels.back();
+            MipLevel next = MipLevel(std::max(1, prev.width / 2), std::max(1, prev.height / 2));
+            for (int y = 0; y < next.height; y++){
+                int y0 = std::min(y * 2, prev.height - 1);
+                int y1 = std::min(y * 2 + 1, prev.height - 1);
+                for (int x = 0; x < next.width; x++){
+                    int x0 = std::min(x * 2, prev.width - 1);
+                    int x1 = std::min(x * 2 + 1, prev.width - 1);
+                    uint32_t a = prev.get(x0, y0), b = prev.get(x1, y0), c = prev.get(x0, y1), d = prev.get(x1, y1);
+                    uint32_t texel = 0;
+                    // average each channel, rounding to nearest
+                    for (int shift = 0; shift < 32; shift += 8){
+                        uint32_t sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) + ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+                        texel |= ((sum + 2) >> 2) << shift;
+                    }
+                    next.set(x, y, texel);
+                }
+            }
+            levels.push_back(std::move(next));
+        }
+    }
+
+    Vector3 bilinear(int l, float u, float v){
+        const MipLevel& level = levels[l];
+        return bilinear_filter(level.width, level.height, u, v, [&](int x, int y){return level.get(x, y);});
     }
 
     Vector3 get_colour(float u, float v){
-        int x = (int)(u * width);
-        // image is flipped in vertically
-        int y = (int)((1-v) * height);
-        return pixels.at(y * width + x);
+        return bilinear(0, u, v);
+    }
+
+    size_t memory_bytes(){
+        size_t bytes = 0;
+        for (const MipLevel& level: levels){
+            bytes += level.texels.size() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    size_t decoded_bytes(){
+        return mip_chain_bytes(width, height);
+    }
+
+    Vector3 get_colour(float u, float v, const TextureFootprint& footprint){
+        float lod = footprint_level(footprint, width, height);
+        return trilinear_filter(lod, levels.size(), [&](int l){return bilinear(l, u, v);});
     }
 };
\ No newline at end of file
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "Texture.h"
+#include "MappedFile.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// map_Kd textures go through the tile cache instead of being decoded at load time
+#define USE_TEXTURE_CACHE 1
+// when on, tile files are mapped and sampled in place, the OS pages them in and out instead of the LRU
+// and processes rendering with the same textures share the pages
+// off by default because mapped tiles are not held to TEXTURE_CACHE_BUDGET, tiles are then read
+// into each processes LRU and nothing is shared
+#define MAP_TEXTURE_TILES 0
+
+// textures are converted to tile files in this directory the first time they are sampled
+std::string TEXTURE_CACHE_DIR = "texture_cache/";
+// bytes of decoded tiles kept in memory
+unsigned long long TEXTURE_CACHE_BUDGET = 256ull << 20;
+
+// tiles are 32x32 texels, 4KB of RGBA8
+const int TEXTURE_TILE_SHIFT = 5;
+const int TEXTURE_TILE_SIZE = 1 << TEXTURE_TILE_SHIFT;
+const int TEXTURE_TILE_TEXELS = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+const uint32_t TEXTURE_TILE_MAGIC = 0x54544558;
+const uint32_t TEXTURE_TILE_VERSION = 1;
+const int TEXTURE_CACHE_SHARDS = 16;
+
+
+struct TextureTile{
+    uint32_t texels[TEXTURE_TILE_TEXELS];
+
+    // same tiled morton layout as MipLevel, 4x4 sub tiles of 8x8 texels
+    static inline int index(int x, int y){
+        int sub_tile = (y >> 3) * (TEXTURE_TILE_SIZE / 8) + (x >> 3);
+        return (sub_tile << 6) | MipLevel::morton(x & 7, y & 7);
+    }
+};
+
+
+// layout of one mip level inside a tile file
+struct TiledLevel{
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    // index of the levels first tile in the file
+    uint64_t first_tile;
+};
+
+
+struct CachedTexture;
+
+// process wide LRU cache of texture tiles, thread safe
+// the key space is split into shards so lookups from different threads rarely share a lock
+struct TextureCache{
+    struct Entry{
+        std::shared_ptr<TextureTile> tile;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    struct Shard{
+        std::mutex lock;
+        std::unordered_map<uint64_t, Entry> tiles;
+        // most recently used at the front
+        std::list<uint64_t> lru;
+        unsigned long long bytes = 0;
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+        unsigned long long evictions = 0;
+    };
+
+    Shard shards[TEXTURE_CACHE_SHARDS];
+    unsigned long long budget; // 0 follows TEXTURE_CACHE_BUDGET
+    std::atomic<uint32_t> next_id{0};
+    std::atomic<unsigned long long> bytes_read{0};
+
+    TextureCache(unsigned long long budget_ = 0) : budget(budget_){}
+
+    unsigned long long current_budget(){
+        return (budget > 0) ? budget : TEXTURE_CACHE_BUDGET;
+    }
+
+    uint32_t register_texture(){
+        return next_id++;
+    }
+
+    // the tile stays valid until the calling thread asks for another one
+    inline const TextureTile* get(CachedTexture& texture, int level, uint64_t tile);
+
+    void report(){
+        unsigned long long hits = 0, misses = 0, evictions = 0, bytes = 0;
+        for (Shard& shard: shards){
+            std::lock_guard<std::mutex> guard(shard.lock);
+            hits += shard.hits;
+            misses += shard.misses;
+            evictions += shard.evictions;
+            bytes += shard.bytes;
+        }
+        unsigned long long lookups = hits + misses;
+        if (lookups == 0){
+            return;
+        }
+        std::cout << "Texture cache: " << hits << " hits, " << misses << " misses ("
+                  << (100.0 * hits) / lookups << "% hit rate), " << evictions << " evictions" << std::endl;
+        std::cout << "Texture cache: " << (bytes >> 20) << "MB resident of " << (current_budget() >> 20) << "MB budget, "
+                  << (bytes_read >> 20) << "MB read from disk" << std::endl;
+    }
+};
+
+TextureCache texture_cache;
+
+
+// a texture whose mip levels live on disk as tiles and are paged in through the cache
+// only the QOI header is read up front, the tile file is written on the first lookup
+struct CachedTexture : public Texture{
+    std::string filename;
+    std::string tile_filename;
+    int width;
+    int height;
+    std::vector<TiledLevel> levels;
+    TextureCache& cache;
+    uint32_t id;
+
+    std::once_flag converted;
+    std::mutex file_lock;
+    std::ifstream tile_file;
+    MappedFile tile_map;
+    // first tile of the mapping, null until the tile file is mapped
+    std::atomic<const TextureTile*> mapped_tiles{nullptr};
+
+    CachedTexture(std::string filename_, TextureCache& cache_ = texture_cache) : filename(filename_), cache(cache_){
+        implemented = true;
+        std::ifstream input(filename, std::ios::in|std::ios::binary);
+        if(!input.is_open()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            throw std::runtime_error("Could not open file");
+        }
+        QOIHeader header;
+        if (!header.read(input) || header.width == 0 || header.height == 0){
+            throw std::runtime_error("Invalid QOI file " + filename);
+        }
+        width = header.width;
+        height = header.height;
+        input.close();
+        id = cache.register_texture();
+
+        // same chain of sizes as ImageTexture::build_mips
+        int w = width, h = height;
+        uint64_t first_tile = 0;
+        while (true){
+            TiledLevel level;
+            level.width = w;
+            level.height = h;
+            level.tiles_x = (w + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+            level.tiles_y = (h + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+            level.first_tile = first_tile;
+            first_tile += level.tiles_x * level.tiles_y;
+            levels.push_back(level);
+            if (w == 1 && h == 1){
+                break;
+            }
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+
+        // tile files are named after the source path
+        std::filesystem::path source = std::filesystem::absolute(filename);
+        tile_filename = TEXTURE_CACHE_DIR + std::to_string(std::hash<std::string>()(source.string())) + ".tiles";
+    }
+
+    // size and modification time of the source, a tile file made from anything else is stale
+    void source_stamp(uint64_t& size, uint64_t& time){
+        size = std::filesystem::file_size(filename);
+        time = std::filesystem::last_write_time(filename).time_since_epoch().count();
+    }
+
+    uint64_t header_size(){
+        return 6 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    }
+
+    bool tile_file_valid(){
+        std::ifstream file(tile_filename, std::ios::in|std::ios::binary);
+        if (!file.is_open()){
+            return false;
+        }
+        uint32_t header[6];
+        uint64_t stamp[2];
+        file.read((char*) header, sizeof(header));
+        file.read((char*) stamp, sizeof(stamp));
+        uint64_t size, time;
+        source_stamp(size, time);
+        std::error_code error;
+        uint64_t file_size = std::filesystem::file_size(tile_filename, error);
+        return file && !error && file_size == header_size() + memory_bytes() && header[0] == TEXTURE_TILE_MAGIC && header[1] == TEXTURE_TILE_VERSION
+            && header[2] == (uint32_t) width && header[3] == (uint32_t) height && header[4] == (uint32_t) levels.size() && header[5] == TEXTURE_TILE_SIZE
+            && stamp[0] == size && stamp[1] == time;
+    }
+
+    // decode the QOI, build the mips and write every level out as tiles
+    // written to a temporary file first so a crash or another process never leaves a half written file behind
+    void write_tile_file(){
+        std::cout << "Tiling texture: " << filename << std::endl;
+        ImageTexture image = ImageTexture(filename);
+        std::filesystem::create_directories(TEXTURE_CACHE_DIR);
+        std::string temp_filename = tile_filename + "." + std::to_string(std::chrono::high_resolution_clock::now().time_since_epoch().count()) + ".tmp";
+        std::ofstream file(temp_filename, std::ios::out|std::ios::binary);
+        if (!file.is_open()){
+            std::cerr << "Could not open file " << temp_filename << std::endl;
+            return;
+        }
+        uint32_t header[6] = {TEXTURE_TILE_MAGIC, TEXTURE_TILE_VERSION, (uint32_t) width, (uint32_t) height, (uint32_t) levels.size(), (uint32_t) TEXTURE_TILE_SIZE};
+        uint64_t stamp[2];
+        source_stamp(stamp[0], stamp[1]);
+        file.write((const char*) header, sizeof(header));
+        file.write((const char*) stamp, sizeof(stamp));
+
+        TextureTile tile;
+        for (int l = 0; l < (int) levels.size(); l++){
+            const MipLevel& mip = image.levels[l];
+            TiledLevel& level = levels[l];
+            for (int ty = 0; ty < level.tiles_y; ty++){
+                for (int tx = 0; tx < level.tiles_x; tx++){
+                    for (int y = 0; y < TEXTURE_TILE_SIZE; y++){
+                        for (int x = 0; x < TEXTURE_TILE_SIZE; x++){
+                            int ix = std::min(tx * TEXTURE_TILE_SIZE + x, level.width - 1);
+                            int iy = std::min(ty * TEXTURE_TILE_SIZE + y, level.height - 1);
+                            tile.texels[TextureTile::index(x, y)] = mip.get(ix, iy);
+                        }
+                    }
+                    file.write((const char*) tile.texels, sizeof(tile.texels));
+                }
+            }
+        }
+        file.close();
+
+        std::error_code error;
+        if (!file){
+            std::cerr << "Could not write file " << temp_filename << std::endl;
+            std::filesystem::remove(temp_filename, error);
+            return;
+        }
+        std::filesystem::rename(temp_filename, tile_filename, error);
+        if (error){
+            std::filesystem::remove(temp_filename, error);
+        }
+    }
+
+    // make sure the tile file is up to date and open it, once
+    void open_tile_file(){
+        std::call_once(converted, [&](){
+            if (!tile_file_valid()){
+                write_tile_file();
+            }
+#if MAP_TEXTURE_TILES
+            // falls back to reading through the cache if the file can't be mapped
+            if (tile_map.open(tile_filename, false) && tile_map.size >= memory_bytes() + header_size()){
+                mapped_tiles = (const TextureTile*) (tile_map.data + header_size());
+                return;
+            }
+#endif
+            tile_file.open(tile_filename, std::ios::in|std::ios::binary);
+        });
+    }
+
+    std::shared_ptr<TextureTile> read_tile(int level, uint64_t tile){
+        open_tile_file();
+        std::shared_ptr<TextureTile> result = std::make_shared<TextureTile>();
+        std::lock_guard<std::mutex> guard(file_lock);
+        tile_file.seekg(header_size() + (levels[level].first_tile + tile) * sizeof(TextureTile::texels));
+        tile_file.read((char*) result->texels, sizeof(result->texels));
+        return result;
+    }
+
+    inline uint32_t fetch(int l, int x, int y){
+        const TiledLevel& level = levels[l];
+        uint64_t tile = (y >> TEXTURE_TILE_SHIFT) * level.tiles_x + (x >> TEXTURE_TILE_SHIFT);
+        int texel = TextureTile::index(x & (TEXTURE_TILE_SIZE - 1), y & (TEXTURE_TILE_SIZE - 1));
+#if MAP_TEXTURE_TILES
+        const TextureTile* tiles = mapped_tiles.load(std::memory_order_acquire);
+        if (tiles == nullptr){
+            open_tile_file();
+            tiles = mapped_tiles.load(std::memory_order_acquire);
+        }
+        if (tiles != nullptr){
+            return tiles[level.first_tile + tile].texels[texel];
+        }
+#endif
+        const TextureTile* t = cache.get(*this, l, tile);
+        return t->texels[texel];
+    }
+
+    Vector3 bilinear(int l, float u, float v){
+        const TiledLevel& level = levels[l];
+        return bilinear_filter(level.width, level.height, u, v, [&](int x, int y){return fetch(l, x, y);});
+    }
+
+    Vector3 get_colour(float u, float v){
+        return bilinear(0, u, v);
+    }
+
+    // what the texture can take up in the cache once every tile is resident
+    size_t memory_bytes(){
+        const TiledLevel& last = levels.back();
+        return (last.first_tile + last.tiles_x * last.tiles_y) * sizeof(TextureTile);
+    }
+
+    size_t decoded_bytes(){
+        return mip_chain_bytes(width, height);
+    }
+
+    Vector3 get_colour(float u, float v, const TextureFootprint& footprint){
+        float lod = footprint_level(footprint, width, height);
+        return trilinear_filter(lod, levels.size(), [&](int l){return bilinear(l, u, v);});
+    }
+};
+
+
+inline const TextureTile* TextureCache::get(CachedTexture& texture, int level, uint64_t tile){
+    // bilinear lookups mostly stay inside one tile, so remember the last one per thread
+    // the shared pointer keeps it alive even if the cache evicts it meanwhile, and lookups
+    // hand out a plain pointer to it so the reference count is only touched when the tile changes
+    thread_local uint64_t last_key = ~0ull;
+    thread_local std::shared_ptr<TextureTile> last_tile;
+
+    uint64_t key = ((uint64_t) texture.id << 40) | ((uint64_t) level << 32) | tile;
+    if (key == last_key){
+        return last_tile.get();
+    }
+
+    Shard& shard = shards[std::hash<uint64_t>()(key) % TEXTURE_CACHE_SHARDS];
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.tiles.find(key);
+        if (it != shard.tiles.end()){
+            shard.hits++;
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+            last_key = key;
+            last_tile = it->second.tile;
+            return last_tile.get();
+        }
+        shard.misses++;
+    }
+
+    // read outside the shard lock so other lookups aren't held up by the disk
+    std::shared_ptr<TextureTile> loaded = texture.read_tile(level, tile);
+    bytes_read += sizeof(TextureTile);
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto it = shard.tiles.find(key);
+    // another thread loaded the same tile first
+    if (it != shard.tiles.end()){
+        loaded = it->second.tile;
+    }
+    else{
+        unsigned long long shard_budget = current_budget() / TEXTURE_CACHE_SHARDS;
+        while (!shard.lru.empty() && shard.bytes + sizeof(TextureTile) > shard_budget){
+            shard.tiles.erase(shard.lru.back());
+            shard.lru.pop_back();
+            shard.bytes -= sizeof(TextureTile);
+            memory_accounting.add(MEMORY_TEXTURES, -(long long) sizeof(TextureTile));
+            shard.evictions++;
+        }
+        memory_accounting.add(MEMORY_TEXTURES, sizeof(TextureTile));
+        shard.lru.push_front(key);
+        shard.tiles[key] = {loaded, shard.lru.begin()};
+        shard.bytes += sizeof(TextureTile);
+    }
+    last_key = key;
+    last_tile = std::move(loaded);
+    return last_tile.get();
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "TextureCache.h"
+#include <future>
+#include <map>
+#include <thread>
+
+
+// process wide registry so every distinct texture file is loaded exactly once
+// textures are looked up by canonical path first, then by the file size and a hash of its first block,
+// only files that agree on those are hashed in full, so copies of the same image under different
+// names are shared without reading every texture at load time
+struct TextureRegistry{
+    // a file loaded under a quick key, its full hash is only worked out when another file has the same key
+    struct Candidate{
+        std::string filename;
+        std::shared_future<std::shared_ptr<Texture>> texture;
+        std::once_flag hashed;
+        uint64_t hash = 0;
+
+        uint64_t content(){
+            std::call_once(hashed, [&](){hash = content_hash(filename);});
+            return hash;
+        }
+    };
+
+    std::mutex lock;
+    std::map<std::string, std::shared_future<std::shared_ptr<Texture>>> by_path;
+    std::map<uint64_t, std::vector<std::shared_ptr<Candidate>>> by_key;
+    unsigned long long requests = 0;
+    unsigned long long loads = 0;
+    unsigned long long bytes_saved = 0;
+
+    static void fnv(uint64_t& hash, const char* data, std::streamsize count){
+        for (std::streamsize i = 0; i < count; i++){
+            hash ^= (unsigned char) data[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+
+    static std::ifstream open(const std::string& filename){
+        std::ifstream file(filename, std::ios::in|std::ios::binary);
+        if (!file.is_open()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            throw std::runtime_error("Could not open file");
+        }
+        return file;
+    }
+
+    // size of the file and FNV-1a of its first 4KB, which covers the header of any image format
+    static uint64_t quick_key(const std::string& filename){
+        std::ifstream file = open(filename);
+        file.seekg(0, std::ios::end);
+        uint64_t hash = 0xcbf29ce484222325ull ^ (uint64_t) file.tellg();
+        file.seekg(0);
+        char block[4096];
+        file.read(block, sizeof(block));
+        fnv(hash, block, file.gcount());
+        return hash;
+    }
+
+    // FNV-1a of the whole file, read in blocks so large files aren't held in memory
+    static uint64_t content_hash(const std::string& filename){
+        std::ifstream file = open(filename);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        std::vector<char> block(1 << 20);
+        while (file){
+            file.read(block.data(), block.size());
+            fnv(hash, block.data(), file.gcount());
+        }
+        return hash;
+    }
+
+    static std::shared_ptr<Texture> load(const std::string& filename){
+#if USE_TEXTURE_CACHE
+        return std::make_shared<CachedTexture>(filename);
+#else
+        return std::make_shared<ImageTexture>(filename);
+#endif
+    }
+
+    std::shared_ptr<Texture> shared(std::shared_future<std::shared_ptr<Texture>> future){
+        std::shared_ptr<Texture> texture = future.get();
+        std::lock_guard<std::mutex> guard(lock);
+        // a second decoded copy is what sharing saves, whether or not the texture keeps its tiles resident
+        bytes_saved += texture->decoded_bytes();
+        return texture;
+    }
+
+    // a texture with the same contents as the file of self among the files loaded under its quick key,
+    // or an invalid future after adding self as a new candidate to be loaded
+    std::shared_future<std::shared_ptr<Texture>> find_or_add(uint64_t key, std::shared_ptr<Candidate> self){
+        size_t checked = 0;
+        while (true){
+            std::vector<std::shared_ptr<Candidate>> others;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                std::vector<std::shared_ptr<Candidate>>& candidates = by_key[key];
+                if (checked == candidates.size()){
+                    candidates.push_back(self);
+                    return std::shared_future<std::shared_ptr<Texture>>();
+                }
+                others.assign(candidates.begin() + checked, candidates.end());
+            }
+            // hashed outside the lock, the first time a file meets another with the same key
+            for (std::shared_ptr<Candidate>& other: others){
+                if (other->content() == self->content()){
+                    return other->texture;
+                }
+            }
+            checked += others.size();
+        }
+    }
+
+    // returns the shared texture for filename, loading it if no one has yet
+    // throws std::runtime_error if the file can't be read
+    std::shared_ptr<Texture> get(const std::string& filename){
+        std::string path = std::filesystem::weakly_canonical(filename).string();
+        std::promise<std::shared_ptr<Texture>> path_promise;
+        std::shared_future<std::shared_ptr<Texture>> loaded;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            requests++;
+            auto it = by_path.find(path);
+            if (it != by_path.end()){
+                loaded = it->second;
+            }
+            else{
+                by_path[path] = path_promise.get_future().share();
+            }
+        }
+        if (loaded.valid()){
+            return shared(loaded);
+        }
+
+        try{
+            uint64_t key = quick_key(filename);
+            std::promise<std::shared_ptr<Texture>> load_promise;
+            std::shared_ptr<Candidate> self = std::make_shared<Candidate>();
+            self->filename = filename;
+            self->texture = load_promise.get_future().share();
+            std::shared_future<std::shared_ptr<Texture>> existing = find_or_add(key, self);
+            if (existing.valid()){
+                std::shared_ptr<Texture> texture = shared(existing);
+                path_promise.set_value(texture);
+                return texture;
+            }
+            try{
+                std::shared_ptr<Texture> texture = load(filename);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    loads++;
+                }
+                load_promise.set_value(texture);
+                path_promise.set_value(texture);
+                return texture;
+            }
+            catch(...){
+                load_promise.set_exception(std::current_exception());
+                throw;
+            }
+        }
+        catch(...){
+            path_promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    // load a batch of textures on several threads
+    // files that fail to load come back as nullptr, going over the memory budget stops the batch and is rethrown
+    std::vector<std::shared_ptr<Texture>> load_all(const std::vector<std::string>& filenames){
+        std::vector<std::shared_ptr<Texture>> textures(filenames.size());
+        std::atomic<int> next{0};
+        std::exception_ptr over_budget;
+        std::mutex over_budget_lock;
+        auto worker = [&](){
+            trace_thread_name("texture loader");
+            for (int i = next++; i < (int) filenames.size(); i = next++){
+                try{
+                    textures[i] = get(filenames[i]);
+                }
+                catch(MemoryBudgetExceeded& e){
+                    std::lock_guard<std::mutex> guard(over_budget_lock);
+                    if (!over_budget){
+                        over_budget = std::current_exception();
+                    }
+                    next = (int) filenames.size();
+                }
+                catch(std::runtime_error& e){}
+            }
+        };
+        int thread_count = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), filenames.size());
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_count; i++){
+            threads.emplace_back(worker);
+        }
+        for (std::thread& thread: threads){
+            thread.join();
+        }
+        if (over_budget){
+            std::rethrow_exception(over_budget);
+        }
+        return textures;
+    }
+
+    void report(){
+        std::lock_guard<std::mutex> guard(lock);
+        if (requests == 0){
+            return;
+        }
+        std::cout << "Texture registry: " << requests << " requests, " << loads << " textures loaded, "
+                  << (bytes_saved >> 20) << "MB saved by sharing" << std::endl;
+    }
+};
+
+TextureRegistry texture_registry;
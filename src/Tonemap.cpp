@@ -0,0 +1,80 @@
+// regrades a linear PFM saved by the renderer into a QOI or PNG without re-rendering
+// the output is a PNG when its name ends in .png, otherwise QOI
+// usage: tonemap input.pfm output.qoi [-exposure stops] [-gamma g] [-linear] [-a a] [-b b]
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include "ImageOutput.h"
+#include "PFM.h"
+#include "Tonemap.h"
+
+// scanlines converted at a time, bounds memory for very large images
+const int TONEMAP_BAND_ROWS = 256;
+
+
+int main(int argc, char** argv){
+    if (argc < 3){
+        std::cerr << "usage: tonemap input.pfm output.qoi [-exposure stops] [-gamma g] [-linear] [-a a] [-b b]" << std::endl;
+        return 1;
+    }
+    TonemapSettings settings;
+    for (int i = 3; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "-linear"){
+            settings.filmic = false;
+        }
+        else if (i + 1 < argc && arg == "-exposure"){
+            settings.exposure = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "-gamma"){
+            settings.gamma = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "-a"){
+            settings.a = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "-b"){
+            settings.b = atof(argv[++i]);
+        }
+        else{
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    PFMReader input = PFMReader(argv[1]);
+    int width = input.width;
+    int height = input.height;
+    std::ofstream output(argv[2], std::ios::out|std::ios::binary);
+    std::unique_ptr<ImageWriter> image = open_image_writer(output, argv[2], width, height);
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<float> linear((size_t) TONEMAP_BAND_ROWS * width * 3);
+    std::vector<uint8_t> display(linear.size());
+    for (int z0 = 0; z0 < height; z0 += TONEMAP_BAND_ROWS){
+        int rows = std::min(TONEMAP_BAND_ROWS, height - z0);
+        input.read_rows(z0, linear.data(), rows);
+
+        // split the band into one run of rows per thread
+        std::vector<std::thread> workers;
+        int rows_per_thread = (rows + threads - 1) / threads;
+        for (int r = 0; r < rows; r += rows_per_thread){
+            size_t first = (size_t) r * width * 3;
+            size_t count = (size_t) std::min(rows_per_thread, rows - r) * width * 3;
+            workers.emplace_back([&, first, count](){
+                tonemap_to_bytes(&linear[first], &display[first], count, settings);
+            });
+        }
+        for (std::thread& thread: workers){
+            thread.join();
+        }
+        image->write_rgb8(display.data(), (size_t) rows * width);
+    }
+    image->finish();
+    output.close();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Tonemapped " << width << "x" << height << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    return 0;
+}
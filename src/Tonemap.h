@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+
+// settings for turning linear radiance into display bytes
+struct TonemapSettings{
+    // in stops, each one doubles the brightness
+    float exposure = 0;
+    float gamma = 2.2;
+    // shoulder of the curve, filmic = false leaves colours linear apart from gamma
+    bool filmic = true;
+    float a = 2;
+    float b = 1.3;
+};
+
+
+// filmic curve x^b / (x^b + (0.5/a)^b) followed by gamma
+inline float tonemap_channel(float c, float a, float b, float inv_gamma){
+    float powered = powf(c, b);
+    float display = powered / (powered + powf(0.5f / a, b));
+    return powf(display, inv_gamma);
+}
+
+
+// tonemap count floats into 0-255 bytes
+// kept as plain loops over flat arrays so the compiler can vectorize them
+inline void tonemap_to_bytes(const float* in, uint8_t* out, size_t count, const TonemapSettings& settings){
+    float scale = exp2f(settings.exposure);
+    float inv_gamma = 1.0f / settings.gamma;
+    float a = settings.a;
+    float b = settings.b;
+    if (settings.filmic){
+        for (size_t i = 0; i < count; i++){
+            float c = tonemap_channel(fmaxf(in[i] * scale, 0), a, b, inv_gamma);
+            out[i] = fmaxf(0, fminf(floorf(c * 255), 255));
+        }
+    }
+    else{
+        for (size_t i = 0; i < count; i++){
+            float c = powf(fmaxf(in[i] * scale, 0), inv_gamma);
+            out[i] = fmaxf(0, fminf(floorf(c * 255), 255));
+        }
+    }
+}
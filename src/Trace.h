@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Json.h"
+
+// when set, timed scopes are recorded and written here as Chrome trace event JSON when the program exits
+// load the file in chrome://tracing or ui.perfetto.dev to see every thread on its own track
+std::string TRACE_OUTPUT = "";
+
+
+struct TraceEvent{
+    const char* name;
+    // the file or object the scope worked on, may be empty
+    std::string detail;
+    double start_us;
+    double duration_us;
+};
+
+// the events of one thread, only ever touched by that thread until it exits
+struct ThreadTrace{
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+
+    ThreadTrace();
+    ~ThreadTrace();
+};
+
+struct TraceRecorder{
+    std::mutex lock;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    // globals are constructed on the main thread
+    std::thread::id main_thread = std::this_thread::get_id();
+    int next_tid = 0;
+    std::vector<ThreadTrace*> threads;
+    // what threads that have exited recorded, by thread id
+    std::map<int, std::string> retired_names;
+    std::vector<std::pair<int, TraceEvent>> retired;
+
+    double now_us(){
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    int add_thread(ThreadTrace* thread){
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(thread);
+        return next_tid++;
+    }
+
+    void remove_thread(ThreadTrace* thread){
+        std::lock_guard<std::mutex> guard(lock);
+        retired_names[thread->tid] = thread->name;
+        for (TraceEvent& event: thread->events){
+            retired.push_back({thread->tid, std::move(event)});
+        }
+        threads.erase(std::find(threads.begin(), threads.end(), thread));
+    }
+
+    static void write_event(std::ofstream& file, int tid, const TraceEvent& event, bool& first){
+        file << (first ? "\n" : ",\n") << "{\"name\": " << json_quote(event.name) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+             << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us;
+        if (!event.detail.empty()){
+            file << ", \"args\": {\"detail\": " << json_quote(event.detail) << "}";
+        }
+        file << "}";
+        first = false;
+    }
+
+    // threads still running keep recording, so this is meant for when the work being traced is done
+    void save(const std::string& filename){
+        std::lock_guard<std::mutex> guard(lock);
+        std::ofstream file(filename);
+        if (!file.is_open()){
+            std::cerr << "Could not open file " << filename << std::endl;
+            return;
+        }
+        file.precision(12);
+        size_t count = retired.size();
+        bool first = true;
+        file << "{\"traceEvents\": [";
+        std::map<int, std::string> names = retired_names;
+        for (ThreadTrace* thread: threads){
+            names[thread->tid] = thread->name;
+        }
+        for (auto& name: names){
+            if (!name.second.empty()){
+                file << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << name.first
+                     << ", \"args\": {\"name\": " << json_quote(name.second) << "}}";
+                first = false;
+            }
+        }
+        for (auto& event: retired){
+            write_event(file, event.first, event.second, first);
+        }
+        for (ThreadTrace* thread: threads){
+            for (const TraceEvent& event: thread->events){
+                write_event(file, thread->tid, event, first);
+            }
+            count += thread->events.size();
+        }
+        file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+        std::cout << "Wrote " << count << " trace events to " << filename << std::endl;
+    }
+
+    ~TraceRecorder(){
+        if (!TRACE_OUTPUT.empty()){
+            save(TRACE_OUTPUT);
+        }
+    }
+};
+
+TraceRecorder trace_recorder;
+
+ThreadTrace::ThreadTrace(){
+    tid = trace_recorder.add_thread(this);
+    if (std::this_thread::get_id() == trace_recorder.main_thread){
+        name = "main";
+    }
+}
+
+ThreadTrace::~ThreadTrace(){
+    trace_recorder.remove_thread(this);
+}
+
+inline ThreadTrace& thread_trace(){
+    thread_local ThreadTrace trace;
+    return trace;
+}
+
+inline bool tracing(){
+    return !TRACE_OUTPUT.empty();
+}
+
+// names the calling threads track in the trace
+inline void trace_thread_name(const std::string& name){
+    if (tracing()){
+        thread_trace().name = name;
+    }
+}
+
+// records the time from its construction to the end of the enclosing block
+struct TraceScope{
+    const char* name;
+    std::string detail;
+    double start = -1;
+
+    TraceScope(const char* name_, const std::string& detail_ = std::string()) : name(name_){
+        if (tracing()){
+            detail = detail_;
+            start = trace_recorder.now_us();
+        }
+    }
+
+    ~TraceScope(){
+        if (start >= 0){
+            double end = trace_recorder.now_us();
+            thread_trace().events.push_back({name, std::move(detail), start, end - start});
+        }
+    }
+};
+
+#define TRACE_JOIN_NAME(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_JOIN_NAME(trace_scope_, line)
+// TRACE_SCOPE("name") or TRACE_SCOPE("name", detail) times the rest of the block
+#define TRACE_SCOPE(...) TraceScope TRACE_SCOPE_NAME(__LINE__)(__VA_ARGS__)
@@ -3,8 +3,13 @@
 #include "RayHit.h"
 #include "Observable.h"
 #include "Ray.h"
+#include "Counters.h"
 
-unsigned long long triangle_count = 0;
+// ray triangle test, can be picked on the command line to compare them with the kernel benchmarks
+// 0 divides by the determinant up front, 1 tests against the determinant and only divides for hits
+#ifndef TRIANGLE_VARIANT
+#define TRIANGLE_VARIANT 0
+#endif
 
 struct Triangle: public Observable{
     Vector3 vertices[3];
@@ -29,9 +34,10 @@ struct Triangle: public Observable{
         return Vector3::min(vertices[0], Vector3::min(vertices[1], vertices[2]));
     }
 
+#if TRIANGLE_VARIANT == 0
     // moller trumbore algorithm
     inline bool intersect(const Ray& ray, RayHit& inter){
-        triangle_count++;
+        PERF_COUNT(COUNTER_TRIANGLE_TESTS);
         Vector3 v0 = vertices[0];
         Vector3 v1 = vertices[1];
         Vector3 v2 = vertices[2];
@@ -57,6 +63,7 @@ struct Triangle: public Observable{
 
         float t = Vector3::dot(v0v2,qvec) * invdet;
         if (t > EPSILON && t < inter.distance){
+            PERF_COUNT(COUNTER_TRIANGLE_HITS);
             inter.distance = t;
             inter.index = face_index;
             inter.hu = u;
@@ -65,4 +72,45 @@ struct Triangle: public Observable{
         }
         return false;
     }
+#else
+    // moller trumbore with the barycentrics and distance kept scaled by the determinant
+    // so rays that miss never pay for the division
+    inline bool intersect(const Ray& ray, RayHit& inter){
+        PERF_COUNT(COUNTER_TRIANGLE_TESTS);
+        Vector3 v0v1 = vertices[1] - vertices[0];
+        Vector3 v0v2 = vertices[2] - vertices[0];
+        Vector3 pvec = Vector3::cross(ray.direction, v0v2);
+        float det = Vector3::dot(v0v1, pvec);
+        if (det == 0){
+            return false;
+        }
+        // flip everything to a positive determinant so the range tests have one form
+        float sign = (det > 0) ? 1.0f : -1.0f;
+        float adet = det * sign;
+
+        Vector3 tvec = ray.origin - vertices[0];
+        float u = Vector3::dot(tvec, pvec) * sign;
+        if (u < 0 || u > adet){
+            return false;
+        }
+
+        Vector3 qvec = Vector3::cross(tvec, v0v1);
+        float v = Vector3::dot(ray.direction, qvec) * sign;
+        if (v < 0 || u + v > adet){
+            return false;
+        }
+
+        float t = Vector3::dot(v0v2, qvec) * sign;
+        if (t <= EPSILON * adet || t >= inter.distance * adet){
+            return false;
+        }
+        PERF_COUNT(COUNTER_TRIANGLE_HITS);
+        float invdet = 1.0f / adet;
+        inter.distance = t * invdet;
+        inter.index = face_index;
+        inter.hu = u * invdet;
+        inter.hv = v * invdet;
+        return true;
+    }
+#endif
 };
\ No newline at end of file
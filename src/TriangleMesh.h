@@ -5,31 +5,53 @@
 #include "BVH.h"
 #include "OctreeRec.h"
 #include "Mat4.h"
+#include "Simplify.h"
+#include "ObjParser.h"
+#include "CostAttribution.h"
+#include "MemoryAccounting.h"
+#include <algorithm>
 
 #define BUILD_OCTREE 0
 uint OCTREE_DEPTH = 7;
 
-std::string replace_slash(std::string str){
-    std::string newStr = "";
-    for (int i = 0; i < str.length(); i++){
-        if (str[i] == '/'){
-            newStr += " ";
-        }
-        else {
-            newStr += str[i];
-        }
-    }
-    return newStr;
-}
+// levels of detail are only generated for meshes with at least LOD_MIN_FACES faces
+#define BUILD_LODS 1
+uint LOD_LEVELS = 4;
+uint LOD_MIN_FACES = 5000;
+// largest simplification error allowed, as a fraction of the bounding box diagonal
+float LOD_MAX_ERROR = 0.05f;
+// largest simplification error allowed on screen, in pixels
+float LOD_PIXEL_ERROR = 0.5f;
+
+struct MeshLOD{
+    // faces index the vertex arrays of the full resolution mesh
+    std::vector<Face> faces;
+    // only built while the level is selected, see select_lod
+    std::shared_ptr<Observable> tree;
+    // world space error of the simplification
+    float error;
+};
+
 
 struct TriangleMesh: public Observable{
+    // from the OBJ o line or the glTF mesh, used to report what each mesh costs
+    std::string name;
     std::vector<Vector3> vertices;
     std::vector<Vector3> normals;
     std::vector<Vector3> texcoords;
-    std::vector<std::vector<int>> faces;
+    std::vector<Face> faces;
     Mat4 object_matrix;
     Vector3 boundingBox[2];
     std::shared_ptr<Observable> tree;
+    std::vector<MeshLOD> lods;
+    // 0 is full resolution, otherwise lods[lod - 1]
+    int lod = 0;
+    // what the meshes rays and hits are charged to, see CostAttribution
+    int cost_id = -1;
+    // set for meshes that can be freed while their hits are still being shaded, see GeometryCache
+    const Material* arena_material = nullptr;
+    MemoryCharge attribute_memory = MemoryCharge(MEMORY_MESH_ATTRIBUTES);
+    MemoryCharge index_memory = MemoryCharge(MEMORY_INDICES);
 
     TriangleMesh(){
         object_matrix = Mat4();
@@ -48,122 +70,36 @@ struct TriangleMesh: public Observable{
     // }
 
     TriangleMesh(const std::string& filename, Material material_){
-        std::ifstream file(filename);
-        if(!file.is_open()){
-            std::cerr << "Could not open file " << filename << std::endl;
+        ObjData obj;
+        if (!parse_obj(filename, obj)){
             return;
         }
         mat = material_;
-        std::string line;
-        while(std::getline(file, line)){
-            if(line.empty()) continue;
-            if(line[0] == 'v'){
-                std::istringstream iss(line);
-                std::string type;
-                iss >> type;
-                // vertex
-                if(type == "v"){
-                    Vector3 v;
-                    iss >> v.x >> v.y >> v.z;
-                    vertices.push_back(v);
-                }
-                // vertex normal
-                else if(type == "vn"){
-                    Vector3 vn;
-                    iss >> vn.x >> vn.y >> vn.z;                     
-                    normals.push_back(vn);
-                }
-                // vertex texture
-                else if(type == "vt"){
-                    Vector3 vt;
-                    iss >> vt.x >> vt.y;
-                    texcoords.push_back(vt);
-                }
-            }
-            // face
-            else if (line[0] == 'f'){
-                std::vector<int> face;
-                parse_face(face, line);
-                faces.push_back(face);
-            }
+        name = filename;
+        vertices = std::move(obj.vertices);
+        normals = std::move(obj.normals);
+        texcoords = std::move(obj.texcoords);
+        faces = std::move(obj.faces);
+        // faces without texcoords index them with the vertex index
+        if (texcoords.size() == 0){
+            texcoords.resize(vertices.size(), Vector3(0,0,0));
         }
+        // calculate normals if they are not given
         if (normals.size() == 0){
             calculate_normals();
         }
-        file.close();
-        // calculate normals if they are not given
         recalc_bounding_box();
     }
 
-    void parse_face(std::vector<int>& face, std::string line){
-        std::istringstream iss(line);
-        std::string type;
-        iss >> type;
-        std::string fc;
-
-        while (iss >> fc){
-            fc = replace_slash(fc);
-            int v;
-            std::istringstream fcss(fc);
-            fcss >> v;
-            face.push_back(v);
-            fcss >> v;
-            face.push_back(v);
-            fcss >> v;
-            face.push_back(v);
-        }
-
-        int ftype = face_type(line);
-        if (ftype == 1){
-            face[2] = face[0];
-            face[5] = face[3];
-            face[8] = face[6];
-            return;
-        }
-        else if(ftype == -1){
-            std::cerr << "Unknown face type" << std::endl;
-            return;
-        }
-    }
-
-    int face_type(std::string line){
-        // type 0 - f 1/2/3 4/5/6 7/8/9
-        // type 1 - f 1/2 3/4 5/6
-        // type 2 - f 1//2 3//4 5//6
-        // type 3 - f 1 2 3
-        if (line.find("//") != std::string::npos){
-            return 2;
-        }
-        if (line.find("/") == std::string::npos){
-            return 3;
-        }
-        // count number of "/"
-        int count = 0;
-        for (int i = 0; i < line.length(); i++){
-            if (line[i] == '/'){
-                count++;
-            }
-        }
-        if (count == 6){
-            return 0;
-        }
-        else if (count == 3){
-            return 1;
-        }
-        else {
-            std::cout << line << std::endl;
-            std::cerr << "Unknown face type" << std::endl;
-            return -1;
-        }
-    }
-
 
+    // smooth normals from the faces around each normal index
     void calculate_normals(){
-        normals.clear();
-        for (int i = 0; i < faces.size(); i++){
-            normals.push_back(Vector3(0,0,0));
+        int normal_count = 0;
+        for (const Face& face: faces){
+            normal_count = std::max({normal_count, face[2], face[5], face[8]});
         }
-        for (auto face: faces){
+        normals.assign(normal_count, Vector3(0,0,0));
+        for (const Face& face: faces){
             Vector3 v0 = vertices[face[0] - 1];
             Vector3 v1 = vertices[face[3] - 1];
             Vector3 v2 = vertices[face[6] - 1];
@@ -193,20 +129,115 @@ struct TriangleMesh: public Observable{
         std::cout << "vmax: " << vmax << std::endl;
         boundingBox[0] = vmin;
         boundingBox[1] = vmax;
+        account_memory();
     }
 
-    void recalc_tree(){
-        std::vector<std::shared_ptr<Observable>> triangles;
-        for (int i = 0; i < faces.size(); i++){
-            std::vector<int> face = faces[i];
-            Triangle tri = Triangle(vertices[face[0] - 1], vertices[face[3] - 1], vertices[face[6] - 1], i);
-            triangles.push_back(std::make_shared<Triangle>(tri));
+    // charges what the arrays and levels take up now, called whenever they have changed
+    // the triangles are charged by the trees that hold them
+    void account_memory(){
+        attribute_memory.set((vertices.capacity() + normals.capacity() + texcoords.capacity()) * sizeof(Vector3));
+        size_t index_bytes = faces.capacity() * sizeof(Face);
+        for (const MeshLOD& level: lods){
+            index_bytes += level.faces.capacity() * sizeof(Face);
         }
+        index_memory.set(index_bytes);
+#if COST_ATTRIBUTION
+        // every loader gets here once the name is set
+        cost_id = object_cost_id(name, faces.size());
+#endif
+    }
+
+    // what hits on the mesh are shaded with
+    inline const Material* material() const{
+        return (arena_material != nullptr) ? arena_material : &mat;
+    }
+
+    std::vector<Triangle> build_triangles(const std::vector<Face>& faces_){
+        std::vector<Triangle> triangles;
+        triangles.reserve(faces_.size());
+        for (int i = 0; i < (int) faces_.size(); i++){
+            const Face& face = faces_[i];
+            triangles.emplace_back(vertices[face[0] - 1], vertices[face[3] - 1], vertices[face[6] - 1], i);
+        }
+        return triangles;
+    }
+
+    std::shared_ptr<Observable> build_tree(std::vector<Face>& faces_){
 #if BUILD_OCTREE
-        tree = std::make_shared<Octree>(boundingBox, faces, vertices, OCTREE_DEPTH);
+        return std::make_shared<Octree>(boundingBox, faces_, vertices, OCTREE_DEPTH);
 #else
-        tree = std::make_shared<BVH>(triangles);
+        return std::make_shared<BVH>(build_triangles(faces_));
+#endif
+    }
+
+    void recalc_tree(){
+        tree = build_tree(faces);
+#if BUILD_LODS
+        build_lods();
 #endif
+        account_memory();
+    }
+
+    // simplify the mesh into a chain of levels, each with about half the faces of the last
+    // their trees are left to select_lod, so loading never holds a tree for every level at once
+    void build_lods(){
+        TRACE_SCOPE("build_lods", name);
+        lods.clear();
+        lod = 0;
+        if (faces.size() < LOD_MIN_FACES){
+            return;
+        }
+        float diagonal = Vector3::length(boundingBox[1] - boundingBox[0]);
+        MeshSimplifier simplifier = MeshSimplifier(vertices, faces);
+        int face_count = faces.size();
+        for (uint i = 0; i < LOD_LEVELS; i++){
+            simplifier.run(face_count / 2, LOD_MAX_ERROR * diagonal);
+            // stop once the error bound stops the simplifier making progress
+            if (simplifier.alive_faces > face_count * 0.9f){
+                break;
+            }
+            face_count = simplifier.alive_faces;
+            SimplifiedLevel level = simplifier.snapshot();
+            MeshLOD mesh_lod;
+            mesh_lod.faces = level.faces;
+            mesh_lod.error = level.error;
+            lods.push_back(mesh_lod);
+        }
+    }
+
+    // the tree of the level in use
+    std::shared_ptr<Observable>& active_tree(){
+        return (lod == 0) ? tree : lods[lod - 1].tree;
+    }
+
+    // pick the coarsest level whose error projects to less than LOD_PIXEL_ERROR pixels
+    // only the chosen levels tree is kept, it is built from its faces the first time a camera wants it
+    void select_lod(const Camera& cam){
+        lod = 0;
+        if (lods.empty()){
+            return;
+        }
+        // distance to the closest point of the bounding box
+        Vector3 closest = Vector3::max(boundingBox[0], Vector3::min(cam.position, boundingBox[1]));
+        float dist = Vector3::length(closest - cam.position);
+        // world space size of a pixel at that distance
+        float pixel_size = dist * cam.x_step_m;
+        for (int i = 0; i < (int) lods.size(); i++){
+            if (lods[i].error > LOD_PIXEL_ERROR * pixel_size){
+                break;
+            }
+            lod = i + 1;
+        }
+        for (int i = 0; i <= (int) lods.size(); i++){
+            std::vector<Face>& level_faces = (i == 0) ? faces : lods[i - 1].faces;
+            std::shared_ptr<Observable>& level_tree = (i == 0) ? tree : lods[i - 1].tree;
+            if (i != lod){
+                level_tree = nullptr;
+            }
+            else if (level_tree == nullptr){
+                level_tree = build_tree(level_faces);
+            }
+        }
     }
 
     Vector3 centroid(){
@@ -236,33 +267,74 @@ struct TriangleMesh: public Observable{
     }
 
 
-    ~TriangleMesh(){
-        vertices.clear();
-        normals.clear();
-        texcoords.clear();
-        faces.clear();
+    // intersect the differential rays with the plane of the hit triangle
+    // and difference their texture coordinates with the main hit
+    TextureFootprint footprint(const Ray& ray, const Face& face, const Vector3& uv){
+        TextureFootprint result;
+        Vector3 v0 = vertices[face[0] - 1];
+        Vector3 e1 = vertices[face[3] - 1] - v0;
+        Vector3 e2 = vertices[face[6] - 1] - v0;
+        Vector3 n = Vector3::cross(e1, e2);
+        float nn = Vector3::dot(n, n);
+        if (nn == 0){
+            return result;
+        }
+        float d = Vector3::dot(n, v0);
+        float denom_x = Vector3::dot(n, ray.rx_direction);
+        float denom_z = Vector3::dot(n, ray.rz_direction);
+        if (denom_x == 0 || denom_z == 0){
+            return result;
+        }
+        Vector3 px = ray.rx_origin + ray.rx_direction * ((d - Vector3::dot(n, ray.rx_origin)) / denom_x);
+        Vector3 pz = ray.rz_origin + ray.rz_direction * ((d - Vector3::dot(n, ray.rz_origin)) / denom_z);
+
+        Vector3 t0 = texcoords[face[1] - 1];
+        Vector3 t1 = texcoords[face[4] - 1];
+        Vector3 t2 = texcoords[face[7] - 1];
+        // barycentric coordinates of a point on the triangles plane
+        auto interpolate = [&](Vector3 p){
+            Vector3 w = p - v0;
+            float b1 = Vector3::dot(Vector3::cross(w, e2), n) / nn;
+            float b2 = Vector3::dot(Vector3::cross(e1, w), n) / nn;
+            return t0 * (1 - b1 - b2) + t1 * b1 + t2 * b2;
+        };
+        Vector3 duv_x = interpolate(px) - uv;
+        Vector3 duv_z = interpolate(pz) - uv;
+        result.dudx = duv_x.x;
+        result.dvdx = duv_x.y;
+        result.dudy = duv_z.x;
+        result.dvdy = duv_z.y;
+        return result;
     }
 
     bool intersect(const Ray& ray, RayHit& inter){
-        bool hit = tree->intersect(ray, inter);
+#if COST_ATTRIBUTION
+        ObjectCostScope scope(object_cost(cost_id));
+#endif
+        std::vector<Face>& active_faces = (lod == 0) ? faces : lods[lod - 1].faces;
+        bool hit = active_tree()->intersect(ray, inter);
         // check if we had a intersection of a triangle
         if (!hit){
             return false;
         }
         
         // index is greater than -1 if there is an intersection
+        inter.object = cost_id;
         inter.point = ray.at(inter.distance);
-        auto face = faces[inter.index];
+        auto& face = active_faces[inter.index];
         // if (Ntex->implemented){
         //     inter.normal = Ntex->get_colour(inter.u, inter.v);
         // }
         // else{
             inter.normal = Vector3::normalize(normals[face[2] - 1] * (1 - inter.hu - inter.hv) + normals[face[5] - 1] * inter.hu + normals[face[8] - 1] * inter.hv);
         //}
-        inter.mat = std::make_shared<Material>(mat);
+        inter.mat = material();
         Vector3 uv = texcoords[face[1] - 1] * (1 - inter.hu - inter.hv) + texcoords[face[4] - 1] * inter.hu + texcoords[face[7] - 1] * inter.hv;
         inter.u = uv.x;
         inter.v = uv.y;
+        if (ray.has_differentials){
+            inter.footprint = footprint(ray, face, uv);
+        }
         return true;
     }
 };
\ No newline at end of file
@@ -6,7 +6,13 @@
 #define FINF 1e30f
 
 const float EPSILON = 0.000001;
-uint32_t state = 727;
+// per thread so render threads don't share (and race on) one generator
+thread_local uint32_t state = 727;
+
+// restart the calling threads sequence, used to make sampling independent of thread scheduling
+void seed_random(uint32_t seed){
+	state = seed * 747796405 + 727;
+}
 
 float random_value(){
 	state = state * 747796405 + 2891336453;